@@ -0,0 +1,90 @@
+/**
+ * Benchmarks the ASCII kernels of strutil against their scalar versions and
+ * the per-character `std::tolower` they replaced.
+ *
+ * Build with -DHTTPSERVER_BENCHMARKS=ON and run `strutil_bench`. Every case
+ * is timed over enough iterations to take a few hundred milliseconds, and
+ * the time per call is printed.
+ */
+#include "strutil.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fmt/format.h>
+#include <string>
+
+/* Keeps the compiler from optimizing away work whose result is unused */
+template <typename T> static void keep(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * Run `f` repeatedly and print the average time of a call in nanoseconds.
+ */
+template <typename F> static void bench(const char *name, F &&f) {
+  using clock = std::chrono::steady_clock;
+  // warm up, and find out how many iterations fill the time budget
+  std::size_t iterations = 1;
+  for (;;) {
+    auto start = clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+      f();
+    }
+    if (clock::now() - start > std::chrono::milliseconds(50)) {
+      break;
+    }
+    iterations *= 2;
+  }
+  iterations *= 4;
+  auto start = clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    f();
+  }
+  std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+  fmt::print("{:<40} {:>9.1f} ns\n", name, elapsed.count() / iterations);
+}
+
+/* How `strutil::lowers` worked before the ASCII kernels */
+static std::string lowers_tolower(const std::string &s) {
+  std::string out(s);
+  std::transform(out.begin(), out.end(), out.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return out;
+}
+
+int main() {
+  const std::string line =
+      "Accept-Encoding: GZIP, Deflate, BR; Q=0.9, Identity; Q=0.1 \r\n";
+  const std::string name = "X-Forwarded-For-Some-Long-Header-Name-40";
+  const std::string value = std::string(512, 'v') + "\tvalue";
+  std::string buffer = line;
+
+  fmt::print("{} byte header line, {} byte header name, {} byte value\n\n",
+             line.size(), name.size(), value.size());
+
+  bench("lowers with std::tolower", [&] { keep(lowers_tolower(line)); });
+  bench("strutil::lowers", [&] { keep(strutil::lowers(line)); });
+  bench("ascii_lower (scalar)", [&] {
+    strutil::detail::ascii_case_scalar<false>(line.data(), buffer.data(),
+                                              line.size());
+    keep(buffer);
+  });
+  bench("ascii_lower", [&] {
+    strutil::ascii_lower(line.data(), buffer.data(), line.size());
+    keep(buffer);
+  });
+  bench("ascii_lower_inplace", [&] {
+    strutil::ascii_lower_inplace(buffer);
+    keep(buffer);
+  });
+
+  bench("is_token (scalar)", [&] {
+    keep(strutil::detail::is_token_scalar(name.data(), name.size()));
+  });
+  bench("is_token", [&] { keep(strutil::is_token(name)); });
+
+  bench("has_control_chars (scalar)", [&] {
+    keep(strutil::detail::has_ctl_scalar(value.data(), value.size()));
+  });
+  bench("has_control_chars", [&] { keep(strutil::has_control_chars(value)); });
+}
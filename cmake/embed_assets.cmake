@@ -0,0 +1,151 @@
+# Script mode helper for `add_static_assets` (see CMakeLists.txt).
+#
+# Turns every regular file under ASSET_DIR into a constexpr byte array and
+# writes a header containing a table of `EmbeddedAsset`s sorted by path, so
+# lookups can be done with a binary search at compile time or at runtime.
+#
+# Expected variables (passed in with -D):
+#   ASSET_DIR  the directory to embed
+#   ASSET_NAME the namespace the generated table lives in
+#   OUTPUT     the path of the header to generate
+#   WORK_DIR   scratch directory for the precompressed variants
+#   BROTLI     (optional) path to the `brotli` executable
+
+cmake_minimum_required(VERSION 3.23.2)
+
+# Build-time MIME table. Anything not listed here is served as
+# application/octet-stream
+set(MIME_.html "text/html")
+set(MIME_.htm "text/html")
+set(MIME_.css "text/css")
+set(MIME_.js "text/javascript")
+set(MIME_.mjs "text/javascript")
+set(MIME_.json "application/json")
+set(MIME_.map "application/json")
+set(MIME_.txt "text/plain")
+set(MIME_.xml "application/xml")
+set(MIME_.svg "image/svg+xml")
+set(MIME_.png "image/png")
+set(MIME_.jpg "image/jpeg")
+set(MIME_.jpeg "image/jpeg")
+set(MIME_.gif "image/gif")
+set(MIME_.webp "image/webp")
+set(MIME_.ico "image/x-icon")
+set(MIME_.woff "font/woff")
+set(MIME_.woff2 "font/woff2")
+set(MIME_.wasm "application/wasm")
+set(MIME_.pdf "application/pdf")
+
+# Text types compress well and are worth spending build time on
+set(COMPRESSIBLE .html .htm .css .js .mjs .json .map .txt .xml .svg .wasm)
+
+# Stores `value` in the variable named by `out` as a C++ string literal,
+# quotes included, with the characters which would end or change it escaped
+function(string_literal value out)
+  string(REPLACE "\\" "\\\\" value "${value}")
+  string(REPLACE "\"" "\\\"" value "${value}")
+  string(REPLACE "\n" "\\n" value "${value}")
+  set(${out} "\"${value}\"" PARENT_SCOPE)
+endfunction()
+
+# Emits a constexpr char array called `${var_name}` holding the bytes of
+# `file` into the variable named by `out`
+function(bytes_to_array file var_name out)
+  file(READ ${file} hex HEX)
+  # keep the lines at a sane length for the compiler and for humans
+  string(REPEAT "[0-9a-f]" 32 line)
+  string(REGEX REPLACE "(${line})" "\\1\n    " hex "${hex}")
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "'\\\\x\\1'," bytes "${hex}")
+  set(${out} "inline constexpr char ${var_name}[] = {\n    ${bytes}};\n" PARENT_SCOPE)
+endfunction()
+
+file(GLOB_RECURSE files LIST_DIRECTORIES false RELATIVE ${ASSET_DIR}
+     ${ASSET_DIR}/*)
+list(SORT files)
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+set(arrays "")
+set(entries "")
+set(index 0)
+foreach(rel ${files})
+  set(path ${ASSET_DIR}/${rel})
+  file(SIZE ${path} size)
+  get_filename_component(ext ${rel} LAST_EXT)
+  string(TOLOWER "${ext}" ext)
+
+  set(mime "application/octet-stream")
+  if(DEFINED MIME_${ext})
+    set(mime ${MIME_${ext}})
+  endif()
+
+  file(SHA1 ${path} sha)
+  string(SUBSTRING ${sha} 0 20 etag)
+
+  set(data "{}")
+  set(gzip "{}")
+  set(br "{}")
+  if(size GREATER 0)
+    bytes_to_array(${path} data_${index} array)
+    string(APPEND arrays "${array}")
+    set(data "{detail::data_${index}, sizeof(detail::data_${index})}")
+
+    if(ext IN_LIST COMPRESSIBLE)
+      set(gz_path ${WORK_DIR}/${index}.gz)
+      file(ARCHIVE_CREATE OUTPUT ${gz_path} PATHS ${path} FORMAT raw
+           COMPRESSION GZip COMPRESSION_LEVEL 9)
+      file(SIZE ${gz_path} gz_size)
+      # only keep the variant if it actually saves bytes on the wire
+      if(gz_size LESS size)
+        bytes_to_array(${gz_path} gzip_${index} array)
+        string(APPEND arrays "${array}")
+        set(gzip "{detail::gzip_${index}, sizeof(detail::gzip_${index})}")
+      endif()
+
+      if(BROTLI)
+        set(br_path ${WORK_DIR}/${index}.br)
+        execute_process(COMMAND ${BROTLI} -f -q 11 -o ${br_path} ${path}
+                        RESULT_VARIABLE br_result)
+        if(br_result EQUAL 0)
+          file(SIZE ${br_path} br_size)
+          if(br_size LESS size)
+            bytes_to_array(${br_path} br_${index} array)
+            string(APPEND arrays "${array}")
+            set(br "{detail::br_${index}, sizeof(detail::br_${index})}")
+          endif()
+        endif()
+      endif()
+    endif()
+  endif()
+
+  string_literal("/${rel}" path_literal)
+  string_literal("${mime}" mime_literal)
+  string(APPEND entries
+         "    {${path_literal}, ${data}, ${gzip}, ${br},\n"
+         "     R\"(\"${etag}\")\", ${mime_literal}},\n")
+  math(EXPR index "${index} + 1")
+endforeach()
+
+string(TOUPPER "${ASSET_NAME}_ASSETS_HPP" guard)
+set(content "// Generated by add_static_assets() from ${ASSET_DIR}. Do not edit.
+#ifndef ${guard}
+#define ${guard}
+
+#include <embedded_assets.hpp>
+
+namespace ${ASSET_NAME} {
+namespace detail {
+${arrays}} // namespace detail
+
+/**
+ * Every file under ${ASSET_DIR}, sorted by path.
+ */
+inline constexpr EmbeddedAsset assets[] = {
+${entries}};
+
+static_assert(is_sorted_by_path(assets),
+              \"embedded assets must be sorted for find_embedded_asset\");
+} // namespace ${ASSET_NAME}
+
+#endif // !${guard}
+")
+file(WRITE ${OUTPUT} "${content}")
@@ -18,6 +18,9 @@
 /* sockaddr_in struct for defining a internet address */
 #include <netinet/in.h>
 
+/* TCP_NODELAY and the other TCP level socket options */
+#include <netinet/tcp.h>
+
 /* provides type definitions for a lot of interfaces */
 #include <sys/types.h>
 
@@ -58,10 +61,43 @@
 /* getipaddr function for easy hostname to IP address conversion */
 #include "get_ip.hpp"
 
+/* EmbeddedAsset tables generated at build time by `add_static_assets` */
+#include "embedded_assets.hpp"
+
+/* mmap-ed asset packs generated at build time by `asset_packer` */
+#include "asset_pack.hpp"
+
+/* file extension to Content-Type lookups for static files */
+#include "mime_types.hpp"
+
+/* json::writer for building JSON straight into response bodies */
+#include "json.hpp"
+
+/* precompiled templates for server rendered pages */
+#include "html_template.hpp"
+
+/* per client token buckets */
+#include "rate_limiter.hpp"
+
+/* CIDR allow/deny rules checked when accepting connections */
+#include "ip_filter.hpp"
+
+/* redirects answered before routing */
+#include "redirect_table.hpp"
+
+/* settings loaded from a config file */
+#include "server_config.hpp"
+
+/* noticing clients which hang up while their request is handled */
+#include "disconnect_monitor.hpp"
+
 /* provides the sig_atomic_t type so that the program can exit gracefully when
  * interrupted */
 #include <atomic>
 
+/* steady_clock for request deadlines */
+#include <chrono>
+
 /* for specific int types such as uint16_t */
 #include <cstdint>
 
@@ -73,10 +109,58 @@
 
 /* map to store routing information in HttpServer */
 #include <map>
+
+/* the different kinds of response bodies */
+#include <variant>
+
+/* shared_ptr for resources which are shared between copies of HttpServer */
+#include <memory>
 /*************************INCLUDES END**************************/
 
 #define BIND_RETRY_COUNT 5
 #define DEFAULT_PORT 3000
+/* The most connections accepted in a row before the accept loop checks
+   for signals again */
+#define ACCEPT_BATCH_SIZE 64
+
+/**
+ * A region of an open file to be sent as a response body with `sendfile`,
+ * without ever being read into memory.
+ *
+ * `owner` keeps `fd` open for as long as the response needs it, i.e. the
+ * AssetPack the region points into.
+ */
+struct FileRegion {
+  int fd;
+  off_t offset;
+  std::size_t length;
+  std::shared_ptr<const void> owner;
+};
+
+/**
+ * A body which is produced while it is being sent, using chunked transfer
+ * encoding. `produce` appends to `buffer` and calls `flush` whenever what it
+ * has so far should be sent as a chunk (`flush` clears `buffer`).
+ */
+struct StreamedBody {
+  std::function<void(std::string &buffer, const std::function<void()> &flush)>
+      produce;
+};
+
+/**
+ * The body of a HttpResponse, which is one of:
+ * 1. a string owned by the response
+ * 2. a shared, immutable buffer, so that cached content costs a refcount bump
+ *    per response instead of a copy
+ * 3. a view of storage which outlives the server, i.e. embedded assets
+ * 4. a region of a file
+ * 5. a stream of chunks
+ * 6. a rendered template, whose static text is sent straight out of the
+ *    template
+ */
+using ResponseBody =
+    std::variant<std::string, std::shared_ptr<const std::string>,
+                 std::string_view, FileRegion, StreamedBody, RenderedTemplate>;
 
 /**
  * struct which encapulates the contents of a HttpResponse
@@ -89,11 +173,45 @@
  * response
  */
 struct HttpResponse {
+  /**
+   * HttpServer sends responses with a pending file on its file I/O pool
+   */
+  friend class HttpServer;
+
 private:
   std::map<std::string, std::string> _headers;
-  std::string _body;
+  ResponseBody _body;
   uint16_t _status_code;
 
+  /**
+   * Path to a file which is to become the body, but wasn't in the page cache
+   * when `static_file` was called. It is read by the server on its file I/O
+   * pool so that the thread running the handler doesn't wait for the disk.
+   */
+  std::string _pending_file;
+
+  /**
+   * Read `_pending_file` into the body, blocking until it is read.
+   *
+   * @throw std::runtime_error if the file cannot be opened
+   */
+  void load_pending_file();
+
+  /**
+   * Forget any pending file, since the body is about to be replaced, and
+   * return the body to replace.
+   */
+  ResponseBody &reset_body();
+
+  /**
+   * Move an owned string body into a shared buffer, so that copies of this
+   * response share it instead of copying it.
+   */
+  void share_body();
+
+  /* The length of the body in bytes, whatever kind of body it is */
+  std::size_t body_size() const;
+
 public:
   /**
    * This constructor simply sets the default status code to be 200
@@ -112,9 +230,22 @@ public:
    * formatted string.
    *
    * @return The fully formatted HTTP response as a string
+   * @throw std::runtime_error if a file body can no longer be read in full
    */
   std::string get_full_response() const;
 
+  /**
+   * Write the full HTTP response to `connfd`.
+   * Unlike `get_full_response()`, the body is never copied: the headers and
+   * body are written together with `writev`, or with `sendfile` if the body
+   * is a FileRegion.
+   *
+   * @param connfd The file descriptor of the client
+   * @return false if the client went away before the whole response was
+   * written
+   */
+  bool write_to(int connfd) const;
+
   /**
    * Return the headers of the HTTP response in a formatted string.
    * This method is basically identical to `get_full_response()`, just
@@ -142,6 +273,41 @@ public:
    */
   void set_status_code(const int &status_code);
 
+  /**
+   * Set the body of the HTTP response to `body` as is.
+   * This method does not set the Content-Type of the HTTP response,
+   * so the user has to specify the Content-Type using `set_header`.
+   *
+   * @param body The raw HTTP response body
+   */
+  void set_body(const std::string &body);
+
+  /**
+   * Set the body of the HTTP response to a shared, immutable buffer.
+   * The buffer is not copied, which makes this the cheapest way to send
+   * content that is cached by the handler.
+   *
+   * @param body The buffer to be sent
+   */
+  void set_body(std::shared_ptr<const std::string> body);
+
+  /**
+   * Set the body of the HTTP response to a region of an open file, which is
+   * sent with `sendfile`.
+   *
+   * @param region The region of the file to be sent
+   */
+  void set_body(FileRegion region);
+
+  /**
+   * Set the body of the HTTP response to `body` without copying it.
+   * The storage `body` points into must outlive the server, i.e. string
+   * literals or embedded assets.
+   *
+   * @param body A view of the raw HTTP response body
+   */
+  void set_static_body(std::string_view body);
+
   /**
    * Set the Content-Type of the HTTP response to "text/plain",
    * and the response body to `msg`.
@@ -156,6 +322,9 @@ public:
    * This method does not set the Content-Type of the HTTP response,
    * so the user has to specify the Content-Type using `set_header`.
    *
+   * If the file is not in the page cache, reading it is left to the
+   * server's file I/O pool after the handler returns.
+   *
    * @param path The path to the file
    */
   void static_file(const std::string &path);
@@ -195,6 +364,18 @@ public:
    */
   void html_string(const std::string &html_string);
 
+  /**
+   * Set the Content-Type of the HTTP response to
+   * "text/html" and render `tmpl` with `args` as the body of the response.
+   *
+   * Only the slot values are copied into the response: the static parts
+   * of the template are written out of the template itself.
+   *
+   * @param tmpl The template to render
+   * @param args The values of the template's slots
+   */
+  void render(const HtmlTemplate &tmpl, const HtmlTemplate::Args &args);
+
   /**
    * Set the Content-Type of the HTTP response to
    * "application/json" and set the body of the response
@@ -204,6 +385,29 @@ public:
    */
   void json(const std::string &json_string);
 
+  /**
+   * Set the Content-Type of the HTTP response to
+   * "application/json" and return a `json::writer` which writes
+   * straight into the body of the response.
+   *
+   * The writer is only valid until the body of the response is set
+   * again.
+   *
+   * @return A writer for the response body
+   */
+  json::writer json_writer();
+
+  /**
+   * Set the Content-Type of the HTTP response to
+   * "application/json" and stream the body with chunked transfer encoding.
+   * `producer` is called while the response is being sent, and the writer
+   * it is given sends a chunk every 16KB or so, which keeps large arrays
+   * from being built in memory all at once.
+   *
+   * @param producer Writes the JSON body
+   */
+  void json_stream(std::function<void(json::writer &)> producer);
+
   /**
    * Set the Content-Type of the HTTP response to `content_type` and
    * the Content-Dispostion to "attachment".
@@ -219,6 +423,9 @@ public:
   void redirect(const std::string &new_location, const int &status_code = 301);
 };
 
+/* Defined in HttpServer.cpp */
+class ThreadPool;
+
 /**
  * A struct to encapsulate the contents of a HttpRequest
  */
@@ -227,13 +434,32 @@ struct HttpRequest {
    * Friend function which reads the body of a HTTP request into
    * the struct, if there's any.
    */
-  friend void handle_request_body(int connfd, HttpRequest &req);
+  friend void handle_request_body(int connfd, HttpRequest &req,
+                                  std::size_t size_to_read);
+  friend class HttpServer;
 
 private:
   std::map<std::string, std::string> _headers;
   std::string _body;
   std::string _method;
   std::string _route;
+  sockaddr_storage _peer{};
+  /* Set by the DisconnectMonitor, if the connection is being watched */
+  std::shared_ptr<std::atomic<bool>> _cancelled;
+  /* When the connection was accepted, which deadlines count from */
+  std::chrono::steady_clock::time_point _received =
+      std::chrono::steady_clock::now();
+  /* Mutable so that the `timeout` middleware can move it */
+  mutable std::chrono::steady_clock::time_point _deadline =
+      std::chrono::steady_clock::time_point::max();
+
+  /**
+   * Set the deadline to `timeout` after the connection was accepted, or
+   * sooner if the client asked for that with X-Request-Timeout.
+   */
+  void set_timeout(std::chrono::milliseconds timeout) const;
+  friend std::function<bool(const HttpRequest &, HttpResponse &)>
+  timeout(std::chrono::milliseconds timeout);
 
 public:
   /**
@@ -245,16 +471,156 @@ public:
    *
    * @param raw_headers the raw HTTP request headers
    * @return A HttpRequest object containing the parsed information
+   * @throw std::invalid_argument if the request line is malformed or its
+   * target contains control characters, or a header has an invalid name or
+   * contains control characters
    */
   HttpRequest(std::string text);
 
   /* Getters for each component of the HttpRequest */
-  std::map<std::string, std::string> headers() const;
-  std::string body() const;
-  std::string method() const;
-  std::string route() const;
+  const std::map<std::string, std::string> &headers() const;
+  const std::string &body() const;
+  const std::string &method() const;
+  const std::string &route() const;
+
+  /**
+   * The length of the body, from the Content-Length header.
+   *
+   * @return The length, or 0 if there is no Content-Length header
+   * @throw std::invalid_argument if the header isn't a decimal number which
+   * fits in a std::size_t
+   */
+  std::size_t content_length() const;
+
+  /* The address of the client which sent the request */
+  const sockaddr_storage &peer() const;
+
+  /* The IP address of the client as text, only formatted when asked for */
+  std::string peer_address() const;
+
+  /**
+   * The host the request was sent to, which is the Host header without
+   * the port, i.e. "example.com" for "Example.com:8080".
+   *
+   * @return The host in lowercase, or an empty view if there is no Host
+   * header
+   */
+  std::string_view host() const;
+
+  /**
+   * Whether the client has hung up since the request was read, in which
+   * case nobody is waiting for the response any more. Handlers doing
+   * expensive work, or producing a streamed body, can check this now and
+   * then and stop early:
+   *
+   * for (const auto &row : rows) {
+   *   if (req.cancelled()) {
+   *     return;
+   *   }
+   *   ...
+   * }
+   *
+   * This is only advisory: a client which shuts down its end of the
+   * connection once it has sent the request (which is allowed) looks the
+   * same as one which went away, so the server still sends the response,
+   * and writing it to a client which is really gone simply fails. Checking
+   * is a single atomic load, since the connection is watched for the
+   * client closing it (EPOLLRDHUP) by another thread. Requests are never
+   * cancelled on platforms other than Linux.
+   */
+  bool cancelled() const;
+
+  /**
+   * When the response is due. The server answers requests whose handler
+   * finishes after it with a 504 instead, and doesn't start handling them
+   * at all once it has passed.
+   *
+   * The deadline counts from when the connection was accepted, and comes
+   * from the `timeout` middleware of the route, or "timeouts.request_ms" in
+   * the config otherwise. Clients can ask for a shorter one (but never a
+   * longer one) with an `X-Request-Timeout` header in milliseconds.
+   *
+   * @return The deadline, or `time_point::max()` if there is none
+   */
+  std::chrono::steady_clock::time_point deadline() const;
+
+  /**
+   * The time left until the deadline, i.e. to pass on to the services a
+   * handler calls so that they give up when the response can't be used:
+   *
+   * upstream.set_header("X-Request-Timeout",
+   *                     std::to_string(req.time_left().count()));
+   *
+   * @return The time left, which is 0 once the deadline has passed, or
+   * `milliseconds::max()` if there is no deadline
+   */
+  std::chrono::milliseconds time_left() const;
+
+  /**
+   * Read the body of the request as JSON, on demand: nothing is parsed
+   * until the handler asks for it, and the body is read in place without
+   * being copied.
+   *
+   * auto doc = req.json();
+   * auto name = doc.root()["name"].get_string();
+   *
+   * A `json::error` thrown out of a handler is answered with a 400.
+   *
+   * @return A reader over the body, which must not outlive the request
+   */
+  json::document json() const;
 };
 
+/**
+ * Compose middleware and a handler into a single route function at compile
+ * time, so that calling the chain costs no more than calling the functions
+ * one after the other.
+ *
+ * Each middleware has the signature
+ * bool f(const HttpRequest &, HttpResponse &res)
+ * and returns false to stop the request from going any further, after
+ * filling in `res` itself (i.e. with a 401).
+ *
+ * svr.get("/admin", compose(require_auth, cors)(admin_page));
+ *
+ * @param middleware The middleware to run before the handler, in order
+ * @return A function which takes the handler and returns the route function
+ */
+template <typename... Middleware> auto compose(Middleware... middleware) {
+  return [=](auto handler) {
+    return [=](const HttpRequest &req, HttpResponse &res) {
+      if ((middleware(req, res) && ...)) {
+        handler(req, res);
+      }
+    };
+  };
+}
+
+/**
+ * Middleware which limits each client to `requests_per_second` requests per
+ * second, with bursts of up to `burst` requests, and answers the requests
+ * over the limit with a 429. Every call creates a separate limit, i.e. for
+ * one route:
+ *
+ * svr.post("/login", {rate_limit(1, 5)}, login);
+ *
+ * @throw std::invalid_argument if the limit is invalid, see `RateLimiter`
+ */
+std::function<bool(const HttpRequest &, HttpResponse &)>
+rate_limit(double requests_per_second, double burst);
+
+/**
+ * Middleware which gives requests `timeout` (counted from when their
+ * connection was accepted) to be answered in, in place of the default
+ * from the config (see `HttpRequest::deadline`). Requests which are already
+ * past it are answered with a 504 without running the handler, and so are
+ * requests whose handler doesn't finish in time:
+ *
+ * svr.get("/report", {timeout(std::chrono::seconds(30))}, report);
+ */
+std::function<bool(const HttpRequest &, HttpResponse &)>
+timeout(std::chrono::milliseconds timeout);
+
 class HttpServer {
 
   /**
@@ -263,6 +629,19 @@ class HttpServer {
    */
   using routeFunc = std::function<void(const HttpRequest &, HttpResponse &)>;
 
+  /**
+   * Middleware which runs before a handler, and returns false to stop the
+   * request from going any further.
+   */
+  using middlewareFunc =
+      std::function<bool(const HttpRequest &, HttpResponse &)>;
+
+  /**
+   * Hooks which run after a handler (or middleware which stopped the
+   * request), i.e. to add headers or record metrics.
+   */
+  using afterFunc = std::function<void(const HttpRequest &, HttpResponse &)>;
+
   /**
    * The server file descriptor made into an instance variable so
    * that it can be closed whenever needed.
@@ -271,21 +650,149 @@ class HttpServer {
 
   /**
    * The number of backlog listeners allowed in the server before the
-   * connection gets dropped.
+   * connection gets dropped, or 0 for the system's limit.
    */
   int _numListeners;
 
   /**
-   * The path to a static directory for hosting.
-   * If this string is not empty, the server will host the
-   * files in this directory.
+   * The options the listening socket is created with, see `setSocketOptions`
+   */
+  ServerConfig::SocketOptions _socketOptions;
+
+  /**
+   * The number of threads reading files which weren't in the page cache
+   */
+  int _numFileIOThreads;
+
+  /**
+   * The number of threads handling connections, or 0 for one per core
+   */
+  int _numThreads;
+
+  /**
+   * How long the accept loop and idle workers spin before sleeping, or 0
+   * to sleep straight away. See `setBusyPoll`.
+   */
+  int _spinMicros;
+
+  /**
+   * The IPv4 address and port to listen on, where a port of 0 means the one
+   * passed to `run`.
+   */
+  std::string _address;
+  std::uint16_t _port;
+
+  /**
+   * How many times to try binding before giving up
+   */
+  int _bindRetries;
+
+  /**
+   * The file the config is loaded from, see `loadConfig`.
+   */
+  std::string _config_path;
+
+  /**
+   * The settings which connections are handled with, i.e. timeouts and
+   * limits. SIGHUP swaps in a new config while connections are being
+   * handled. Shared by copies of the server.
+   */
+  std::shared_ptr<std::atomic<std::shared_ptr<const ServerConfig>>> _config;
+
+  /**
+   * The pool which sends responses with a pending file, only valid while
+   * `run` is running.
+   */
+  ThreadPool *_file_io_pool;
+
+  /**
+   * Flags requests whose client hung up, only valid while `run` is running.
+   */
+  DisconnectMonitor *_disconnect_monitor;
+
+  /**
+   * A static directory for hosting, along with the GET routes for its
+   * files, which are filled in when it is scanned (see `staticSetup`).
+   */
+  struct StaticMount {
+    std::string directory;
+    std::map<std::string, routeFunc> routes;
+  };
+
+  /**
+   * The hosted static directories by their mount points.
+   * If there are any, the server will host the files in them.
+   */
+  std::map<std::string, StaticMount> _static_mounts;
+
+  /**
+   * Table of assets compiled into the binary, see `mount_embedded_assets`.
+   */
+  std::span<const EmbeddedAsset> _embedded_assets;
+
+  /**
+   * The URI for the embedded assets
+   */
+  std::string _embedded_assets_mount_point;
+
+  /**
+   * The path to an asset pack for hosting, see `mount_asset_pack`.
+   */
+  std::string _asset_pack_path;
+
+  /**
+   * The URI for the hosted asset pack
+   */
+  std::string _asset_pack_mount_point;
+
+  /**
+   * The asset pack at `_asset_pack_path`, mapped when the server starts and
+   * swapped out by `reloadAssetPack` while requests are being handled
+   */
+  std::shared_ptr<std::atomic<std::shared_ptr<const AssetPack>>> _asset_pack;
+
+  /**
+   * Rate limits every client before its connection is handed to a worker,
+   * see `setRateLimit`. Shared by copies of the server.
+   */
+  std::shared_ptr<RateLimiter> _rate_limiter;
+
+  /**
+   * The 429 sent to clients over the rate limit, serialized once in `run`
+   */
+  std::string _too_many_requests;
+
+  /**
+   * The file the IP filter is loaded from, see `setIpFilter`.
+   */
+  std::string _ip_filter_path;
+
+  /**
+   * The current IP filter, which `reloadIpFilter` swaps out while
+   * connections are being accepted. Shared by copies of the server.
    */
-  std::string _static_directory_path;
+  std::shared_ptr<std::atomic<std::shared_ptr<const IpFilter>>> _ip_filter;
 
   /**
-   * The URI for the hosted static directory
+   * The file the redirects are loaded from, see `setRedirects`.
    */
-  std::string _static_directory_mount_point;
+  std::string _redirects_path;
+
+  /**
+   * The current redirects, which `reloadRedirects` swaps out while requests
+   * are being handled. Shared by copies of the server.
+   */
+  std::shared_ptr<std::atomic<std::shared_ptr<const RedirectTable>>>
+      _redirects;
+
+  /**
+   * The sites served by this server by the host they were requested for,
+   * see `virtual_host`. Wildcard hosts are keyed by what follows the '*',
+   * i.e. ".example.com", so that a lookup can try each suffix of the host.
+   */
+  std::map<std::string, std::shared_ptr<HttpServer>, std::less<>> _hosts;
+  std::map<std::string, std::shared_ptr<HttpServer>, std::less<>>
+      _wildcard_hosts;
 
   /**
    * The HTTP response to be sent to the client when a requested
@@ -300,13 +807,56 @@ class HttpServer {
    */
   static volatile sig_atomic_t _run;
 
+  /**
+   * Set to 1 when a SIGHUP is catched, so that the accept loop reloads the
+   * config file.
+   */
+  static volatile sig_atomic_t _reload;
+
   /**
    * Map of HTTP methods to their respective route maps.
    * Each route map consists of a route and their corresponding
-   * lambda.
+   * lambda. Requests are routed with a `RouteTable` built from these.
    */
   std::unordered_map<std::string, std::map<std::string, routeFunc>> _routes;
 
+  /**
+   * Middleware and after hooks in the order they were added, with the
+   * route prefix they apply to ("" for every route).
+   */
+  std::vector<std::pair<std::string, middlewareFunc>> _middleware;
+  std::vector<std::pair<std::string, afterFunc>> _after_hooks;
+
+  /**
+   * Hooks which run before the body of a request is read, see
+   * `before_body`.
+   */
+  std::vector<std::pair<std::string, middlewareFunc>> _body_hooks;
+
+  /**
+   * Middleware for single routes, keyed by method and then route like
+   * `_routes`.
+   */
+  std::unordered_map<std::string,
+                     std::map<std::string, std::vector<middlewareFunc>>>
+      _route_middleware;
+
+  /**
+   * Everything requests are routed with, put together from the members
+   * above: the routes, with their middleware composed in, and the static
+   * mounts. A table is immutable once it is published, defined in
+   * HttpServer.cpp.
+   */
+  struct RouteTable;
+
+  /**
+   * The route table requests are currently routed with and the lock which
+   * changes to the routes are made under, see `reconfigure`. Only set once
+   * the server is running.
+   */
+  struct LiveRoutes;
+  std::shared_ptr<LiveRoutes> _live_routes;
+
 public:
   /**
    * Constructor which initializes some fields of the
@@ -314,6 +864,7 @@ public:
    *
    * Default Values:
    * _num_listeners = 3
+   * _numFileIOThreads = 2
    * _notFoundResponse = HttpResponse().status_code(404).text("Wilson's Server:
    * The requested page is not found")
    */
@@ -324,11 +875,11 @@ public:
    *
    * This method is to be called at the very end after all the settings and
    * routes are defined. If `port` is not specified, the server will run on the
-   * default port of 3000
+   * port from the config file, or the default port of 3000 if there is none.
    *
    * @param port The port to run the server on
    */
-  void run(const std::uint16_t &port = DEFAULT_PORT);
+  void run(const std::uint16_t &port = 0);
 
   /**
    * Define a route for GET requests
@@ -336,6 +887,11 @@ public:
    * The method signature of the lambda to be passed in is
    * void f(const HttpRequest &, HttpResponse &res)
    *
+   * Like every method which defines routes or middleware, this can also be
+   * called from any thread while the server is running, in which case the
+   * route is live as soon as it returns. Requests which are being handled
+   * carry on with the routes they started with.
+   *
    * @param route The URI route
    * @param f The lambda which defines what the route does.
    *
@@ -379,11 +935,270 @@ public:
   void put(const std::string &route, routeFunc f);
 
   /**
-   * Sets the number of listeners allowed in the server
+   * Define routes which run `middleware` before `f`, on top of the
+   * middleware added with `use`.
+   *
+   * @param route The URI route
+   * @param middleware The middleware for this route only, in order
+   * @param f The lambda which defines what the route does.
+   */
+  void get(const std::string &route, std::vector<middlewareFunc> middleware,
+           routeFunc f);
+  void post(const std::string &route, std::vector<middlewareFunc> middleware,
+            routeFunc f);
+  void del(const std::string &route, std::vector<middlewareFunc> middleware,
+           routeFunc f);
+  void put(const std::string &route, std::vector<middlewareFunc> middleware,
+           routeFunc f);
+
+  /**
+   * Add middleware which runs before the handler of every request.
+   *
+   * The method signature of the lambda to be passed in is
+   * bool f(const HttpRequest &, HttpResponse &res)
+   * and it returns false to stop the request from going any further, after
+   * filling in `res` itself.
+   *
+   * Middleware runs in the order it was added. The chains are put together
+   * once when the server starts, so routes without any middleware don't pay
+   * anything for it.
+   *
+   * @param f The middleware
+   */
+  void use(middlewareFunc f);
+
+  /**
+   * Add middleware which runs before the handler of requests for `prefix`
+   * and the routes under it, i.e. "/api" covers "/api" and "/api/users" but
+   * not "/apiary".
+   *
+   * @param prefix The route prefix
+   * @param f The middleware
+   */
+  void use(const std::string &prefix, middlewareFunc f);
+
+  /**
+   * Add a hook which runs after the handler of every request, even if
+   * middleware stopped the request.
+   *
+   * @param f The hook
+   */
+  void after(afterFunc f);
+
+  /**
+   * Add a hook which runs after the handler of requests for `prefix` and
+   * the routes under it.
+   *
+   * @param prefix The route prefix
+   * @param f The hook
+   */
+  void after(const std::string &prefix, afterFunc f);
+
+  /**
+   * Add a hook which looks at the headers of requests with a body before
+   * the body is read, i.e. to check credentials or the Content-Length of an
+   * upload. Like middleware it returns false to turn the request away,
+   * after filling in `res` itself (i.e. with a 401), and the connection is
+   * then closed without reading the body.
+   *
+   * Clients which send `Expect: 100-continue` wait for the server's go
+   * ahead before sending the body, which is only given once these hooks
+   * and the "limits.max_body_bytes" check (413) have passed, so a rejected
+   * upload never crosses the network. The hooks see no body, so the
+   * middleware of the route still has to check anything it depends on.
+   *
+   * @param f The hook
+   */
+  void before_body(middlewareFunc f);
+
+  /**
+   * Add a hook which looks at the headers of requests for `prefix` and the
+   * routes under it before their body is read.
+   *
+   * @param prefix The route prefix
+   * @param f The hook
+   */
+  void before_body(const std::string &prefix, middlewareFunc f);
+
+  /**
+   * Remove the route for `method` ("GET", "POST", "DELETE" or "PUT") and
+   * `route`, along with its middleware. This can be called while the
+   * server is running.
+   *
+   * @return false if there was no such route
+   */
+  bool remove_route(const std::string &method, const std::string &route);
+
+  /**
+   * Host the static directory at `directory_path` on `mount_point`,
+   * replacing the directory which was mounted there before, if any. Unlike
+   * `mount_static_directory` this changes the server in place, so that it
+   * can be called from any thread while the server is running. The
+   * directory is scanned before anything changes, and the new files are
+   * served as soon as this returns.
+   *
+   * The index.html of the directory is served on `mount_point` itself and
+   * every file under it, i.e. "docs/css/main.css" on "/docs/css/main.css"
+   * for a mount point of "/docs".
+   *
+   * @param directory_path The path to the static directory
+   * @param mount_point The route the static directory will be mounted on
+   * @throw std::invalid_argument if the server is running and the directory
+   * doesn't exist or has no index.html
+   */
+  void add_static_directory(const std::string &directory_path,
+                            const std::string &mount_point = "/");
+
+  /**
+   * Stop hosting the static directory mounted on `mount_point`. This can be
+   * called while the server is running.
+   *
+   * @return false if no directory was mounted there
+   */
+  bool remove_static_directory(const std::string &mount_point = "/");
+
+  /**
+   * Sets the number of listeners allowed in the server, i.e. the backlog of
+   * connections waiting to be accepted. By default this is as many as the
+   * system allows (net.core.somaxconn), since a short backlog drops
+   * connections as soon as a burst arrives.
+   *
+   * Like the other setters and `mount_*` methods, this configures the server
+   * in place and returns it so that calls can be chained. On a temporary,
+   * i.e. `HttpServer().setNumListeners(20)`, the server is moved out
+   * instead, so configuring never copies the server or its routes.
    *
    * @param num_listeners The number of listeners
    */
-  HttpServer setNumListeners(int num_listeners);
+  HttpServer &setNumListeners(int num_listeners) &;
+  HttpServer setNumListeners(int num_listeners) &&;
+
+  /**
+   * Sets the number of threads used to read files which are not in the page
+   * cache, so that slow disks hold up only the requests which need them.
+   *
+   * @param num_threads The number of file I/O threads
+   */
+  HttpServer &setNumFileIOThreads(int num_threads) &;
+  HttpServer setNumFileIOThreads(int num_threads) &&;
+
+  /**
+   * Sets the TCP options of the listening socket, which the connections
+   * accepted from it inherit (see `ServerConfig::SocketOptions`), i.e.
+   *
+   * ```
+   * svr.setSocketOptions({.nodelay = true, .cork = true, .defer_accept_s = 1});
+   * ```
+   *
+   * Options the platform doesn't support are skipped with a warning.
+   *
+   * @param options The socket options
+   */
+  HttpServer &setSocketOptions(const ServerConfig::SocketOptions &options) &;
+  HttpServer setSocketOptions(const ServerConfig::SocketOptions &options) &&;
+
+  /**
+   * Sets the number of threads handling connections, which is one per core
+   * by default.
+   *
+   * @param num_threads The number of worker threads
+   */
+  HttpServer &setNumThreads(int num_threads) &;
+  HttpServer setNumThreads(int num_threads) &&;
+
+  /**
+   * Busy-poll mode, for latency critical deployments with cores to spare.
+   * The accept loop and idle workers spin for up to `spin_us` microseconds
+   * waiting for work before going to sleep, and connections get
+   * `SO_BUSY_POLL` with the same budget so that reading a request polls the
+   * network card instead of waiting for its interrupt. That burns a core
+   * per spinning thread in exchange for a wakeup in a microsecond or two,
+   * instead of the tens of microseconds a sleeping thread takes.
+   *
+   * With the default number of workers, one core is left to the accept
+   * loop. Raising `SO_BUSY_POLL` above net.core.busy_read needs
+   * CAP_NET_ADMIN, and is skipped with a warning without it.
+   *
+   * @param spin_us The spin budget in microseconds, or 0 to turn it off
+   */
+  HttpServer &setBusyPoll(int spin_us) &;
+  HttpServer setBusyPoll(int spin_us) &&;
+
+  /**
+   * Load the settings in the config file at `path` (see `ServerConfig` for
+   * the format), which take precedence over the ones set before.
+   *
+   * While the server is running, a SIGHUP loads the file again. Timeouts,
+   * limits, static directories, the IP filter, redirects and log settings
+   * change without dropping any connections. The listen address, socket
+   * options, threads and 404 page need a restart. If the new file is
+   * invalid, the old settings stay in place.
+   *
+   * @param path The path to the config file
+   * @throw std::runtime_error if the file cannot be read
+   * @throw std::invalid_argument if the file has an invalid setting
+   */
+  HttpServer &loadConfig(const std::string &path) &;
+  HttpServer loadConfig(const std::string &path) &&;
+
+  /**
+   * Limit each client (by IP address) to `requests_per_second` connections
+   * per second, with bursts of up to `burst` connections. Connections over
+   * the limit are sent a 429 and closed straight from the accept loop, so
+   * they never take up a worker thread.
+   *
+   * See `rate_limit` for limiting single routes.
+   *
+   * @param requests_per_second The long run rate allowed per client
+   * @param burst The number of connections allowed at once
+   * @throw std::invalid_argument if the limit is invalid
+   */
+  HttpServer &setRateLimit(double requests_per_second, double burst) &;
+  HttpServer setRateLimit(double requests_per_second, double burst) &&;
+
+  /**
+   * Check clients against the IP allow/deny rules in the file at `path`
+   * (see `IpFilter::from_file` for the format) as soon as they connect.
+   * Denied connections are reset before anything is read from them.
+   *
+   * @param path The path to the rules
+   * @throw std::runtime_error if the file cannot be read
+   * @throw std::invalid_argument if the file has an invalid rule
+   */
+  HttpServer &setIpFilter(const std::string &path) &;
+  HttpServer setIpFilter(const std::string &path) &&;
+
+  /**
+   * Load the IP filter file again and swap the new rules in, i.e. after a
+   * threat feed was updated. This can be called from any thread while the
+   * server is running. If the file is invalid the old rules stay in place.
+   *
+   * @throw std::runtime_error if the file cannot be read
+   * @throw std::invalid_argument if the file has an invalid rule
+   */
+  void reloadIpFilter();
+
+  /**
+   * Answer requests for the routes in the redirect file at `path` (see
+   * `RedirectTable::from_file` for the format) with redirects, before they
+   * are routed. The responses are serialized when the file is loaded.
+   *
+   * @param path The path to the redirects
+   * @throw std::runtime_error if the file cannot be read
+   * @throw std::invalid_argument if the file has an invalid redirect
+   */
+  HttpServer &setRedirects(const std::string &path) &;
+  HttpServer setRedirects(const std::string &path) &&;
+
+  /**
+   * Load the redirect file again and swap the new redirects in. This can be
+   * called from any thread while the server is running. If the file is
+   * invalid the old redirects stay in place.
+   *
+   * @throw std::runtime_error if the file cannot be read
+   * @throw std::invalid_argument if the file has an invalid redirect
+   */
+  void reloadRedirects();
 
   /**
    * Set the body of `_notFoundResponse` to the
@@ -391,14 +1206,16 @@ public:
    *
    * @param path The path to the file
    */
-  HttpServer set404Page(const std::string &path);
+  HttpServer &set404Page(const std::string &path) &;
+  HttpServer set404Page(const std::string &path) &&;
 
   /**
    * Set the body of `_notFoundResponse` to `message`.
    *
    * @param message The message to be displayed as plain text
    */
-  HttpServer set404Text(const std::string &message);
+  HttpServer &set404Text(const std::string &message) &;
+  HttpServer set404Text(const std::string &message) &&;
 
   /**
    * Set `_notFoundResponse` to `res`.
@@ -407,17 +1224,99 @@ public:
    *
    * @param res The HttpResponse to be sent
    */
-  HttpServer set404Response(HttpResponse res);
+  HttpServer &set404Response(HttpResponse res) &;
+  HttpServer set404Response(HttpResponse res) &&;
 
   /**
    * Mounts a static directory at `directory_path` to `mount_point`.
    * If `mount_point` is not specified, it will be defaulted to "/".
+   * Directories can be mounted on several mount points, with their files
+   * served under them, see `add_static_directory` for changing them while
+   * the server is running.
    *
    * @param directory_path The path to the static directory
    * @param mount_point The route the static directory will be mounted on
    */
+  HttpServer &mount_static_directory(const std::string &directory_path,
+                                     const std::string &mount_point = "/") &;
   HttpServer mount_static_directory(const std::string &directory_path,
-                                    const std::string &mount_point = "/");
+                                    const std::string &mount_point = "/") &&;
+
+  /**
+   * Serves a table of assets generated by the `add_static_assets` CMake
+   * function at `mount_point`, straight from the memory of the executable.
+   * If the table contains an "index.html", it will also be served at
+   * `mount_point` itself.
+   *
+   * Responses carry an ETag, and the precompressed gzip/brotli variants are
+   * sent to clients which accept them.
+   *
+   * @param assets The generated table, i.e. `static_files::assets`
+   * @param mount_point The route the assets will be mounted on
+   */
+  HttpServer &mount_embedded_assets(std::span<const EmbeddedAsset> assets,
+                                    const std::string &mount_point = "/") &;
+  HttpServer mount_embedded_assets(std::span<const EmbeddedAsset> assets,
+                                   const std::string &mount_point = "/") &&;
+
+  /**
+   * Serves the asset pack at `pack_path` (see the `asset_packer` tool) at
+   * `mount_point`. The pack is `mmap`ed when the server starts and GET
+   * requests under `mount_point` which don't match any route are looked up
+   * in its index.
+   * If the pack contains an "index.html", it will also be served at
+   * `mount_point` itself.
+   * A new pack renamed over `pack_path` is picked up by `reloadAssetPack`,
+   * which a SIGHUP calls as well.
+   *
+   * @param pack_path The path to the pack file
+   * @param mount_point The route the pack will be mounted on
+   */
+  HttpServer &mount_asset_pack(const std::string &pack_path,
+                               const std::string &mount_point = "/") &;
+  HttpServer mount_asset_pack(const std::string &pack_path,
+                              const std::string &mount_point = "/") &&;
+
+  /**
+   * Map the asset pack file again and swap the new pack in, i.e. after a
+   * deploy renamed a new one over it. This can be called from any thread
+   * while the server is running. Responses which are being sent keep the old
+   * pack alive until they are done, and if the file is invalid the old pack
+   * stays in place.
+   *
+   * @throw std::logic_error if no asset pack was mounted
+   * @throw std::runtime_error if the file cannot be mapped or is not a
+   * valid pack
+   */
+  void reloadAssetPack();
+
+  /**
+   * Serve the requests for `host` with the routes, mounts, middleware and
+   * 404 page of `site`, so that several sites can share one process and
+   * port:
+   *
+   * HttpServer blog = HttpServer().mount_static_directory("blog/");
+   * auto svr = HttpServer()
+   *                .virtual_host("blog.example.com", blog)
+   *                .virtual_host("*.shop.example.com", shop);
+   *
+   * A wildcard covers every subdomain of what follows the "*.", but not
+   * the domain itself. Exact hosts win over wildcards, and longer wildcards
+   * win over shorter ones. Requests for any other host, or without a Host
+   * header, are routed by this server itself.
+   *
+   * Only the routing of `site` is used: rate limits, the IP filter and
+   * redirects are always those of this server, and redirects are answered
+   * before the host is looked at. `site` is copied, so its routes have to
+   * be defined beforehand.
+   *
+   * @param host The host name, or a wildcard such as "*.example.com"
+   * @param site The server whose routes are used for `host`
+   * @throw std::invalid_argument if `host` is invalid, or `site` has
+   * virtual hosts of its own
+   */
+  HttpServer &virtual_host(const std::string &host, HttpServer site) &;
+  HttpServer virtual_host(const std::string &host, HttpServer site) &&;
 
 private:
   /**
@@ -426,24 +1325,61 @@ private:
    */
   static void intHandler(int);
 
+  /**
+   * Handler function for SIGHUP, which sets _reload to 1
+   */
+  static void hupHandler(int);
+
+  /**
+   * Apply `config` to a server which isn't running yet.
+   */
+  void applyConfig(std::shared_ptr<const ServerConfig> config);
+
+  /**
+   * Load the config file again and apply whatever can change while the
+   * server is running, after a SIGHUP. Called from the accept loop, so the
+   * rate limiter can be swapped without racing it. Errors are logged, and
+   * leave the old config in place.
+   */
+  void reloadConfig();
+
+  /**
+   * Map the asset packs of this server and its virtual hosts again, after a
+   * SIGHUP. Errors are logged, and leave the old packs in place.
+   */
+  void reloadAssetPacks();
+
   /**
    * Light wrapper around the `accept` function which reads the
    * client information into a `sockaddr` and prints out its
-   * IP address.
+   * IP address if verbose.
    * Additionally does error checking which prints the error message
    *
-   * @throw std::runtime_exception if `accept` returns -1
+   * Clients which the IP filter denies are turned away here, and the next
+   * one is accepted instead. Connections are close-on-exec.
+   *
+   * @param peer Set to the address of the client
+   * @return The connection, or -1 if there are none waiting, a signal
+   * interrupted `accept` or the server is out of file descriptors
+   * @throw std::runtime_exception if `accept` fails for another reason
    */
-  int accept_connection();
+  int accept_connection(sockaddr_storage &peer);
 
   /**
-   * Setup SIGINT handler using `sigaction`
+   * Wait for the non-blocking listener to have a connection by sleeping in
+   * `poll`. In busy-poll mode it is spun on for up to `_spinMicros` first.
+   */
+  void wait_for_connection();
+
+  /**
+   * Setup SIGINT handler using `sigaction`, and a SIGHUP handler if a
+   * config file was loaded
    */
   void setup_interrupts();
 
   /**
-   * Create a listener socket and set it to be non-blocking
-   * and resuable using `setsockopt` and `fcntl`.
+   * Create a listener socket, set it to be non-blocking and resuable and
+   * give it the options in `_socketOptions` using `setsockopt` and `fcntl`.
    *
    * @throw std::runtime_exception if `socket` returns -1
    */
@@ -471,16 +1407,47 @@ private:
   void try_bind(const int &port);
 
   /**
-   * This methods takes in a HttpRequest and checks whether
-   * the URI the requested is defined in the server.
+   * This methods takes in a HttpRequest and answers it with a redirect if
+   * there is one for its route. Otherwise, the request is routed by the
+   * virtual host it was sent to, or by this server if there is none.
+   *
+   * @param request The incoming HTTP request from the client
+   * @param connfd The file descriptor of the client
+   * @return false if `connfd` was handed off to the file I/O pool, which
+   * will close it once the reply is sent
+   *
+   */
+  bool handle_reply(const HttpRequest &request, int connfd);
+
+  /**
+   * Find the virtual host for the Host of `request`, see `virtual_host`.
+   *
+   * @return The site for the host, or this server if there is none
+   */
+  HttpServer &select_host(const HttpRequest &request);
+
+  /**
+   * Checks whether the URI the requested is defined in the server, or is a
+   * file in the mounted asset pack.
    * If the URI requested is not defined, it will respond with
    * _notFoundResponse.
    *
    * @param request The incoming HTTP request from the client
    * @param connfd The file descriptor of the client
+   * @return false if `connfd` was handed off to the file I/O pool
+   */
+  bool route_request(const HttpRequest &request, int connfd);
+
+  /**
+   * Write `res` to `connfd`, unless its body is a file which still has to be
+   * read from the disk. In that case the response is handed off to the file
+   * I/O pool, which sends it and closes `connfd` itself.
    *
+   * @param res The response to be sent
+   * @param connfd The file descriptor of the client
+   * @return false if `connfd` was handed off to the file I/O pool
    */
-  void handle_reply(const HttpRequest &request, int connfd);
+  bool send_response(HttpResponse &res, int connfd);
 
   /**
    * Reads from `connfd` using `select`.
@@ -490,22 +1457,95 @@ private:
    *
    * If the connection is valid, the function will read the the entire
    * HTTP request and pass the parsed request into `handle_reply`.
+   * `connfd` is closed once the reply has been sent.
+   *
+   * Connections which waited in the queue for longer than the request
+   * timeout in the config are answered with a 503 instead of being read.
    *
    * @param connfd The file descriptor to be read from
+   * @param peer The address of the client
+   * @param accepted When the connection was accepted
+   */
+  void handle_connections(int connfd, const sockaddr_storage &peer,
+                          std::chrono::steady_clock::time_point accepted);
+
+  /**
+   * Scan the directory of `mount` and set up a GET route for each of its
+   * files in `mount.routes`.
+   *
+   * @throw std::invalid_argument if the directory doesn't exist or has no
+   * index.html
    */
-  void handle_connections(int connfd);
+  static void staticSetup(const std::string &mount_point, StaticMount &mount);
 
   /**
-   * Set up the GET routes for files in `_static_directory_path` if specified.
+   * Set up the GET routes for `_embedded_assets` in `routes`.
    */
-  void staticSetup();
+  void embeddedSetup(std::map<std::string, routeFunc> &routes) const;
 
   /**
-   * Identical to `get`, but used internally in `staticSetup` as defining
-   * additional GET routes is not allowed when `_static_directory_path` is
-   * specified.
+   * Set up the mounts and publish the first route table, which `run` does
+   * for this server and for every virtual host.
+   */
+  void routeSetup();
+
+  /**
+   * Add a route along with middleware for it alone.
+   */
+  void add_route(const std::string &method, const std::string &route,
+                 std::vector<middlewareFunc> middleware, routeFunc f);
+
+  /**
+   * Wrap the handler of every route in `table` which has middleware or after
+   * hooks into a single function.
+   */
+  void composeMiddleware(RouteTable &table) const;
+
+  /**
+   * Make a change to the routes, middleware or static mounts. Once the
+   * server is running, changes are made one at a time and a new route table
+   * is published after each of them.
+   *
+   * @param change Changes the members the route table is built from
+   */
+  void reconfigure(const std::function<void()> &change);
+
+  /**
+   * Build a route table from the routes, middleware and static mounts, and
+   * swap it in for the one requests are routed with.
+   */
+  void publishRoutes();
+
+  /**
+   * The route table to route a request with, which stays valid until the
+   * calling thread asks for the route table of this server again.
+   *
+   * Each thread keeps hold of the table it used last, so that routing a
+   * request only costs an atomic load as long as the routes don't change,
+   * instead of bumping a reference count every worker shares. A table
+   * which was swapped out is freed once every thread which used it has
+   * moved on to a newer one.
+   */
+  const RouteTable &routeTable() const;
+
+  /**
+   * Run the middleware for requests which didn't match a route, i.e. asset
+   * pack files and 404s.
+   *
+   * @return false if middleware stopped the request
+   */
+  static bool run_middleware(const RouteTable &table,
+                             const HttpRequest &request, HttpResponse &res);
+  static void run_after_hooks(const RouteTable &table,
+                              const HttpRequest &request, HttpResponse &res);
+
+  /**
+   * Run the `before_body` hooks of the site `request` is for.
+   *
+   * @return false if a hook turned the request away, with its response
+   * in `res`
    */
-  void _get(const std::string &route, routeFunc);
+  bool run_body_hooks(const HttpRequest &request, HttpResponse &res);
 
   /**
    * Simply `close`s the `_listenfd` socket
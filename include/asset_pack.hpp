@@ -0,0 +1,116 @@
+#ifndef ASSET_PACK_HPP
+#define ASSET_PACK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+/* AssetPack hands out its files as EmbeddedAssets */
+#include "embedded_assets.hpp"
+
+/**
+ * On-disk layout of an asset pack, as written by the `asset_packer` tool.
+ *
+ * A pack file consists of:
+ * 1. an `AssetPackHeader`
+ * 2. `entry_count` `AssetPackEntry`s, sorted by (path_hash, path)
+ * 3. the paths, metadata and contents of the files, which the entries point
+ *    into with absolute offsets
+ *
+ * All integers are stored in the native byte order of the machine which
+ * packed the directory.
+ */
+inline constexpr char ASSET_PACK_MAGIC[4] = {'W', 'S', 'A', 'P'};
+inline constexpr std::uint32_t ASSET_PACK_VERSION = 1;
+
+struct AssetPackHeader {
+  char magic[4];
+  std::uint32_t version;
+  std::uint64_t entry_count;
+};
+
+struct AssetPackRange {
+  std::uint64_t offset;
+  std::uint64_t length;
+};
+
+struct AssetPackEntry {
+  std::uint64_t path_hash;
+  AssetPackRange path;
+  AssetPackRange mime_type;
+  AssetPackRange etag;
+  AssetPackRange data;
+  AssetPackRange gzip;
+  AssetPackRange brotli;
+};
+
+/**
+ * 64 bit FNV-1a hash used to index the paths in a pack.
+ *
+ * @param s The string to be hashed
+ * @return The hash of `s`
+ */
+constexpr std::uint64_t asset_pack_hash(std::string_view s) {
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char c : s) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * A read-only asset pack which is `mmap`ed into memory when constructed.
+ *
+ * Looking up a file is a binary search over the index, and the returned
+ * views point straight into the mapping, so serving a file never touches
+ * the filesystem. Replacing the pack file on disk (i.e. with a `rename`)
+ * does not affect a pack which is already open.
+ */
+class AssetPack {
+public:
+  /**
+   * Map the pack file at `path` and validate its index.
+   *
+   * @param path The path to the pack file
+   * @throw std::runtime_error if the file cannot be mapped or is not a
+   * valid asset pack
+   */
+  explicit AssetPack(const std::string &path);
+  ~AssetPack();
+
+  AssetPack(const AssetPack &) = delete;
+  AssetPack &operator=(const AssetPack &) = delete;
+
+  /**
+   * Find the file at `path` in the pack.
+   *
+   * @param path The path of the file relative to the packed directory,
+   * i.e. "/app.js"
+   * @return The file, or std::nullopt if there is no such file
+   */
+  std::optional<EmbeddedAsset> find(std::string_view path) const;
+
+  /* The number of files in the pack */
+  std::size_t size() const;
+
+  /* The file descriptor of the pack, for `sendfile`ing out of it */
+  int fd() const;
+
+  /* The offset in the pack file of a view returned by `find` */
+  off_t offset_of(std::string_view view) const;
+
+private:
+  int _fd;
+  const char *_base;
+  std::size_t _length;
+  const AssetPackEntry *_entries;
+  std::size_t _entry_count;
+
+  std::string_view view(const AssetPackRange &range) const;
+};
+
+#endif // !ASSET_PACK_HPP
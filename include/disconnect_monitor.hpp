@@ -0,0 +1,105 @@
+#ifndef DISCONNECT_MONITOR_HPP
+#define DISCONNECT_MONITOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * Watches the connections of requests which are being handled for their
+ * client hanging up, so that handlers doing expensive work can check
+ * `HttpRequest::cancelled` and give up early instead of finishing and
+ * writing into a dead socket.
+ *
+ * A single thread waits in `epoll_wait` on every watched connection for
+ * EPOLLRDHUP (the client closed its end) or a reset, and sets the flag of
+ * the request on that connection. Watching a connection costs one
+ * `epoll_ctl`; the kernel drops it from the set when it is closed, so
+ * `unwatch` doesn't need a system call.
+ *
+ * The same thread also finishes closing connections whose requests were
+ * turned away before their bodies were read, see `drain`.
+ *
+ * Only Linux has EPOLLRDHUP, so everywhere else nothing is watched and
+ * requests are never cancelled.
+ */
+class DisconnectMonitor {
+public:
+  /**
+   * @throw std::runtime_error if the epoll instance cannot be created
+   */
+  DisconnectMonitor();
+  ~DisconnectMonitor();
+
+  DisconnectMonitor(const DisconnectMonitor &) = delete;
+  DisconnectMonitor &operator=(const DisconnectMonitor &) = delete;
+
+  /**
+   * Start watching `connfd`.
+   *
+   * @param connfd The connection of a request which is about to be handled
+   * @return The flag which is set once the client has gone away, or nullptr
+   * if the connection couldn't be watched
+   */
+  std::shared_ptr<std::atomic<bool>> watch(int connfd);
+
+  /**
+   * Stop watching `connfd`. The connection may have been closed, and its
+   * descriptor reused, already, in which case `cancelled` tells the watch
+   * to stop apart from the one of the new connection.
+   *
+   * @param cancelled The flag `watch` returned
+   */
+  void unwatch(int connfd, const std::shared_ptr<std::atomic<bool>> &cancelled);
+
+  /**
+   * Close `connfd` once the client has stopped sending, after its response
+   * has been written.
+   *
+   * Closing a socket with unread data in it makes the kernel reset the
+   * connection, which throws away the response before a client that is
+   * still sending its body gets to read it. So the sending side is shut
+   * down right away, and the monitor's thread reads and throws away
+   * whatever the client still sends, for up to a few seconds or megabytes,
+   * before closing it. The caller gives up `connfd` and doesn't wait.
+   *
+   * @param connfd A connection which isn't watched
+   */
+  void drain(int connfd);
+
+private:
+  struct Watched {
+    /* Tells a stale event for a reused descriptor apart from a new watch */
+    std::uint32_t generation;
+    std::shared_ptr<std::atomic<bool>> cancelled;
+  };
+
+  struct Draining {
+    std::uint32_t generation;
+    /* How much more is read before giving up on the client */
+    std::size_t bytes_left;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  int _epollfd = -1;
+  /* An eventfd which wakes the thread up, to stop it or to pick up the
+     deadline of a new drain */
+  int _wakefd = -1;
+  std::mutex _mutex;
+  bool _stop = false;
+  std::unordered_map<int, Watched> _watched;
+  std::unordered_map<int, Draining> _draining;
+  std::uint32_t _generation = 0;
+  std::thread _thread;
+
+  void monitor();
+  /* Reads what `connfd` has sent, returning whether it can be closed */
+  bool discard(int connfd, Draining &draining);
+};
+
+#endif // !DISCONNECT_MONITOR_HPP
@@ -0,0 +1,58 @@
+#ifndef EMBEDDED_ASSETS_HPP
+#define EMBEDDED_ASSETS_HPP
+
+#include <algorithm>
+#include <span>
+#include <string_view>
+
+/**
+ * A single file which was compiled into the binary by the
+ * `add_static_assets` CMake function.
+ *
+ * All the views point into read-only storage in the executable, so an
+ * `EmbeddedAsset` is cheap to copy around and never needs to touch the disk.
+ * The precompressed variants are empty if compressing the file didn't make it
+ * any smaller (or if no compressor was available at build time).
+ */
+struct EmbeddedAsset {
+  /* The path of the file relative to the embedded directory, i.e. "/app.js" */
+  std::string_view path;
+  std::string_view data;
+  std::string_view gzip;
+  std::string_view brotli;
+  /* A strong ETag (including the quotes) derived from the file's hash */
+  std::string_view etag;
+  std::string_view mime_type;
+};
+
+/**
+ * Check whether `assets` is sorted by path, which is a precondition for
+ * `find_embedded_asset`. The generated tables `static_assert` this.
+ */
+constexpr bool is_sorted_by_path(std::span<const EmbeddedAsset> assets) {
+  return std::is_sorted(assets.begin(), assets.end(),
+                        [](const EmbeddedAsset &a, const EmbeddedAsset &b) {
+                          return a.path < b.path;
+                        });
+}
+
+/**
+ * Binary search `assets` for the file at `path`.
+ *
+ * @param assets A table generated by `add_static_assets`
+ * @param path The path of the file, relative to the embedded directory
+ * @return A pointer to the asset, or nullptr if there is no such file
+ */
+constexpr const EmbeddedAsset *
+find_embedded_asset(std::span<const EmbeddedAsset> assets,
+                    std::string_view path) {
+  auto it = std::lower_bound(
+      assets.begin(), assets.end(), path,
+      [](const EmbeddedAsset &a, std::string_view p) { return a.path < p; });
+  if (it == assets.end() || it->path != path) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+#endif // !EMBEDDED_ASSETS_HPP
@@ -0,0 +1,155 @@
+#ifndef HTML_TEMPLATE_HPP
+#define HTML_TEMPLATE_HPP
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+/**
+ * The output of rendering a template without copying its static text: a
+ * list of segments which either point into the template's source or into
+ * `dynamic`, which holds the escaped slot values.
+ */
+struct RenderedTemplate {
+  struct Segment {
+    /* Points into the template, or nullptr for a range of `dynamic` */
+    const char *data;
+    std::size_t offset;
+    std::size_t length;
+  };
+
+  /* Keeps the template's source alive for as long as the segments are */
+  std::shared_ptr<const std::string> source;
+  std::string dynamic;
+  std::vector<Segment> segments;
+
+  /* The total length of the rendered page */
+  std::size_t size() const;
+};
+
+/**
+ * A HTML template which is compiled once, i.e. at startup, into a list of
+ * static segments and slots.
+ *
+ * Slots are written as `{{name}}`, which is HTML escaped when rendered, or
+ * `{{{name}}}`, which is inserted as is (i.e. for the output of another
+ * template). The same name may be used for more than one slot.
+ *
+ * HtmlTemplate page("<h1>{{title}}</h1><ul>{{{items}}}</ul>");
+ * auto args = page.args();
+ * args.set("title", title).set("items", items_html);
+ * res.render(page, args);
+ *
+ * Copies of a template share the compiled template.
+ */
+class HtmlTemplate {
+  struct Compiled;
+
+public:
+  /* The value of a slot: unset slots render as nothing */
+  using Value = std::variant<std::monostate, std::string_view, std::int64_t,
+                             double>;
+
+  /**
+   * The values to render a template with, one per slot name. Strings are
+   * not copied, so they have to outlive the call to `render`.
+   */
+  class Args {
+  public:
+    /**
+     * Set the value of the slot `name`.
+     *
+     * @throw std::invalid_argument if the template has no such slot
+     */
+    Args &set(std::string_view name, std::string_view value);
+    Args &set(std::string_view name, const char *value);
+    Args &set(std::string_view name, double value);
+    template <std::integral T> Args &set(std::string_view name, T value) {
+      _values[find_slot(*_compiled, name)] = static_cast<std::int64_t>(value);
+      return *this;
+    }
+
+    /* Set a slot by the index returned by `HtmlTemplate::slot`, which skips
+     * looking up the name on every render */
+    Value &operator[](std::size_t slot) { return _values[slot]; }
+    const Value &operator[](std::size_t slot) const { return _values[slot]; }
+
+  private:
+    friend class HtmlTemplate;
+    std::shared_ptr<const Compiled> _compiled;
+    std::vector<Value> _values;
+
+    explicit Args(std::shared_ptr<const Compiled> compiled);
+  };
+
+  /**
+   * Compile `source`.
+   *
+   * @throw std::invalid_argument if a slot is unterminated or has an
+   * invalid name
+   */
+  explicit HtmlTemplate(std::string source);
+
+  /**
+   * Compile the template in the file at `path`.
+   *
+   * @throw std::runtime_error if the file cannot be read
+   * @throw std::invalid_argument if the template is malformed
+   */
+  static HtmlTemplate from_file(const std::string &path);
+
+  /* A set of (unset) values for rendering this template */
+  Args args() const;
+
+  /**
+   * The index of the slot `name`, for use with `Args::operator[]`.
+   *
+   * @throw std::invalid_argument if the template has no such slot
+   */
+  std::size_t slot(std::string_view name) const;
+
+  /* The names of the slots, in order of first appearance */
+  const std::vector<std::string> &slots() const;
+
+  /* Append the rendered template to `out`, copying the static text */
+  void render(std::string &out, const Args &args) const;
+
+  /* Render the template into segments, without copying the static text */
+  void render(RenderedTemplate &out, const Args &args) const;
+
+private:
+  enum class OpKind : std::uint8_t { Static, Escaped, Raw };
+
+  struct Op {
+    OpKind kind;
+    /* The slot of an Escaped/Raw op */
+    std::uint32_t slot;
+    /* The range of a Static op in the source */
+    std::uint32_t offset;
+    std::uint32_t length;
+  };
+
+  struct Compiled {
+    std::shared_ptr<const std::string> source;
+    std::vector<Op> ops;
+    std::vector<std::string> slots;
+    /* The length of the static text, to size the output up front */
+    std::size_t static_size = 0;
+  };
+
+  std::shared_ptr<const Compiled> _compiled;
+
+  static std::size_t find_slot(const Compiled &compiled, std::string_view name);
+};
+
+/**
+ * Append `s` to `out`, escaping & < > " and ' as character references.
+ */
+void html_escape(std::string &out, std::string_view s);
+
+#endif // !HTML_TEMPLATE_HPP
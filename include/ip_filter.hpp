@@ -0,0 +1,98 @@
+#ifndef IP_FILTER_HPP
+#define IP_FILTER_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <vector>
+
+/**
+ * IP allow/deny rules, i.e. from a threat feed, which are checked against
+ * every client before anything is read from it.
+ *
+ * The rules are kept in a path compressed binary trie over 128 bit keys,
+ * where IPv4 addresses live in the IPv4-mapped part of the IPv6 space
+ * (::ffff:0:0/96) so that both families share one trie. A lookup follows
+ * one node per branching bit instead of one per address bit, and the most
+ * specific rule which covers the address wins. IPv4 lookups skip the top
+ * of the trie through a table indexed by the first 16 bits of the address,
+ * much like the direct pointing of a poptrie.
+ *
+ * A filter is immutable once it's in use: reloading the rules builds a new
+ * filter, which is swapped in atomically (see `HttpServer::setIpFilter`).
+ */
+class IpFilter {
+public:
+  enum class Action : std::uint8_t { None, Allow, Deny };
+
+  /**
+   * Add a rule for `cidr`, replacing any rule for the same network.
+   *
+   * @param cidr An IPv4 or IPv6 network such as "10.0.0.0/8", or a single
+   * address
+   * @param action Whether to allow or deny the network
+   * @throw std::invalid_argument if `cidr` isn't a valid network
+   */
+  void add(std::string_view cidr, Action action);
+
+  /* What to do with clients no rule covers, Allow unless set otherwise */
+  void set_default(Action action);
+
+  /**
+   * Load the rules in the file at `path`, one per line:
+   *
+   * allow 10.1.0.0/16
+   * deny 10.0.0.0/8
+   * 203.0.113.7       # a bare network is denied
+   * default deny      # what to do with everything else
+   *
+   * Anything after a '#' is a comment.
+   *
+   * @throw std::runtime_error if the file cannot be read
+   * @throw std::invalid_argument if a line is invalid, with its line number
+   */
+  static IpFilter from_file(const std::string &path);
+
+  /* Whether the client at `address` is allowed to connect */
+  bool allowed(const sockaddr_storage &address) const;
+
+  /* The number of rules in the filter */
+  std::size_t size() const;
+
+private:
+  struct Key {
+    std::uint64_t hi;
+    std::uint64_t lo;
+  };
+
+  static constexpr std::uint32_t NONE = UINT32_MAX;
+
+  struct Node {
+    Key prefix;
+    std::uint32_t child[2] = {NONE, NONE};
+    std::uint8_t length;
+    /* None for nodes which only exist to branch */
+    Action action;
+  };
+
+  /* Where to pick up an IPv4 lookup for each /16 */
+  struct IndexEntry {
+    std::uint32_t node;
+    /* The most specific rule covering the whole /16 */
+    Action action;
+  };
+
+  std::vector<Node> _nodes;
+  std::uint32_t _root = NONE;
+  std::size_t _rules = 0;
+  Action _default = Action::Allow;
+  /* Built by `from_file`, and dropped by `add` since it'd be out of date */
+  std::vector<IndexEntry> _v4_index;
+
+  void insert(Key prefix, unsigned length, Action action);
+  void build_index();
+  Action walk(Key key, std::uint32_t current, Action best) const;
+};
+
+#endif // !IP_FILTER_HPP
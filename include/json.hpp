@@ -0,0 +1,302 @@
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace json {
+
+/**
+ * A streaming JSON writer which appends straight to a string, usually the
+ * body of a HttpResponse (see `HttpResponse::json_writer`).
+ *
+ * Commas and quotes are taken care of, strings are escaped with SIMD and
+ * numbers are formatted with `std::to_chars`, so nothing is allocated
+ * besides growing the output string.
+ *
+ * auto w = res.json_writer();
+ * w.begin_object().key("id").value(42).key("tags").begin_array();
+ * for (const auto &tag : tags) w.value(tag);
+ * w.end_array().end_object();
+ *
+ * The writer doesn't validate the structure: calling `key` outside of an
+ * object or forgetting to close an array produces invalid JSON.
+ */
+class writer {
+public:
+  /**
+   * @param out The string to append to
+   */
+  explicit writer(std::string &out);
+
+  /**
+   * A writer which calls `flush` whenever `out` grows past `flush_threshold`
+   * bytes. `flush` is expected to send and clear `out`, which is how large
+   * arrays are streamed with chunked transfer encoding.
+   *
+   * @param out The string to append to
+   * @param flush Called when `out` is large enough to be sent
+   * @param flush_threshold The size of `out` which triggers a flush
+   */
+  writer(std::string &out, std::function<void()> flush,
+         std::size_t flush_threshold = 16 * 1024);
+
+  writer &begin_object();
+  writer &end_object();
+  writer &begin_array();
+  writer &end_array();
+
+  /* Write the key of the next member of an object */
+  writer &key(std::string_view key);
+
+  writer &value(std::string_view s);
+  writer &value(const char *s);
+  writer &value(bool b);
+  writer &value(std::nullptr_t);
+  /* Non-finite doubles have no JSON representation and are written as null */
+  writer &value(double d);
+
+  template <std::integral T> writer &value(T n) {
+    separator();
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), n);
+    _out.append(buf, end - buf);
+    maybe_flush();
+    return *this;
+  }
+
+  /* Write `json` as is, i.e. a fragment which was serialized ahead of time */
+  writer &raw(std::string_view json);
+
+private:
+  std::string &_out;
+  std::function<void()> _flush;
+  std::size_t _flush_threshold;
+
+  /* Bit n is set once the container at depth n has at least one item */
+  std::uint64_t _has_items = 0;
+  unsigned _depth = 0;
+  bool _after_key = false;
+
+  void separator();
+  void open(char c);
+  void close(char c);
+  void maybe_flush();
+};
+
+/**
+ * Append `s` to `out` as a quoted and escaped JSON string.
+ */
+void write_string(std::string &out, std::string_view s);
+
+/**
+ * The number of readable bytes the reader expects after the end of a
+ * document, so that it can scan 32 bytes at a time without checking for the
+ * end of the buffer first.
+ */
+inline constexpr std::size_t PADDING = 64;
+
+/**
+ * Thrown when a document is malformed, a value is read as the wrong type or
+ * a member is missing.
+ */
+class error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+enum class type { null, boolean, number, string, array, object };
+
+class document;
+class array_range;
+class object_range;
+
+/**
+ * A value in a document, which is nothing more than a position in the
+ * document's buffer.
+ *
+ * Nothing is parsed until it is asked for: looking up a member scans the
+ * keys of its object and skips over the values of the other members
+ * without parsing them, so handlers only pay for the fields they use.
+ * Malformed JSON is only noticed in the parts which are actually read.
+ */
+class value {
+public:
+  json::type type() const;
+
+  bool is_null() const;
+  bool get_bool() const;
+  std::int64_t get_int() const;
+  double get_double() const;
+
+  /**
+   * The unescaped contents of a string. This points into the document's
+   * buffer unless the string has escapes, in which case it is unescaped
+   * into storage owned by the document.
+   */
+  std::string_view get_string() const;
+
+  /* The JSON text of the value, i.e. to forward a nested object as is */
+  std::string_view raw() const;
+
+  /**
+   * Look up a member of an object.
+   *
+   * @throw json::error if this is not an object or has no member `key`
+   */
+  value operator[](std::string_view key) const;
+
+  /* Look up a member of an object, or std::nullopt if there is none */
+  std::optional<value> find(std::string_view key) const;
+
+  /**
+   * Look up an element of an array. This skips over the elements before
+   * it, so iterate with `elements` to visit every element.
+   *
+   * @throw json::error if this is not an array or is too short
+   */
+  value operator[](std::size_t index) const;
+
+  /* Iterate over the elements of an array */
+  array_range elements() const;
+
+  /* Iterate over the members of an object, as {key, value} pairs */
+  object_range members() const;
+
+private:
+  friend class document;
+  friend class array_range;
+  friend class object_range;
+
+  const document *_doc;
+  const char *_p;
+
+  value(const document *doc, const char *p) : _doc(doc), _p(p) {}
+};
+
+struct member {
+  std::string_view key;
+  json::value value;
+};
+
+class array_range {
+public:
+  class iterator {
+  public:
+    value operator*() const { return {_doc, _p}; }
+    iterator &operator++();
+    bool operator==(const iterator &other) const { return _p == other._p; }
+
+  private:
+    friend class array_range;
+    const document *_doc;
+    const char *_p; // the current element, or nullptr at the end
+
+    iterator(const document *doc, const char *p) : _doc(doc), _p(p) {}
+  };
+
+  iterator begin() const;
+  iterator end() const { return {_doc, nullptr}; }
+
+private:
+  friend class value;
+  const document *_doc;
+  const char *_p; // the opening bracket
+
+  array_range(const document *doc, const char *p) : _doc(doc), _p(p) {}
+};
+
+class object_range {
+public:
+  class iterator {
+  public:
+    member operator*() const;
+    iterator &operator++();
+    bool operator==(const iterator &other) const { return _p == other._p; }
+
+  private:
+    friend class object_range;
+    const document *_doc;
+    const char *_p; // the key of the current member, or nullptr at the end
+
+    iterator(const document *doc, const char *p) : _doc(doc), _p(p) {}
+  };
+
+  iterator begin() const;
+  iterator end() const { return {_doc, nullptr}; }
+
+private:
+  friend class value;
+  const document *_doc;
+  const char *_p; // the opening brace
+
+  object_range(const document *doc, const char *p) : _doc(doc), _p(p) {}
+};
+
+/**
+ * Tag for documents whose buffer is already followed by `PADDING` readable
+ * bytes, and so can be read in place.
+ */
+struct padded_t {};
+inline constexpr padded_t padded{};
+
+/**
+ * An on-demand JSON reader.
+ *
+ * auto doc = req.json();
+ * std::int64_t id = doc.root()["id"].get_int();
+ * for (auto tag : doc.root()["tags"].elements()) { ... tag.get_string() ... }
+ *
+ * Strings and nested values are skipped with SIMD scans for quotes and
+ * brackets, which needs the buffer to be padded (see `PADDING`). The values
+ * handed out point into the document, so it can't be copied or moved.
+ */
+class document {
+public:
+  /* Copy `json` into a padded buffer owned by the document */
+  explicit document(std::string_view json);
+
+  /* Read `json` in place, which must be followed by `PADDING` readable bytes */
+  document(std::string_view json, padded_t);
+
+  document(const document &) = delete;
+  document &operator=(const document &) = delete;
+
+  /**
+   * The top level value of the document.
+   *
+   * @throw json::error if the document is empty
+   */
+  value root() const;
+
+private:
+  friend class value;
+  friend class array_range;
+  friend class object_range;
+
+  std::string _copy;
+  const char *_begin;
+  const char *_end;
+  /* Unescaped strings, which must not move once they are handed out */
+  mutable std::deque<std::string> _strings;
+
+  const char *skip_ws(const char *p) const;
+  const char *expect(const char *p, char c) const;
+  const char *skip_string(const char *p) const;
+  const char *skip_value(const char *p) const;
+  const char *scalar_end(const char *p) const;
+  std::string_view read_string(const char *p) const;
+  [[noreturn]] void fail(const char *p, const char *what) const;
+};
+
+} // namespace json
+
+#endif // !JSON_HPP
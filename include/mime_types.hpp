@@ -0,0 +1,162 @@
+#ifndef MIME_TYPES_HPP
+#define MIME_TYPES_HPP
+
+#include "strutil.hpp"
+#include <array>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Extension to MIME type lookups for serving files.
+ *
+ * The common types live in a hash table which is built at compile time, and
+ * more types can be added (or the built-in ones overridden) at startup with
+ * `mime::register_type`.
+ */
+namespace mime {
+
+inline constexpr std::string_view DEFAULT_TYPE = "application/octet-stream";
+
+struct Entry {
+  std::string_view extension;
+  std::string_view type;
+};
+
+/* Extensions are stored lowercase and with their leading dot */
+inline constexpr Entry builtin_types[] = {
+    {".html", "text/html"},
+    {".htm", "text/html"},
+    {".css", "text/css"},
+    {".js", "text/javascript"},
+    {".mjs", "text/javascript"},
+    {".json", "application/json"},
+    {".map", "application/json"},
+    {".webmanifest", "application/manifest+json"},
+    {".txt", "text/plain"},
+    {".md", "text/markdown"},
+    {".csv", "text/csv"},
+    {".xml", "application/xml"},
+    {".rss", "application/rss+xml"},
+    {".atom", "application/atom+xml"},
+    {".pdf", "application/pdf"},
+    {".zip", "application/zip"},
+    {".gz", "application/gzip"},
+    {".tar", "application/x-tar"},
+    {".wasm", "application/wasm"},
+    {".svg", "image/svg+xml"},
+    {".png", "image/png"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".gif", "image/gif"},
+    {".webp", "image/webp"},
+    {".avif", "image/avif"},
+    {".bmp", "image/bmp"},
+    {".ico", "image/x-icon"},
+    {".woff", "font/woff"},
+    {".woff2", "font/woff2"},
+    {".ttf", "font/ttf"},
+    {".otf", "font/otf"},
+    {".mp3", "audio/mpeg"},
+    {".wav", "audio/wav"},
+    {".ogg", "audio/ogg"},
+    {".mp4", "video/mp4"},
+    {".webm", "video/webm"},
+};
+
+namespace detail {
+
+/* Open addressing with linear probing, kept at most half full */
+inline constexpr std::size_t TABLE_SIZE = 128;
+static_assert(std::size(builtin_types) * 2 <= TABLE_SIZE);
+
+constexpr std::array<const Entry *, TABLE_SIZE> build_table() {
+  std::array<const Entry *, TABLE_SIZE> table{};
+  for (const Entry &entry : builtin_types) {
+    std::size_t slot = strutil::ihash{}(entry.extension) % TABLE_SIZE;
+    while (table[slot] != nullptr) {
+      slot = (slot + 1) % TABLE_SIZE;
+    }
+    table[slot] = &entry;
+  }
+  return table;
+}
+
+inline constexpr std::array<const Entry *, TABLE_SIZE> table = build_table();
+
+/* Types added at startup, keyed by their extension in any case. The types
+   are views into `type_storage`, so that overriding one leaves the views
+   `lookup` handed out before valid */
+using Registry = std::unordered_map<std::string, std::string_view,
+                                    strutil::ihash, strutil::iequal_to>;
+
+inline Registry &registry() {
+  static Registry types;
+  return types;
+}
+
+/* Every type ever registered. Never shrinks, and a deque doesn't move its
+   elements when it grows */
+inline std::deque<std::string> &type_storage() {
+  static std::deque<std::string> types;
+  return types;
+}
+
+} // namespace detail
+
+/**
+ * Look up a built-in MIME type, ignoring types added with `register_type`.
+ * This can be done at compile time.
+ *
+ * @param extension The file extension, including the leading dot
+ * @return The MIME type, or an empty view if the extension is unknown
+ */
+constexpr std::string_view builtin_lookup(std::string_view extension) {
+  std::size_t slot = strutil::ihash{}(extension) % detail::TABLE_SIZE;
+  while (const Entry *entry = detail::table[slot]) {
+    if (strutil::iequals(entry->extension, extension)) {
+      return entry->type;
+    }
+    slot = (slot + 1) % detail::TABLE_SIZE;
+  }
+  return {};
+}
+
+/**
+ * Add a MIME type for `extension`, or override an existing one.
+ *
+ * This is meant to be called at startup: it is not safe to call this while
+ * the server is running. Types returned by `lookup` stay valid after they
+ * are overridden, though.
+ *
+ * @param extension The file extension, including the leading dot
+ * @param type The MIME type to serve files with `extension` as
+ */
+inline void register_type(std::string_view extension, std::string_view type) {
+  std::string_view stored = detail::type_storage().emplace_back(type);
+  detail::registry().insert_or_assign(std::string(extension), stored);
+}
+
+/**
+ * Look up the MIME type for a file extension (case insensitive).
+ *
+ * @param extension The file extension, including the leading dot
+ * @return The MIME type, or `DEFAULT_TYPE` if the extension is unknown. The
+ * view stays valid for the rest of the program
+ */
+inline std::string_view lookup(std::string_view extension) {
+  const auto &registry = detail::registry();
+  if (!registry.empty()) {
+    if (auto it = registry.find(extension); it != registry.end()) {
+      return it->second;
+    }
+  }
+  std::string_view type = builtin_lookup(extension);
+  return type.empty() ? DEFAULT_TYPE : type;
+}
+
+} // namespace mime
+
+#endif // !MIME_TYPES_HPP
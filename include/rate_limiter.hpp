@@ -0,0 +1,106 @@
+#ifndef RATE_LIMITER_HPP
+#define RATE_LIMITER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <sys/socket.h>
+
+/**
+ * The key clients are rate limited by: the IPv4 address in the low 32 bits
+ * (tagged like an IPv4-mapped IPv6 address), or the /64 prefix of an IPv6
+ * address, since that's what a single IPv6 client usually gets.
+ *
+ * @param address The address of the client
+ * @return The key for `address`, never 0
+ */
+std::uint64_t client_key(const sockaddr_storage &address);
+
+/**
+ * Token bucket rate limiting by client.
+ *
+ * Each client gets a bucket of `burst` tokens which refills at `rate`
+ * tokens per second, and every request takes a token. The buckets live in a
+ * fixed size table which is split into cache line aligned shards and updated
+ * with compare-and-swap only, so checking a client never takes a lock. A
+ * slot which changes hands is marked as claimed until its new bucket is in
+ * place, and its client waits out those few instructions.
+ *
+ * Entries expire lazily: a bucket which has had time to fill up again is
+ * indistinguishable from a new one, so its slot is simply reused by the next
+ * client which probes it. If all the slots a client could use are held by
+ * active clients, the client is let through rather than turned away.
+ */
+class RateLimiter {
+public:
+  /**
+   * @param rate The number of requests per second allowed in the long run
+   * @param burst The number of requests allowed at once
+   * @param capacity The number of clients which can be tracked at once
+   * @throw std::invalid_argument if `rate` isn't positive or `burst` isn't
+   * between 1 and 16000
+   */
+  RateLimiter(double rate, double burst, std::size_t capacity = 64 * 1024);
+
+  RateLimiter(const RateLimiter &) = delete;
+  RateLimiter &operator=(const RateLimiter &) = delete;
+
+  /**
+   * Take a token from the bucket of `key`.
+   *
+   * @param key The client, see `client_key`
+   * @return false if the client has run out of tokens
+   */
+  bool allow(std::uint64_t key);
+
+  /* Seconds until a client which was turned away gets another token */
+  unsigned retry_after() const;
+
+private:
+  struct alignas(16) Slot {
+    std::atomic<std::uint64_t> key{0};
+    /* The time of the last refill and the tokens left, see `pack`, or
+       CLAIMED while the slot changes hands */
+    std::atomic<std::uint64_t> state{0};
+  };
+
+  /* Not std::hardware_destructive_interference_size, which GCC warns about
+     in headers since it may differ between compilations */
+  static constexpr std::size_t CACHE_LINE = 64;
+
+  /* Frees the slots, which are allocated cache line aligned */
+  struct FreeSlots {
+    void operator()(Slot *slots) const {
+      ::operator delete(slots, std::align_val_t(CACHE_LINE));
+    }
+  };
+
+  /* Tokens are counted in thousandths, in the low 24 bits of a state */
+  static constexpr std::uint64_t TOKEN_BITS = 24;
+  static constexpr std::uint64_t TOKEN_MASK = (1ULL << TOKEN_BITS) - 1;
+  static constexpr std::size_t SHARDS = 64;
+  static constexpr std::size_t MAX_PROBES = 8;
+  /* A state which can never be packed, since the time would need 40 bits */
+  static constexpr std::uint64_t CLAIMED = UINT64_MAX;
+
+  static std::uint64_t pack(std::uint64_t now, std::uint64_t tokens) {
+    return now << TOKEN_BITS | tokens;
+  }
+
+  double _rate;            // thousandths of a token per millisecond
+  std::uint64_t _burst;    // in thousandths of a token
+  std::uint64_t _refill_ms; // the time it takes an empty bucket to fill up
+  std::size_t _shard_mask;
+  std::unique_ptr<Slot[], FreeSlots> _slots;
+  std::size_t _shard_size;
+  std::chrono::steady_clock::time_point _epoch;
+
+  /* Milliseconds since the limiter was created, starting at 1 */
+  std::uint64_t now() const;
+  bool take(Slot &slot, std::uint64_t key, std::uint64_t now);
+};
+
+#endif // !RATE_LIMITER_HPP
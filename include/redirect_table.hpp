@@ -0,0 +1,114 @@
+#ifndef REDIRECT_TABLE_HPP
+#define REDIRECT_TABLE_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * A table of redirects, i.e. for legacy URLs, which are answered before
+ * routing with responses that were serialized when the table was built.
+ *
+ * Exact redirects live in an open addressing hash table and prefix
+ * redirects in a path compressed trie. All the strings are packed into one
+ * buffer, so a redirect costs a few dozen bytes on top of its response
+ * rather than a route and a `std::function` each.
+ *
+ * A table is immutable once it's in use: reloading the redirects builds a
+ * new table, which is swapped in atomically (see
+ * `HttpServer::setRedirects`).
+ */
+class RedirectTable {
+public:
+  /**
+   * A redirect response, which is `head`, `suffix` and `tail` one after
+   * the other. `suffix` is the rest of the route for prefix redirects which
+   * keep it, and is empty otherwise.
+   */
+  struct Match {
+    std::string_view head;
+    std::string_view suffix;
+    std::string_view tail;
+  };
+
+  /**
+   * Add a redirect, replacing any redirect from the same route.
+   *
+   * A `from` ending in '*' redirects every route starting with the rest of
+   * it, and the longest such prefix wins. If `to` ends in '*' as well, the
+   * part of the route matched by the '*' is appended to the location.
+   *
+   * @param from The route to redirect, i.e. "/old" or "/post-*"
+   * @param to The location to redirect to
+   * @param status_code 301, 302, 307 or 308
+   * @throw std::invalid_argument if the redirect is invalid
+   */
+  void add(std::string_view from, std::string_view to, int status_code = 301);
+
+  /**
+   * Load the redirects in the file at `path`, one per line:
+   *
+   * /old-page /new-page
+   * /blog/post-* https://blog.example.com/post-* 302
+   *
+   * i.e. the route, the location and optionally the status code, which is
+   * 301 by default. Anything after a '#' is a comment.
+   *
+   * @throw std::runtime_error if the file cannot be read
+   * @throw std::invalid_argument if a line is invalid, with its line number
+   */
+  static RedirectTable from_file(const std::string &path);
+
+  /**
+   * Find the redirect for `route`, exact redirects first.
+   *
+   * @return The response, or std::nullopt if `route` isn't redirected
+   */
+  std::optional<Match> find(std::string_view route) const;
+
+  /* The number of redirects in the table */
+  std::size_t size() const;
+
+private:
+  struct Range {
+    std::uint32_t offset = 0;
+    std::uint32_t length = 0;
+  };
+
+  struct Exact {
+    std::uint64_t hash;
+    Range from;
+    Range response;
+  };
+
+  struct Prefix {
+    /* The response up to and including the location */
+    Range head;
+    bool keep_suffix;
+  };
+
+  struct Node {
+    Range label;
+    /* Index into `_prefixes`, or -1 */
+    std::int32_t prefix = -1;
+    /* Sorted by the first byte of their labels */
+    std::vector<std::uint32_t> children;
+  };
+
+  std::string _arena;
+  std::vector<Exact> _exact;
+  /* Indices into `_exact` plus one, 0 being an empty slot */
+  std::vector<std::uint32_t> _slots;
+  std::vector<Prefix> _prefixes;
+  std::vector<Node> _nodes;
+
+  Range store(std::string_view s);
+  std::string_view view(Range range) const;
+  void add_exact(std::string_view from, std::string_view response);
+  void add_prefix(std::string_view prefix, Prefix rule);
+  void grow();
+};
+
+#endif // !REDIRECT_TABLE_HPP
@@ -0,0 +1,121 @@
+#ifndef SERVER_CONFIG_HPP
+#define SERVER_CONFIG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * The settings of a HttpServer which can be loaded from a JSON file (see
+ * `HttpServer::loadConfig`) instead of being compiled in:
+ *
+ * {
+ *   "listen": {"address": "0.0.0.0", "port": 8080, "backlog": 128},
+ *   "socket": {"nodelay": true, "cork": true, "defer_accept_s": 1,
+ *              "fastopen_queue": 256, "recv_buffer": 0, "send_buffer": 0},
+ *   "threads": {"workers": 8, "file_io": 2, "spin_us": 0},
+ *   "timeouts": {"read_ms": 5000, "write_ms": 5000, "request_ms": 10000},
+ *   "limits": {
+ *     "max_header_bytes": 8192,
+ *     "max_body_bytes": 1048576,
+ *     "rate_limit": {"requests_per_second": 50, "burst": 100}
+ *   },
+ *   "static": [{"directory": "www", "mount": "/"}],
+ *   "ip_filter": "rules.txt",
+ *   "redirects": "redirects.txt",
+ *   "not_found_page": "www/404.html",
+ *   "log": {"verbose": false, "requests": true}
+ * }
+ *
+ * Every setting is optional, and the defaults are those of a HttpServer
+ * which was never configured. Timeouts and limits of 0 mean there are none,
+ * and a backlog of 0 means the system's limit (net.core.somaxconn).
+ */
+struct ServerConfig {
+  struct StaticDirectory {
+    std::string directory;
+    std::string mount_point = "/";
+  };
+
+  struct RateLimit {
+    double requests_per_second;
+    double burst;
+    /* The number of clients the limiter can keep track of at once */
+    std::size_t clients = 64 * 1024;
+  };
+
+  /**
+   * Options of the listening socket, which the connections accepted from it
+   * inherit. Sizes and times of 0 leave the kernel's defaults alone.
+   */
+  struct SocketOptions {
+    /* TCP_NODELAY, so that the end of a response isn't held back by Nagle */
+    bool nodelay = true;
+    /**
+     * Hold the headers of a response back until its body is written (with
+     * MSG_MORE), so that they go out in the same packets instead of a small
+     * one of their own.
+     */
+    bool cork = true;
+    /* TCP_DEFER_ACCEPT, to wake up only once the request has arrived */
+    int defer_accept_s = 0;
+    /* TCP_FASTOPEN, how many fast open requests can wait at once */
+    int fastopen_queue = 0;
+    /* SO_RCVBUF and SO_SNDBUF, which turns off the kernel's autotuning */
+    int recv_buffer = 0;
+    int send_buffer = 0;
+
+    bool operator==(const SocketOptions &) const = default;
+  };
+
+  /* "listen" */
+  std::string address = "0.0.0.0";
+  /* The port passed to `HttpServer::run` unless set */
+  std::optional<std::uint16_t> port;
+  int backlog = 0;
+  int bind_retries = 5;
+
+  /* "socket" */
+  SocketOptions socket;
+
+  /* "threads", where 0 workers means one per core */
+  int workers = 0;
+  int file_io_threads = 2;
+  /* The busy-poll budget, see `HttpServer::setBusyPoll` */
+  int spin_us = 0;
+
+  /* "timeouts", for reading requests and writing responses */
+  int read_timeout_ms = 0;
+  int write_timeout_ms = 0;
+  /* The deadline of requests without a `timeout` of their own, counted
+     from when the connection is accepted */
+  int request_timeout_ms = 0;
+
+  /* "limits", where 0 means no header limit and a 1 GiB body limit */
+  std::size_t max_header_bytes = 0;
+  std::size_t max_body_bytes = 0;
+  std::optional<RateLimit> rate_limit;
+
+  std::vector<StaticDirectory> static_directories;
+  std::string ip_filter;
+  std::string redirects;
+  std::string not_found_page;
+
+  /* "log", where `verbose` is left as compiled in unless set */
+  std::optional<bool> verbose;
+  bool log_requests = true;
+
+  /**
+   * Load the config file at `path`. Unknown settings are errors, so that a
+   * typo doesn't go unnoticed.
+   *
+   * @throw std::runtime_error if the file cannot be read
+   * @throw std::invalid_argument if the file isn't valid JSON or has an
+   * invalid setting, with the line and column of the problem
+   */
+  static ServerConfig from_file(const std::string &path);
+};
+
+#endif // !SERVER_CONFIG_HPP
@@ -2,15 +2,31 @@
 #define STRUTIL_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <functional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STRUTIL_X86_SIMD 1
+#endif
+
 namespace strutil {
 inline std::vector<std::string> split(const std::string &s,
                                       const std::string &delimiter) {
@@ -32,17 +48,397 @@ inline std::vector<std::string> split(const std::string &s,
   return res;
 }
 
+/**
+ * ASCII kernels for the hot paths of HTTP parsing.
+ *
+ * These ignore the locale on purpose, since HTTP is defined in terms of
+ * ASCII. Each kernel has a scalar, an SSE2 and an AVX2 version, and the
+ * fastest one the CPU supports is picked the first time it is called.
+ */
+namespace detail {
+
+/* Bytes allowed in a token (RFC 7230 tchar), such as a header name */
+constexpr bool is_tchar(unsigned char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z') || std::string_view("!#$%&'*+-.^_`|~").find(
+                                       static_cast<char>(c)) !=
+                                       std::string_view::npos;
+}
+
+/* Control characters, which are not allowed in header values (HTAB is) */
+constexpr bool is_ctl(unsigned char c) {
+  return (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+template <bool Upper> inline void ascii_case_scalar(const char *src, char *dst,
+                                                   std::size_t n) {
+  constexpr char first = Upper ? 'a' : 'A';
+  for (std::size_t i = 0; i < n; ++i) {
+    char c = src[i];
+    dst[i] = (c >= first && c <= first + 25) ? static_cast<char>(c ^ 0x20) : c;
+  }
+}
+
+inline bool is_token_scalar(const char *s, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    if (!is_tchar(static_cast<unsigned char>(s[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline bool has_ctl_scalar(const char *s, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    if (is_ctl(static_cast<unsigned char>(s[i]))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline std::size_t find_json_escape_scalar(const char *s, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\' || c < 0x20) {
+      return i;
+    }
+  }
+  return n;
+}
+
+inline bool is_html_special(char c) {
+  return c == '&' || c == '<' || c == '>' || c == '"' || c == '\'';
+}
+
+inline std::size_t find_html_special_scalar(const char *s, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    if (is_html_special(s[i])) {
+      return i;
+    }
+  }
+  return n;
+}
+
+#ifdef STRUTIL_X86_SIMD
+/* Signed compares are fine for the ranges below: bytes >= 0x80 are negative
+ * and so never fall inside them */
+template <bool Upper>
+__attribute__((target("sse2"))) inline void
+ascii_case_sse2(const char *src, char *dst, std::size_t n) {
+  const __m128i lo = _mm_set1_epi8((Upper ? 'a' : 'A') - 1);
+  const __m128i hi = _mm_set1_epi8((Upper ? 'z' : 'Z') + 1);
+  const __m128i flip = _mm_set1_epi8(0x20);
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i in_range =
+        _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+    v = _mm_xor_si128(v, _mm_and_si128(in_range, flip));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+  }
+  ascii_case_scalar<Upper>(src + i, dst + i, n - i);
+}
+
+template <bool Upper>
+__attribute__((target("avx2"))) inline void
+ascii_case_avx2(const char *src, char *dst, std::size_t n) {
+  const __m256i lo = _mm256_set1_epi8((Upper ? 'a' : 'A') - 1);
+  const __m256i hi = _mm256_set1_epi8((Upper ? 'z' : 'Z') + 1);
+  const __m256i flip = _mm256_set1_epi8(0x20);
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i in_range =
+        _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+    v = _mm256_xor_si256(v, _mm256_and_si256(in_range, flip));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), v);
+  }
+  ascii_case_sse2<Upper>(src + i, dst + i, n - i);
+}
+
+/* Control characters are the bytes <= 0x1f other than HTAB, and DEL */
+__attribute__((target("sse2"))) inline bool has_ctl_sse2(const char *s,
+                                                         std::size_t n) {
+  const __m128i max_ctl = _mm_set1_epi8(0x1f);
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i del = _mm_set1_epi8(0x7f);
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+    __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, max_ctl), v);
+    __m128i ctl = _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi8(v, tab), low),
+                               _mm_cmpeq_epi8(v, del));
+    if (_mm_movemask_epi8(ctl) != 0) {
+      return true;
+    }
+  }
+  return has_ctl_scalar(s + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline bool has_ctl_avx2(const char *s,
+                                                         std::size_t n) {
+  const __m256i max_ctl = _mm256_set1_epi8(0x1f);
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i del = _mm256_set1_epi8(0x7f);
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(v, max_ctl), v);
+    __m256i ctl =
+        _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), low),
+                        _mm256_cmpeq_epi8(v, del));
+    if (_mm256_movemask_epi8(ctl) != 0) {
+      return true;
+    }
+  }
+  return has_ctl_sse2(s + i, n - i);
+}
+
+/*
+ * tchar lookup by nibbles: byte `c` is a tchar iff bit (c >> 4) is set in
+ * tchar_rows[c & 0xf]. Bytes >= 0x80 have the sign bit set, which makes
+ * pshufb return 0 for them.
+ */
+constexpr std::array<std::uint8_t, 16> tchar_rows() {
+  std::array<std::uint8_t, 16> rows{};
+  for (int c = 0; c < 0x80; ++c) {
+    if (is_tchar(c)) {
+      rows[c & 0xf] |= 1 << (c >> 4);
+    }
+  }
+  return rows;
+}
+
+__attribute__((target("avx2"))) inline bool is_token_avx2(const char *s,
+                                                          std::size_t n) {
+  constexpr auto rows = tchar_rows();
+  const __m256i row_table = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows.data())));
+  const __m256i bit_table = _mm256_setr_epi8(
+      1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32,
+      64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    __m256i row = _mm256_shuffle_epi8(row_table, _mm256_and_si256(v, nibble));
+    // bytes >= 0x80 keep their sign bit here so the shuffle zeroes them
+    __m256i high = _mm256_or_si256(
+        _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble),
+        _mm256_and_si256(v, _mm256_set1_epi8(static_cast<char>(0x80))));
+    __m256i bit = _mm256_shuffle_epi8(bit_table, high);
+    __m256i ok = _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit);
+    // `bit` is 0 for bytes >= 0x80, so they have to be checked separately
+    ok = _mm256_andnot_si256(_mm256_cmpeq_epi8(bit, _mm256_setzero_si256()),
+                             ok);
+    if (_mm256_movemask_epi8(ok) != -1) {
+      return false;
+    }
+  }
+  return is_token_scalar(s + i, n - i);
+}
+
+/* Bytes which have to be escaped in a JSON string: '"', '\\' and < 0x20 */
+__attribute__((target("sse2"))) inline std::size_t
+find_json_escape_sse2(const char *s, std::size_t n) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i max_ctl = _mm_set1_epi8(0x1f);
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+    __m128i hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(v, max_ctl), v));
+    if (int mask = _mm_movemask_epi8(hit)) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + find_json_escape_scalar(s + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline std::size_t
+find_json_escape_avx2(const char *s, std::size_t n) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i max_ctl = _mm256_set1_epi8(0x1f);
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    __m256i hit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                        _mm256_cmpeq_epi8(v, backslash)),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(v, max_ctl), v));
+    if (unsigned mask = _mm256_movemask_epi8(hit)) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + find_json_escape_sse2(s + i, n - i);
+}
+
+/* Bytes which have to be escaped in HTML text and attributes: & < > " ' */
+__attribute__((target("sse2"))) inline std::size_t
+find_html_special_sse2(const char *s, std::size_t n) {
+  const __m128i amp = _mm_set1_epi8('&');
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i gt = _mm_set1_epi8('>');
+  const __m128i quot = _mm_set1_epi8('"');
+  const __m128i apos = _mm_set1_epi8('\'');
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+    __m128i hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt)),
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_cmpeq_epi8(v, quot)),
+                     _mm_cmpeq_epi8(v, apos)));
+    if (int mask = _mm_movemask_epi8(hit)) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + find_html_special_scalar(s + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline std::size_t
+find_html_special_avx2(const char *s, std::size_t n) {
+  const __m256i amp = _mm256_set1_epi8('&');
+  const __m256i lt = _mm256_set1_epi8('<');
+  const __m256i gt = _mm256_set1_epi8('>');
+  const __m256i quot = _mm256_set1_epi8('"');
+  const __m256i apos = _mm256_set1_epi8('\'');
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    __m256i hit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(v, lt)),
+        _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, gt), _mm256_cmpeq_epi8(v, quot)),
+            _mm256_cmpeq_epi8(v, apos)));
+    if (unsigned mask = _mm256_movemask_epi8(hit)) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + find_html_special_sse2(s + i, n - i);
+}
+
+template <typename F> inline F pick(F avx2, F sse2) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? avx2 : sse2;
+}
+#endif // STRUTIL_X86_SIMD
+
+} // namespace detail
+
+/**
+ * Lowercase the ASCII letters of `n` bytes at `src` into `dst`, leaving
+ * every other byte alone. `src` and `dst` may be the same buffer.
+ */
+inline void ascii_lower(const char *src, char *dst, std::size_t n) {
+#ifdef STRUTIL_X86_SIMD
+  static const auto impl = detail::pick(&detail::ascii_case_avx2<false>,
+                                        &detail::ascii_case_sse2<false>);
+  impl(src, dst, n);
+#else
+  detail::ascii_case_scalar<false>(src, dst, n);
+#endif
+}
+
+/**
+ * Uppercase the ASCII letters of `n` bytes at `src` into `dst`, leaving
+ * every other byte alone. `src` and `dst` may be the same buffer.
+ */
+inline void ascii_upper(const char *src, char *dst, std::size_t n) {
+#ifdef STRUTIL_X86_SIMD
+  static const auto impl = detail::pick(&detail::ascii_case_avx2<true>,
+                                        &detail::ascii_case_sse2<true>);
+  impl(src, dst, n);
+#else
+  detail::ascii_case_scalar<true>(src, dst, n);
+#endif
+}
+
+/* In place versions of `ascii_lower` and `ascii_upper` */
+inline void ascii_lower_inplace(std::string &s) {
+  ascii_lower(s.data(), s.data(), s.size());
+}
+
+inline void ascii_upper_inplace(std::string &s) {
+  ascii_upper(s.data(), s.data(), s.size());
+}
+
+/**
+ * Check whether `s` is a non-empty RFC 7230 token, i.e. a valid header name.
+ */
+inline bool is_token(std::string_view s) {
+  if (s.empty()) {
+    return false;
+  }
+#ifdef STRUTIL_X86_SIMD
+  static const auto impl =
+      detail::pick(&detail::is_token_avx2, &detail::is_token_scalar);
+  return impl(s.data(), s.size());
+#else
+  return detail::is_token_scalar(s.data(), s.size());
+#endif
+}
+
+/**
+ * Check whether `s` contains any control characters other than HTAB, which
+ * are not allowed in header values.
+ */
+inline bool has_control_chars(std::string_view s) {
+#ifdef STRUTIL_X86_SIMD
+  static const auto impl =
+      detail::pick(&detail::has_ctl_avx2, &detail::has_ctl_sse2);
+  return impl(s.data(), s.size());
+#else
+  return detail::has_ctl_scalar(s.data(), s.size());
+#endif
+}
+
+/**
+ * Find the first byte in `s` which has to be escaped in a JSON string,
+ * i.e. a quote, a backslash or a control character.
+ *
+ * @return The index of the byte, or std::string_view::npos if there is none
+ */
+inline std::size_t find_json_escape(std::string_view s) {
+#ifdef STRUTIL_X86_SIMD
+  static const auto impl = detail::pick(&detail::find_json_escape_avx2,
+                                        &detail::find_json_escape_sse2);
+  std::size_t i = impl(s.data(), s.size());
+#else
+  std::size_t i = detail::find_json_escape_scalar(s.data(), s.size());
+#endif
+  return i == s.size() ? std::string_view::npos : i;
+}
+
+/**
+ * Find the first byte in `s` which has to be escaped in HTML, i.e. one of
+ * & < > " '
+ *
+ * @return The index of the byte, or std::string_view::npos if there is none
+ */
+inline std::size_t find_html_special(std::string_view s) {
+#ifdef STRUTIL_X86_SIMD
+  static const auto impl = detail::pick(&detail::find_html_special_avx2,
+                                        &detail::find_html_special_sse2);
+  std::size_t i = impl(s.data(), s.size());
+#else
+  std::size_t i = detail::find_html_special_scalar(s.data(), s.size());
+#endif
+  return i == s.size() ? std::string_view::npos : i;
+}
+
 inline std::string lowers(const std::string &s) {
   std::string tmp = s;
-  std::transform(tmp.cbegin(), tmp.cend(), tmp.begin(),
-                 [](const char &c) { return tolower(c); });
+  ascii_lower_inplace(tmp);
   return tmp;
 }
 
 inline std::string uppers(const std::string &s) {
   std::string tmp = s;
-  std::transform(tmp.cbegin(), tmp.cend(), tmp.begin(),
-                 [](const char &c) { return toupper(c); });
+  ascii_upper_inplace(tmp);
   return tmp;
 }
 
@@ -70,19 +466,351 @@ inline std::string trim(const std::string &s) {
   return copy;
 }
 
-inline bool contains(const std::string haystack, const std::string needle) {
-  return haystack.find(needle) != std::string::npos;
+inline bool contains(std::string_view haystack, std::string_view needle) {
+  return haystack.find(needle) != std::string_view::npos;
 }
 
-inline std::string slurp(const std::string &path) {
-  std::ostringstream buf;
-  std::ifstream input(path.c_str());
-  if (!input) {
+/**
+ * Lazy, non-allocating version of `split`: a range of views into `s`
+ * separated by `delimiter`. Like `split`, a trailing empty token is dropped.
+ *
+ * for (std::string_view line : strutil::split_view(text, "\r\n")) { ... }
+ *
+ * Both `s` and `delimiter` must outlive the range.
+ */
+class split_view {
+public:
+  split_view(std::string_view s, std::string_view delimiter)
+      : _s(s), _delimiter(delimiter) {}
+
+  class iterator {
+  public:
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(std::string_view rest, std::string_view delimiter)
+        : _rest(rest), _delimiter(delimiter), _done(rest.empty()) {
+      advance();
+    }
+
+    std::string_view operator*() const { return _token; }
+
+    iterator &operator++() {
+      advance();
+      return *this;
+    }
+
+    iterator operator++(int) {
+      iterator tmp = *this;
+      advance();
+      return tmp;
+    }
+
+    bool operator==(const iterator &other) const {
+      return _finished == other._finished &&
+             (_finished || _token.data() == other._token.data());
+    }
+
+  private:
+    std::string_view _rest;
+    std::string_view _delimiter;
+    std::string_view _token;
+    bool _done = true;
+    bool _finished = true;
+
+    void advance() {
+      if (_done) {
+        _finished = true;
+        return;
+      }
+      _finished = false;
+      std::size_t pos = _rest.find(_delimiter);
+      if (pos == std::string_view::npos) {
+        _token = _rest;
+        _done = true;
+        return;
+      }
+      _token = _rest.substr(0, pos);
+      _rest.remove_prefix(pos + _delimiter.length());
+      // mirror `split`, which doesn't emit an empty last token
+      _done = _rest.empty();
+    }
+  };
+
+  iterator begin() const { return iterator(_s, _delimiter); }
+  iterator end() const { return iterator(); }
+
+private:
+  std::string_view _s;
+  std::string_view _delimiter;
+};
+
+/* The ASCII whitespace `std::isspace` matches in the "C" locale, whatever the
+ * current locale is */
+constexpr bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+         c == '\r';
+}
+
+/* Non-allocating versions of ltrim/rtrim/trim which return views into `s` */
+inline std::string_view ltrim_view(std::string_view s) {
+  while (!s.empty() && is_space(s.front())) {
+    s.remove_prefix(1);
+  }
+  return s;
+}
+
+inline std::string_view rtrim_view(std::string_view s) {
+  while (!s.empty() && is_space(s.back())) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+inline std::string_view trim_view(std::string_view s) {
+  return rtrim_view(ltrim_view(s));
+}
+
+constexpr char ascii_lower(char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+/**
+ * ASCII case-insensitive comparison which doesn't build lowered copies of
+ * its arguments. Meant for header names and other protocol tokens.
+ */
+constexpr bool iequals(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (ascii_lower(a[i]) != ascii_lower(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * ASCII case-insensitive hash and equality, for unordered containers keyed
+ * by header names, i.e.
+ * std::unordered_map<std::string, std::string, strutil::ihash,
+ *                    strutil::iequal_to>
+ */
+struct ihash {
+  using is_transparent = void;
+  constexpr std::size_t operator()(std::string_view s) const {
+    std::uint64_t h = 14695981039346656037ULL;
+    for (char c : s) {
+      h ^= static_cast<unsigned char>(ascii_lower(c));
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+};
+
+struct iequal_to {
+  using is_transparent = void;
+  constexpr bool operator()(std::string_view a, std::string_view b) const {
+    return iequals(a, b);
+  }
+};
+
+namespace detail {
+
+/**
+ * Open `path` for reading and get its size.
+ *
+ * @throw std::runtime_error if the file cannot be opened
+ */
+inline int open_sized(const std::string &path, std::size_t &size) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    if (fd != -1) {
+      close(fd);
+    }
     throw std::runtime_error("file not found: " + path);
   }
-  buf << input.rdbuf();
-  input.close();
-  return buf.str();
+  size = st.st_size;
+  return fd;
+}
+
+/**
+ * Cleared the first time `RWF_NOWAIT` reads are turned down by the kernel or
+ * the filesystem, after which `slurp_cached` doesn't try them anymore.
+ */
+inline std::atomic<bool> nowait_reads = true;
+
+} // namespace detail
+
+/**
+ * Read the whole file at `path` into `out`, reusing its capacity.
+ *
+ * The buffer is sized once with `fstat` and filled with `read`, so there
+ * is no iostream overhead, no regrowing and no copy at the end.
+ *
+ * @param path The path to the file
+ * @param out The string to read the file into
+ * @throw std::runtime_error if the file cannot be opened or read
+ */
+inline void slurp_into(const std::string &path, std::string &out) {
+  std::size_t size;
+  int fd = detail::open_sized(path, size);
+  // files in /proc and friends report a size of 0, so read those in chunks
+  bool unsized = size == 0;
+  out.resize(unsized ? 4096 : size);
+  std::size_t done = 0;
+  while (true) {
+    if (done == out.size()) {
+      if (!unsized) {
+        break;
+      }
+      out.resize(out.size() * 2);
+    }
+    // not pread, which pipes don't support
+    ssize_t n = read(fd, out.data() + done, out.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      close(fd);
+      throw std::runtime_error("error reading file: " + path);
+    }
+    if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  close(fd);
+  out.resize(done);
+}
+
+inline std::string slurp(const std::string &path) {
+  std::string buf;
+  slurp_into(path, buf);
+  return buf;
+}
+
+/**
+ * A read-only `mmap` of a whole file, for large files which shouldn't be
+ * copied into memory at all. The view stays valid for as long as the
+ * `mapped_file` is alive.
+ *
+ * Files which report a size of 0, such as pipes and files in /proc, can't
+ * be mapped and are read into memory instead.
+ */
+class mapped_file {
+public:
+  /**
+   * @param path The path to the file
+   * @throw std::runtime_error if the file cannot be opened, mapped or read
+   */
+  explicit mapped_file(const std::string &path) {
+    int fd = detail::open_sized(path, _size);
+    if (_size == 0) {
+      close(fd);
+      slurp_into(path, _contents);
+      return;
+    }
+    void *data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("unable to mmap file: " + path);
+    }
+    _data = static_cast<const char *>(data);
+    close(fd);
+  }
+
+  ~mapped_file() {
+    if (_data != nullptr) {
+      munmap(const_cast<char *>(_data), _size);
+    }
+  }
+
+  mapped_file(mapped_file &&other) noexcept
+      : _data(std::exchange(other._data, nullptr)),
+        _size(std::exchange(other._size, 0)),
+        _contents(std::move(other._contents)) {}
+
+  mapped_file &operator=(mapped_file &&other) noexcept {
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+    std::swap(_contents, other._contents);
+    return *this;
+  }
+
+  std::string_view view() const {
+    return _data != nullptr ? std::string_view(_data, _size) : _contents;
+  }
+
+private:
+  const char *_data = nullptr;
+  std::size_t _size = 0;
+  /* The file, if it couldn't be mapped */
+  std::string _contents;
+};
+
+/**
+ * Read the file at `path` into `out`, but only if that can be done without
+ * waiting for the disk, i.e. the whole file is already in the page cache.
+ * If it can't, readahead of the file is started in the background so that a
+ * later `slurp` of it waits as little as possible.
+ *
+ * On platforms, kernels or filesystems without `RWF_NOWAIT` this always
+ * reads the file.
+ *
+ * @param path The path to the file
+ * @param out The string to read the file into
+ * @return true if the file was read into `out`, or false if reading it would
+ * have blocked
+ * @throw std::runtime_error if the file cannot be opened
+ */
+inline bool slurp_cached(const std::string &path, std::string &out) {
+#ifdef RWF_NOWAIT
+  if (!detail::nowait_reads.load(std::memory_order_relaxed)) {
+    slurp_into(path, out);
+    return true;
+  }
+  std::size_t size;
+  int fd = detail::open_sized(path, size);
+  out.resize(size);
+  std::size_t done = 0;
+  int error = 0;
+  while (done < out.size()) {
+    iovec iov{out.data() + done, out.size() - done};
+    ssize_t n = preadv2(fd, &iov, 1, done, RWF_NOWAIT);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      error = n == -1 ? errno : 0;
+      break;
+    }
+    done += n;
+  }
+  // only EAGAIN means the rest of the file isn't in the page cache
+  if (error == EAGAIN) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+    out.clear();
+    return false;
+  }
+  close(fd);
+  if (error == EOPNOTSUPP || error == EINVAL || error == ENOSYS) {
+    detail::nowait_reads.store(false, std::memory_order_relaxed);
+  }
+  // files in /proc, files which changed size and failed reads are left to
+  // a plain read
+  if (size == 0 || done < out.size()) {
+    slurp_into(path, out);
+  }
+  return true;
+#else
+  slurp_into(path, out);
+  return true;
+#endif
 }
 
 } // namespace strutil
@@ -1,24 +1,79 @@
 #include "HttpServer.hpp"
 #include "fmt/core.h"
+#include <charconv>
+#include <climits>
 #include <condition_variable>
 #include <cstring>
+#include <fstream>
 #include <mutex>
+#include <optional>
+#include <poll.h>
 #include <queue>
+#include <sys/uio.h>
 #include <thread>
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 /**
  * Global boolean value to determine whether or not to print out verbose
- * debugging messages Compile with -DVERBOSE to set this to true
+ * debugging messages Compile with -DVERBOSE to set this to true, or set
+ * "log.verbose" in the config file.
+ * Atomic since a config reload can change it while requests are handled.
  */
 #ifdef VERBOSE
-static bool verbose = true;
+static std::atomic<bool> verbose = true;
+#else
+static std::atomic<bool> verbose = false;
+#endif
+
+/**
+ * Whether to print a line for every request, "log.requests" in the config
+ * file.
+ */
+static std::atomic<bool> log_requests = true;
+
+/**
+ * Whether to hold the headers of a response back until its body is written,
+ * "socket.cork" in the config file.
+ */
+static std::atomic<bool> cork_responses = true;
+
+/**
+ * The largest request body accepted when "limits.max_body_bytes" isn't set.
+ */
+static constexpr std::size_t DEFAULT_MAX_BODY_BYTES = std::size_t(1) << 30;
+
+#ifdef MSG_MORE
+static constexpr int SEND_MORE = MSG_MORE;
 #else
-static bool verbose = false;
+static constexpr int SEND_MORE = 0;
+#endif
+
+/**
+ * Tell the CPU we're spinning, so that it saves power and lets the other
+ * hyperthread of the core run meanwhile.
+ */
+static inline void cpu_relax() {
+#ifdef STRUTIL_X86_SIMD
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
 #endif
+}
 
 class ThreadPool {
 public:
-  ThreadPool(size_t thread_count) : stop(false) {
+  /**
+   * @param spin How long idle workers spin waiting for a task before going
+   * to sleep, for busy-poll mode. Waking a sleeping worker up takes a futex
+   * call and tens of microseconds, picking a task up while spinning well
+   * under one.
+   */
+  ThreadPool(size_t thread_count,
+             std::chrono::microseconds spin = std::chrono::microseconds(0))
+      : stop(false), spin(spin) {
     for (size_t i = 0; i < thread_count; ++i) {
       workers.emplace_back([this] { worker_thread(); });
     }
@@ -36,11 +91,17 @@ public:
   }
 
   void enqueue(std::function<void()> task) {
+    bool wake;
     {
       std::lock_guard<std::mutex> lock(queue_mutex);
-      tasks.push(task);
+      tasks.push(std::move(task));
+      queued.store(tasks.size(), std::memory_order_release);
+      // spinning workers will see the task without being woken up
+      wake = sleeping > 0;
+    }
+    if (wake) {
+      condition.notify_one();
     }
-    condition.notify_one();
   }
 
 private:
@@ -49,19 +110,42 @@ private:
   std::mutex queue_mutex;
   std::condition_variable condition;
   bool stop;
+  const std::chrono::microseconds spin;
+  /* The size of `tasks`, which spinning workers read without the lock */
+  std::atomic<std::size_t> queued = 0;
+  /* The number of workers waiting on `condition`, guarded by the lock */
+  std::size_t sleeping = 0;
+
+  /* Spin until there might be a task, or for at most `spin` */
+  void spin_for_task() {
+    auto deadline = std::chrono::steady_clock::now() + spin;
+    do {
+      for (int i = 0; i < 64; ++i) {
+        if (queued.load(std::memory_order_acquire) > 0) {
+          return;
+        }
+        cpu_relax();
+      }
+    } while (std::chrono::steady_clock::now() < deadline);
+  }
 
   void worker_thread() {
-    using namespace std::chrono_literals;
     while (true) {
+      if (spin.count() > 0) {
+        spin_for_task();
+      }
       std::function<void()> task;
       {
         std::unique_lock<std::mutex> lock(queue_mutex);
+        ++sleeping;
         condition.wait(lock, [this] { return stop || !tasks.empty(); });
+        --sleeping;
         if (stop && tasks.empty()) {
           return;
         }
         task = std::move(tasks.front());
         tasks.pop();
+        queued.store(tasks.size(), std::memory_order_relaxed);
       }
       task();
     }
@@ -72,28 +156,152 @@ private:
 
 HttpRequest::HttpRequest(std::string raw_headers) {
   using namespace strutil;
-  std::string::size_type n = raw_headers.find("\r\n\r\n");
-  std::string header_string(raw_headers, 0, n);
-  std::vector<std::string> headers = split(header_string, "\r\n");
-  auto it = headers.begin();
-  std::string status_line(*it);
-  std::vector<std::string> status_line_components = split(status_line, " ");
-  _method = status_line_components[0];
-  _route = status_line_components[1];
+  std::string_view header_string(raw_headers);
+  header_string = header_string.substr(0, header_string.find("\r\n\r\n"));
+  split_view lines(header_string, "\r\n");
+  auto it = lines.begin();
+  if (it == lines.end()) {
+    throw std::invalid_argument("empty HTTP request");
+  }
+  // the status line looks like "GET /index.html HTTP/1.1"
+  split_view status_line(*it, " ");
+  auto part = status_line.begin();
+  _method = *part;
+  if (++part == status_line.end()) {
+    throw std::invalid_argument("malformed HTTP request line");
+  }
+  _route = *part;
+  // the route ends up in responses, i.e. the Location of redirects
+  if (has_control_chars(_route) || _route.find('\t') != _route.npos) {
+    throw std::invalid_argument("invalid HTTP request target");
+  }
   it++;
-  for (; it != headers.end(); ++it) {
-    auto tmp = strutil::split(*it, ": ");
-    _headers.insert_or_assign(lowers(trim(tmp[0])), lowers(trim(tmp[1])));
+  for (; it != lines.end(); ++it) {
+    std::string_view line = *it;
+    std::size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    // no whitespace is allowed between the header name and the colon
+    std::string_view name_view = line.substr(0, colon);
+    std::string_view value_view = trim_view(line.substr(colon + 1));
+    if (!is_token(name_view)) {
+      throw std::invalid_argument("invalid HTTP header name");
+    }
+    if (has_control_chars(value_view)) {
+      throw std::invalid_argument("invalid HTTP header value");
+    }
+    std::string name(name_view);
+    std::string value(value_view);
+    ascii_lower_inplace(name);
+    ascii_lower_inplace(value);
+    _headers.insert_or_assign(std::move(name), std::move(value));
   }
 }
 
-std::string HttpRequest::body() const { return _body; }
-std::string HttpRequest::method() const { return _method; }
-std::string HttpRequest::route() const { return _route; }
-std::map<std::string, std::string> HttpRequest::headers() const {
+const std::string &HttpRequest::body() const { return _body; }
+const std::string &HttpRequest::method() const { return _method; }
+const std::string &HttpRequest::route() const { return _route; }
+const std::map<std::string, std::string> &HttpRequest::headers() const {
   return _headers;
 }
 
+std::size_t HttpRequest::content_length() const {
+  auto length = _headers.find("content-length");
+  if (length == _headers.end()) {
+    return 0;
+  }
+  // from_chars takes no sign or whitespace, and fails on overflow
+  const std::string &value = length->second;
+  std::size_t size = 0;
+  auto [end, ec] =
+      std::from_chars(value.data(), value.data() + value.size(), size);
+  if (ec != std::errc() || end != value.data() + value.size()) {
+    throw std::invalid_argument("invalid Content-Length: " + value);
+  }
+  return size;
+}
+
+const sockaddr_storage &HttpRequest::peer() const { return _peer; }
+
+/**
+ * The IP address in `peer` as text, which is left until it is needed since
+ * most connections are never logged.
+ */
+static std::string format_address(const sockaddr_storage &peer) {
+  char address[INET6_ADDRSTRLEN] = {0};
+  if (peer.ss_family == AF_INET6) {
+    inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6 &>(peer).sin6_addr,
+              address, sizeof(address));
+  } else {
+    inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in &>(peer).sin_addr,
+              address, sizeof(address));
+  }
+  return address;
+}
+
+std::string HttpRequest::peer_address() const { return format_address(_peer); }
+
+bool HttpRequest::cancelled() const {
+  return _cancelled && _cancelled->load(std::memory_order_relaxed);
+}
+
+void HttpRequest::set_timeout(std::chrono::milliseconds timeout) const {
+  _deadline = _received + timeout;
+  auto requested = _headers.find("x-request-timeout");
+  if (requested == _headers.end()) {
+    return;
+  }
+  // anything which isn't a number of milliseconds is ignored
+  std::int64_t ms = 0;
+  const std::string &value = requested->second;
+  auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), ms);
+  if (ec == std::errc() && end == value.data() + value.size() && ms >= 0 &&
+      std::chrono::milliseconds(ms) < timeout) {
+    _deadline = _received + std::chrono::milliseconds(ms);
+  }
+}
+
+std::chrono::steady_clock::time_point HttpRequest::deadline() const {
+  return _deadline;
+}
+
+std::chrono::milliseconds HttpRequest::time_left() const {
+  if (_deadline == std::chrono::steady_clock::time_point::max()) {
+    return std::chrono::milliseconds::max();
+  }
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      _deadline - std::chrono::steady_clock::now());
+  return std::max(left, std::chrono::milliseconds(0));
+}
+
+std::string_view HttpRequest::host() const {
+  auto it = _headers.find("host");
+  if (it == _headers.end()) {
+    return {};
+  }
+  // header values are already in lowercase
+  std::string_view host = it->second;
+  // the brackets of an IPv6 address keep its colons apart from the port's,
+  // i.e. "[::1]:8080"
+  std::size_t port = host.starts_with('[') ? host.find(':', host.find(']'))
+                                           : host.find(':');
+  host = host.substr(0, port);
+  // "example.com." is the same host as "example.com"
+  if (host.ends_with('.')) {
+    host.remove_suffix(1);
+  }
+  return host;
+}
+
+json::document HttpRequest::json() const {
+  // copies of a request don't keep the padding `handle_request_body` left
+  if (_body.capacity() - _body.size() >= json::PADDING) {
+    return json::document(_body, json::padded);
+  }
+  return json::document(_body);
+}
+
 /**********************HttpRequest END******************************/
 
 /**********************HttpResponse START******************************/
@@ -111,11 +319,19 @@ HttpResponse::HttpResponse() { _status_code = 200; }
  * "OK" by default if the code if not included in the map.
  *
  */
-static std::string get_status_msg(const uint8_t &status_code) {
-  std::map<uint8_t, std::string> codes = {
-      {200, "OK"},        {301, "Moved Permanently"},
-      {302, "Found"},     {400, "Bad Request"},
-      {404, "Not Found"}, {405, "Method Not Allowed"}};
+static std::string get_status_msg(const uint16_t &status_code) {
+  std::map<uint16_t, std::string> codes = {
+      {100, "Continue"},  {200, "OK"},
+      {301, "Moved Permanently"}, {302, "Found"},
+      {304, "Not Modified"},
+      {307, "Temporary Redirect"}, {308, "Permanent Redirect"},
+      {400, "Bad Request"}, {401, "Unauthorized"},
+      {403, "Forbidden"}, {404, "Not Found"},
+      {405, "Method Not Allowed"}, {413, "Payload Too Large"},
+      {417, "Expectation Failed"}, {429, "Too Many Requests"},
+      {431, "Request Header Fields Too Large"},
+      {500, "Internal Server Error"}, {503, "Service Unavailable"},
+      {504, "Gateway Timeout"}};
   if (codes.find(status_code) != codes.end()) {
     return codes.at(status_code);
   }
@@ -135,36 +351,95 @@ void HttpResponse::set_header(const std::string &key,
   _headers.insert_or_assign(key, value);
 }
 
+ResponseBody &HttpResponse::reset_body() {
+  _pending_file.clear();
+  return _body;
+}
+
+void HttpResponse::set_body(const std::string &body) { reset_body() = body; }
+
+void HttpResponse::set_body(std::shared_ptr<const std::string> body) {
+  reset_body() = std::move(body);
+}
+
+void HttpResponse::set_body(FileRegion region) {
+  reset_body() = std::move(region);
+}
+
+void HttpResponse::set_static_body(std::string_view body) {
+  reset_body() = body;
+}
+
+void HttpResponse::share_body() {
+  if (auto *body = std::get_if<std::string>(&_body)) {
+    _body = std::make_shared<const std::string>(std::move(*body));
+  }
+}
+
+/**
+ * Get a view of a body which lives in memory, i.e. anything but a
+ * FileRegion.
+ */
+static std::string_view memory_body(const ResponseBody &body) {
+  if (const auto *s = std::get_if<std::string>(&body)) {
+    return *s;
+  }
+  if (const auto *shared = std::get_if<std::shared_ptr<const std::string>>(&body)) {
+    return *shared ? std::string_view(**shared) : std::string_view();
+  }
+  if (const auto *view = std::get_if<std::string_view>(&body)) {
+    return *view;
+  }
+  return {};
+}
+
+std::size_t HttpResponse::body_size() const {
+  if (const auto *region = std::get_if<FileRegion>(&_body)) {
+    return region->length;
+  }
+  if (const auto *rendered = std::get_if<RenderedTemplate>(&_body)) {
+    return rendered->size();
+  }
+  return memory_body(_body).size();
+}
+
 void HttpResponse::text(const std::string &msg) {
   this->set_header("Content-Type", "text/plain");
-  _body = msg;
+  reset_body() = msg;
 }
 
 void HttpResponse::static_file(const std::string &path) {
-  _body = strutil::slurp(path);
+  if (!strutil::slurp_cached(path, reset_body().emplace<std::string>())) {
+    _pending_file = path;
+  }
+}
+
+void HttpResponse::load_pending_file() {
+  if (!_pending_file.empty()) {
+    strutil::slurp_into(_pending_file, _body.emplace<std::string>());
+    _pending_file.clear();
+  }
 }
 
 void HttpResponse::image(const std::string &path) {
   this->set_header("Content-Type", "image/png");
-  std::ifstream fin(path, std::ios::in | std::ios::binary);
-  std::ostringstream oss;
-  oss << fin.rdbuf();
-  _body = oss.str();
-  fin.close();
+  this->static_file(path);
 }
 
 void HttpResponse::image(const std::string &path, const std::string &type) {
   this->set_header("Content-Type", "image/" + type);
-  std::ifstream fin(path, std::ios::in | std::ios::binary);
-  std::ostringstream oss;
-  oss << fin.rdbuf();
-  _body = oss.str();
-  fin.close();
+  this->static_file(path);
 }
 
 void HttpResponse::html_string(const std::string &msg) {
   this->set_header("Content-Type", "text/html");
-  _body = msg;
+  reset_body() = msg;
+}
+
+void HttpResponse::render(const HtmlTemplate &tmpl,
+                          const HtmlTemplate::Args &args) {
+  this->set_header("Content-Type", "text/html");
+  tmpl.render(reset_body().emplace<RenderedTemplate>(), args);
 }
 
 void HttpResponse::html(const std::string &path) {
@@ -174,7 +449,23 @@ void HttpResponse::html(const std::string &path) {
 
 void HttpResponse::json(const std::string &json_string) {
   this->set_header("Content-Type", "application/json");
-  _body = json_string;
+  reset_body() = json_string;
+}
+
+json::writer HttpResponse::json_writer() {
+  this->set_header("Content-Type", "application/json");
+  return json::writer(reset_body().emplace<std::string>());
+}
+
+void HttpResponse::json_stream(std::function<void(json::writer &)> producer) {
+  this->set_header("Content-Type", "application/json");
+  this->set_header("Transfer-Encoding", "chunked");
+  reset_body() = StreamedBody{[producer = std::move(producer)](
+                           std::string &buffer,
+                           const std::function<void()> &flush) {
+    json::writer writer(buffer, flush);
+    producer(writer);
+  }};
 }
 
 void HttpResponse::downloadable(const std::string &path,
@@ -193,38 +484,276 @@ void HttpResponse::redirect(const std::string &new_location,
 }
 
 std::string HttpResponse::get_headers() const {
+  if (!_pending_file.empty()) {
+    HttpResponse loaded = *this;
+    loaded.load_pending_file();
+    return loaded.get_headers();
+  }
   std::string res(fmt::format("HTTP/1.1 {} {}\r\n", _status_code,
                               get_status_msg(_status_code)));
   for (const auto &[k, v] : _headers) {
     res.append(fmt::format("{}: {}\r\n", k, v));
   }
-  if (!_body.empty()) {
-    res.append(fmt::format("Content-Length: {}", _body.length()));
+  // streamed bodies are sized by their chunks instead, and 1xx, 204 and 304
+  // responses never have a body to size
+  bool bodiless = (_status_code >= 100 && _status_code < 200) ||
+                  _status_code == 204 || _status_code == 304;
+  if (!bodiless && !std::holds_alternative<StreamedBody>(_body)) {
+    res.append(fmt::format("Content-Length: {}\r\n", body_size()));
   }
-  res.append("\r\n\r\n");
+  res.append("\r\n");
   return res;
 }
 
 std::string HttpResponse::get_full_response() const {
-  return this->get_headers() + _body;
+  if (!_pending_file.empty()) {
+    HttpResponse loaded = *this;
+    loaded.load_pending_file();
+    return loaded.get_full_response();
+  }
+  std::string res = this->get_headers();
+  if (const auto *region = std::get_if<FileRegion>(&_body)) {
+    std::size_t offset = res.size();
+    res.resize(offset + region->length);
+    std::size_t total = 0;
+    while (total < region->length) {
+      ssize_t n = pread(region->fd, res.data() + offset + total,
+                        region->length - total, region->offset + total);
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      // the file was truncated, or can't be read, after it was opened
+      if (n <= 0) {
+        throw std::runtime_error("unable to read the response body file");
+      }
+      total += n;
+    }
+    return res;
+  }
+  if (const auto *stream = std::get_if<StreamedBody>(&_body)) {
+    // everything goes out as a single chunk
+    std::string buffer;
+    stream->produce(buffer, [] {});
+    if (!buffer.empty()) {
+      res.append(fmt::format("{:x}\r\n{}\r\n", buffer.size(), buffer));
+    }
+    res.append("0\r\n\r\n");
+    return res;
+  }
+  if (const auto *rendered = std::get_if<RenderedTemplate>(&_body)) {
+    for (const auto &segment : rendered->segments) {
+      res.append(segment.data ? segment.data
+                              : rendered->dynamic.data() + segment.offset,
+                 segment.length);
+    }
+    return res;
+  }
+  res.append(memory_body(_body));
+  return res;
+}
+
+/**
+ * Write all of `iov` to `fd`, picking up after partial writes.
+ *
+ * When responses are corked, writes which are followed by more of the
+ * response (`more`, or more than IOV_MAX buffers) are sent with MSG_MORE so
+ * that the kernel fills whole packets instead of flushing each write.
+ *
+ * @return false if the write failed, i.e. the client went away
+ */
+static bool writev_all(int fd, iovec *iov, int iovcnt, bool more = false) {
+  while (iovcnt > 0) {
+    int batch = std::min(iovcnt, IOV_MAX);
+    ssize_t n;
+    if (SEND_MORE != 0 && (more || batch < iovcnt) && cork_responses) {
+      msghdr msg{};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = batch;
+      n = sendmsg(fd, &msg, SEND_MORE);
+    } else {
+      n = writev(fd, iov, batch);
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return false;
+    }
+    while (iovcnt > 0 && static_cast<std::size_t>(n) >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+/**
+ * Send `region` to `fd` without copying it through userspace where the
+ * platform allows it.
+ *
+ * @return false if the write failed, i.e. the client went away
+ */
+static bool sendfile_all(int fd, const FileRegion &region) {
+  off_t offset = region.offset;
+  std::size_t remaining = region.length;
+  while (remaining > 0) {
+#ifdef __linux__
+    ssize_t n = sendfile(fd, region.fd, &offset, remaining);
+#else
+    char buf[64 * 1024];
+    ssize_t n = pread(region.fd, buf, std::min(remaining, sizeof(buf)), offset);
+    if (n > 0) {
+      iovec iov{buf, static_cast<std::size_t>(n)};
+      if (!writev_all(fd, &iov, 1)) {
+        return false;
+      }
+      offset += n;
+    }
+#endif
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    remaining -= n;
+  }
+  return true;
+}
+
+/* Thrown out of a StreamedBody producer to stop it once the client is gone */
+struct client_gone {};
+
+/**
+ * Run `stream`'s producer, sending what it produces to `fd` as chunks.
+ *
+ * @return false if the client went away or the producer threw before the
+ * stream was finished
+ */
+static bool stream_all(int fd, const StreamedBody &stream) {
+  std::string buffer;
+  auto flush = [&]() {
+    if (buffer.empty()) {
+      return;
+    }
+    std::string size_line = fmt::format("{:x}\r\n", buffer.size());
+    iovec iov[3] = {{size_line.data(), size_line.size()},
+                    {buffer.data(), buffer.size()},
+                    {const_cast<char *>("\r\n"), 2}};
+    if (!writev_all(fd, iov, 3)) {
+      throw client_gone();
+    }
+    buffer.clear();
+  };
+  try {
+    stream.produce(buffer, flush);
+    flush();
+  } catch (const client_gone &) {
+    return false;
+  } catch (const std::exception &e) {
+    // the headers are already out, so the stream can only be cut short
+    fmt::print(stderr, "Aborted response stream: {}\n", e.what());
+    return false;
+  }
+  iovec last{const_cast<char *>("0\r\n\r\n"), 5};
+  return writev_all(fd, &last, 1);
+}
+
+bool HttpResponse::write_to(int connfd) const {
+  if (!_pending_file.empty()) {
+    HttpResponse loaded = *this;
+    loaded.load_pending_file();
+    return loaded.write_to(connfd);
+  }
+  std::string headers = this->get_headers();
+  if (const auto *region = std::get_if<FileRegion>(&_body)) {
+    iovec iov{headers.data(), headers.size()};
+    return writev_all(connfd, &iov, 1, true) && sendfile_all(connfd, *region);
+  }
+  if (const auto *stream = std::get_if<StreamedBody>(&_body)) {
+    iovec iov{headers.data(), headers.size()};
+    return writev_all(connfd, &iov, 1) && stream_all(connfd, *stream);
+  }
+  if (const auto *rendered = std::get_if<RenderedTemplate>(&_body)) {
+    std::vector<iovec> iov;
+    iov.reserve(rendered->segments.size() + 1);
+    iov.push_back({headers.data(), headers.size()});
+    for (const auto &segment : rendered->segments) {
+      const char *data = segment.data ? segment.data
+                                      : rendered->dynamic.data() + segment.offset;
+      iov.push_back({const_cast<char *>(data), segment.length});
+    }
+    return writev_all(connfd, iov.data(), iov.size());
+  }
+  std::string_view body = memory_body(_body);
+  iovec iov[2] = {{headers.data(), headers.size()},
+                  {const_cast<char *>(body.data()), body.size()}};
+  return writev_all(connfd, iov, body.empty() ? 1 : 2);
 }
 
 /**********************HttpRequest END******************************/
 
 // Have to re-declare static class variables in the source file
 volatile sig_atomic_t HttpServer::_run;
+volatile sig_atomic_t HttpServer::_reload;
 
 void HttpServer::intHandler(int) { _run = 0; }
 
+void HttpServer::hupHandler(int) { _reload = 1; }
+
 HttpServer::HttpServer() {
   _run = 1;
-  _numListeners = 3;
+  _numListeners = 0;
+  _numFileIOThreads = 2;
+  _numThreads = 0;
+  _spinMicros = 0;
+  _address = "0.0.0.0";
+  _port = 0;
+  _bindRetries = BIND_RETRY_COUNT;
+  _file_io_pool = nullptr;
+  _disconnect_monitor = nullptr;
+  _config = std::make_shared<std::atomic<std::shared_ptr<const ServerConfig>>>(
+      std::make_shared<const ServerConfig>());
   HttpResponse not_found_res;
   not_found_res.set_status_code(404);
   not_found_res.text("Wilson's Server: The requested page is not found");
+  not_found_res.share_body();
   _notFoundResponse = not_found_res;
 }
 
+struct HttpServer::RouteTable {
+  /* Unique across every table of every server */
+  std::uint64_t generation;
+  std::unordered_map<std::string, std::map<std::string, routeFunc>> routes;
+  std::vector<std::pair<std::string, middlewareFunc>> middleware;
+  std::vector<std::pair<std::string, afterFunc>> after_hooks;
+  std::vector<std::pair<std::string, middlewareFunc>> body_hooks;
+};
+
+struct HttpServer::LiveRoutes {
+  /* Held while the routes are changed and the new table is published */
+  std::mutex writer;
+  std::atomic<std::shared_ptr<const RouteTable>> table;
+  /* The generation of `table`, which threads check their own copy against */
+  std::atomic<std::uint64_t> generation{0};
+};
+
+void HttpServer::reconfigure(const std::function<void()> &change) {
+  // before `run` there's nobody to race with, and nothing to publish to
+  if (!_live_routes) {
+    change();
+    return;
+  }
+  std::lock_guard<std::mutex> lock(_live_routes->writer);
+  change();
+  publishRoutes();
+}
+
 /**
  * Thing to note about the following route methods:
  *
@@ -234,212 +763,1081 @@ HttpServer::HttpServer() {
  * method.
  *
  * `insert_or_assign` is useful for the same reasons as above.
+ *
+ * Redefining a route replaces its middleware as well, so a route defined
+ * without middleware drops whatever it was defined with before.
  */
 
 void HttpServer::get(const std::string &route, routeFunc func) {
-  if (!_static_directory_path.empty()) {
-    throw std::invalid_argument(
-        "Cannot define GET routes while in static directory serving mode");
-  }
-  _routes["GET"].insert_or_assign(route, func);
-}
-
-/**
- * Internal method that doesn't throw if there is already a
- * `_static_directory_path` defined.
- * This is used for setting up GET routes in `staticSetup`
- */
-void HttpServer::_get(const std::string &route, routeFunc func) {
-  _routes["GET"].insert_or_assign(route, func);
+  reconfigure([&] {
+    if (!_static_mounts.empty()) {
+      throw std::invalid_argument(
+          "Cannot define GET routes while in static directory serving mode");
+    }
+    _routes["GET"].insert_or_assign(route, std::move(func));
+    _route_middleware["GET"].erase(route);
+  });
 }
 
 void HttpServer::post(const std::string &route, routeFunc func) {
-  _routes["POST"].insert_or_assign(route, func);
+  reconfigure([&] {
+    _routes["POST"].insert_or_assign(route, std::move(func));
+    _route_middleware["POST"].erase(route);
+  });
 }
 
 void HttpServer::del(const std::string &route, routeFunc func) {
-  _routes["DELETE"].insert_or_assign(route, func);
+  reconfigure([&] {
+    _routes["DELETE"].insert_or_assign(route, std::move(func));
+    _route_middleware["DELETE"].erase(route);
+  });
 }
 
 void HttpServer::put(const std::string &route, routeFunc func) {
-  _routes["PUT"].insert_or_assign(route, func);
+  reconfigure([&] {
+    _routes["PUT"].insert_or_assign(route, std::move(func));
+    _route_middleware["PUT"].erase(route);
+  });
 }
 
-/**
- * For the following methods which return `HttpServer`, I
- * originally intended to simply modify the current instance
- * and return a reference to `this`.
- *
- * However, that resulted in some weird behaviour where `std::cout`
- * didn't print anything. That's why I'm creating a temporary `HttpServer`
- * object and returning a copy of it.
- */
+void HttpServer::add_route(const std::string &method, const std::string &route,
+                           std::vector<middlewareFunc> middleware,
+                           routeFunc func) {
+  reconfigure([&] {
+    if (method == "GET" && !_static_mounts.empty()) {
+      throw std::invalid_argument(
+          "Cannot define GET routes while in static directory serving mode");
+    }
+    _routes[method].insert_or_assign(route, std::move(func));
+    _route_middleware[method].insert_or_assign(route, std::move(middleware));
+  });
+}
 
-HttpServer HttpServer::setNumListeners(int num_listeners) {
-  HttpServer tmp = *this;
-  tmp._numListeners = num_listeners;
-  return tmp;
+void HttpServer::get(const std::string &route,
+                     std::vector<middlewareFunc> middleware, routeFunc func) {
+  add_route("GET", route, std::move(middleware), std::move(func));
 }
 
-HttpServer HttpServer::set404Page(const std::string &path) {
-  HttpServer tmp = *this;
-  HttpResponse res;
-  res.html(path);
-  tmp._notFoundResponse = res;
-  tmp._notFoundResponse.set_status_code(404);
-  return tmp;
+void HttpServer::post(const std::string &route,
+                      std::vector<middlewareFunc> middleware, routeFunc func) {
+  add_route("POST", route, std::move(middleware), std::move(func));
 }
 
-HttpServer HttpServer::set404Text(const std::string &message) {
-  HttpServer tmp = *this;
-  HttpResponse res;
-  res.text(message);
-  tmp._notFoundResponse = res;
-  tmp._notFoundResponse.set_status_code(404);
-  return tmp;
+void HttpServer::del(const std::string &route,
+                     std::vector<middlewareFunc> middleware, routeFunc func) {
+  add_route("DELETE", route, std::move(middleware), std::move(func));
 }
 
-HttpServer HttpServer::set404Response(HttpResponse res) {
-  HttpServer tmp = *this;
-  tmp._notFoundResponse = res;
-  tmp._notFoundResponse.set_status_code(404);
-  return tmp;
+void HttpServer::put(const std::string &route,
+                     std::vector<middlewareFunc> middleware, routeFunc func) {
+  add_route("PUT", route, std::move(middleware), std::move(func));
 }
 
-HttpServer HttpServer::mount_static_directory(const std::string &directory_path,
-                                              const std::string &mount_point) {
-  HttpServer tmp = *this;
-  tmp._static_directory_path = directory_path;
-  if (tmp._static_directory_path.back() != '/') {
-    tmp._static_directory_path += "/";
-  }
-  tmp._static_directory_mount_point = mount_point;
-  return tmp;
+void HttpServer::use(middlewareFunc func) {
+  reconfigure([&] { _middleware.emplace_back("", std::move(func)); });
 }
 
-/**
- * Returns a copy of a `sockaddr_in` with its
- * fields initialized.
- *
- * s_addr is initialized to `INADDR_ANY` which is basically
- * "0.0.0.0" (I think) and sin_port is initialized to `port`.
- *
- * @param port The port number
- * @return The sockaddr_in struct with its fields initialized
- */
-static sockaddr_in get_sa(uint16_t port) {
-  sockaddr_in sa;
-  sa.sin_family = AF_INET;
-  sa.sin_port = htons(port);
-  sa.sin_addr.s_addr = htonl(INADDR_ANY);
-  return sa;
+void HttpServer::use(const std::string &prefix, middlewareFunc func) {
+  reconfigure([&] { _middleware.emplace_back(prefix, std::move(func)); });
 }
 
-/**
- * The reason I'm using a try-catch instead of simply checking whether
- * "content-length" is a key in req.headers() is because for some reason
- * the latter method didn't work which caused `at` to throw a
- * `std::out_of_range` exception.
- *
- * This function reads the request body into `req` by using the "Content-Length"
- * header of the request.
- *
- * @param connfd The socket to be reading from
- * @param req The HttpRequest object
- */
-void handle_request_body(int connfd, HttpRequest &req) {
-  unsigned long size_to_read;
-  try {
-    size_to_read = std::stoul(req.headers().at("content-length"));
-  } catch (std::out_of_range const &) {
-    return;
-  }
-  // various methods of reading the request body into req._body
+void HttpServer::after(afterFunc func) {
+  reconfigure([&] { _after_hooks.emplace_back("", std::move(func)); });
+}
 
-  // unique pointer method (buf gets deallocated for automatically
-  // and doesn't read directly into the string's `data` so it's
-  // safer)
-  /* auto buf = std::make_unique<char []>(size_to_read + 1);
-  memset(&buf[0], 0, size_to_read + 1);
-  read(connfd, &buf[0], size_to_read);
-  req._body.append(buf.get()); */
+void HttpServer::after(const std::string &prefix, afterFunc func) {
+  reconfigure([&] { _after_hooks.emplace_back(prefix, std::move(func)); });
+}
 
-  // resize method (don't need to use a temp variable in between)
-  // I'll settle on this one for now.
-  // note: don't have to take the null-terminating character into
-  // account when resizing the string
-  //
-  // could be dangerous to read directly into `req._body.data()`,
-  // but since this is the only place we modify it, it should be ok
-  req._body.resize(size_to_read);
-  read(connfd, req._body.data(), size_to_read);
+void HttpServer::before_body(middlewareFunc func) {
+  reconfigure([&] { _body_hooks.emplace_back("", std::move(func)); });
+}
 
-  // Temp string method
-  /* std::string buf(size_to_read + 1, 0);
-  read(connfd, buf.data(), size_to_read);
-  req._body = buf; */
+void HttpServer::before_body(const std::string &prefix, middlewareFunc func) {
+  reconfigure([&] { _body_hooks.emplace_back(prefix, std::move(func)); });
 }
 
-void HttpServer::handle_reply(const HttpRequest &request, int connfd) {
+bool HttpServer::remove_route(const std::string &method,
+                              const std::string &route) {
+  bool removed = false;
+  reconfigure([&] {
+    if (auto routes = _routes.find(method); routes != _routes.end()) {
+      removed = routes->second.erase(route) > 0;
+    }
+    if (auto m = _route_middleware.find(method); m != _route_middleware.end()) {
+      m->second.erase(route);
+    }
+  });
+  return removed;
+}
 
-  HttpResponse res;
-  res.set_header("x-powered-by", "Wilson-Server");
-  if (!_routes.contains(request.method())) {
-    fmt::print(stderr,
-               "No route handler configured for the requested method: {}\n",
-               request.method());
-    res.set_status_code(405);
-    std::string reply = res.get_full_response();
-    write(connfd, reply.c_str(), reply.length());
-    return;
+void HttpServer::add_static_directory(const std::string &directory_path,
+                                      const std::string &mount_point) {
+  StaticMount mount{directory_path, {}};
+  if (mount.directory.back() != '/') {
+    mount.directory += "/";
   }
-
-  auto route = _routes.at(request.method());
-
-  if (!route.contains(request.route())) {
-    fmt::print(stderr,
-               "No route handler configured for the requested path: {}\n",
-               request.route());
-    _notFoundResponse.set_header("x-powered-by", "Wilson-Server");
-    std::string reply = _notFoundResponse.get_full_response();
-    write(connfd, reply.c_str(), reply.length());
-    return;
+  // scan the directory before taking the lock, and leave the routes alone
+  // if it's no good. Mounts added before `run` are scanned by `run`.
+  if (_live_routes) {
+    staticSetup(mount_point, mount);
   }
+  reconfigure([&] {
+    _static_mounts.insert_or_assign(mount_point, std::move(mount));
+  });
+}
 
-  fmt::print("Route func found for the requested method: {} and path: {}\n",
-             request.method(), request.route());
-
-  auto routeFunc = route.at(request.route());
-
-  auto func = route.at(request.route());
-  func(request, res);
-  // add custom powered-by header
-  std::string reply = res.get_full_response();
-  write(connfd, reply.c_str(), reply.length());
+bool HttpServer::remove_static_directory(const std::string &mount_point) {
+  bool removed = false;
+  reconfigure([&] { removed = _static_mounts.erase(mount_point) > 0; });
+  return removed;
 }
 
-void HttpServer::staticSetup() {
-  auto root = std::filesystem::path(_static_directory_path);
-  if (!is_directory(root)) {
-    throw std::invalid_argument(
-        "static directory path has to point to a directory");
-  }
-  if (root.empty()) {
-    throw std::invalid_argument("given directory is empty");
+/**
+ * Whether `route` is `prefix` or a route under it. An empty prefix matches
+ * every route.
+ */
+static bool under_prefix(std::string_view route, std::string_view prefix) {
+  if (!route.starts_with(prefix)) {
+    return false;
   }
-  if (!std::ifstream(root / "index.html").good()) {
-    throw std::invalid_argument(
-        "index.html does not exist in the root directory of the static folder");
+  return prefix.empty() || prefix.back() == '/' ||
+         route.size() == prefix.size() || route[prefix.size()] == '/';
+}
+
+void HttpServer::composeMiddleware(RouteTable &table) const {
+  for (auto &[method, routes] : table.routes) {
+    for (auto &[route, func] : routes) {
+      std::vector<middlewareFunc> before;
+      for (const auto &[prefix, middleware] : _middleware) {
+        if (under_prefix(route, prefix)) {
+          before.push_back(middleware);
+        }
+      }
+      if (auto m = _route_middleware.find(method); m != _route_middleware.end()) {
+        if (auto r = m->second.find(route); r != m->second.end()) {
+          before.insert(before.end(), r->second.begin(), r->second.end());
+        }
+      }
+      std::vector<afterFunc> after;
+      for (const auto &[prefix, hook] : _after_hooks) {
+        if (under_prefix(route, prefix)) {
+          after.push_back(hook);
+        }
+      }
+      // routes without middleware keep calling their handler directly
+      if (before.empty() && after.empty()) {
+        continue;
+      }
+      func = [before = std::move(before), handler = std::move(func),
+              after = std::move(after)](const HttpRequest &req,
+                                        HttpResponse &res) {
+        bool proceed = true;
+        for (const auto &middleware : before) {
+          if (!middleware(req, res)) {
+            proceed = false;
+            break;
+          }
+        }
+        if (proceed) {
+          handler(req, res);
+        }
+        for (const auto &hook : after) {
+          hook(req, res);
+        }
+      };
+    }
+  }
+}
+
+void HttpServer::publishRoutes() {
+  static std::atomic<std::uint64_t> generations{0};
+  auto table = std::make_shared<RouteTable>();
+  table->generation = ++generations;
+  table->routes = _routes;
+  // files in static directories take precedence over routes, as they always
+  // have
+  for (const auto &[mount_point, mount] : _static_mounts) {
+    for (const auto &[route, func] : mount.routes) {
+      table->routes["GET"].insert_or_assign(route, func);
+    }
+  }
+  if (!_embedded_assets.empty()) {
+    embeddedSetup(table->routes["GET"]);
+  }
+  composeMiddleware(*table);
+  table->middleware = _middleware;
+  table->after_hooks = _after_hooks;
+  table->body_hooks = _body_hooks;
+  std::uint64_t generation = table->generation;
+  _live_routes->table.store(std::move(table));
+  _live_routes->generation.store(generation, std::memory_order_release);
+}
+
+const HttpServer::RouteTable &HttpServer::routeTable() const {
+  struct Cached {
+    const LiveRoutes *live;
+    std::shared_ptr<const RouteTable> table;
+  };
+  // one entry per server this thread has routed requests for, which is
+  // more than one with virtual hosts
+  thread_local std::vector<Cached> cache;
+  std::uint64_t generation =
+      _live_routes->generation.load(std::memory_order_acquire);
+  for (Cached &cached : cache) {
+    if (cached.live == _live_routes.get()) {
+      if (cached.table->generation != generation) {
+        cached.table = _live_routes->table.load();
+      }
+      return *cached.table;
+    }
+  }
+  cache.push_back({_live_routes.get(), _live_routes->table.load()});
+  return *cache.back().table;
+}
+
+bool HttpServer::run_middleware(const RouteTable &table,
+                                const HttpRequest &request, HttpResponse &res) {
+  for (const auto &[prefix, middleware] : table.middleware) {
+    if (under_prefix(request.route(), prefix) && !middleware(request, res)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HttpServer::run_body_hooks(const HttpRequest &request,
+                                HttpResponse &res) {
+  const RouteTable &table = select_host(request).routeTable();
+  for (const auto &[prefix, hook] : table.body_hooks) {
+    if (under_prefix(request.route(), prefix) && !hook(request, res)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void HttpServer::run_after_hooks(const RouteTable &table,
+                                 const HttpRequest &request,
+                                 HttpResponse &res) {
+  for (const auto &[prefix, hook] : table.after_hooks) {
+    if (under_prefix(request.route(), prefix)) {
+      hook(request, res);
+    }
+  }
+}
+
+/**
+ * For the following methods which return `HttpServer`, I
+ * originally intended to simply modify the current instance
+ * and return a reference to `this`.
+ *
+ * However, that resulted in some weird behaviour where `std::cout`
+ * didn't print anything, since `auto svr = HttpServer().setX()` was left
+ * with a reference to a temporary which was already gone. So they used to
+ * return a copy of the whole server instead, routes and all, which made
+ * configuring large apps quadratic.
+ *
+ * Now each method comes in two flavours: on a server which is a variable it
+ * modifies it in place and returns a reference to it, and on a temporary
+ * it modifies it in place and then moves it out, which is cheap and can't
+ * dangle.
+ */
+
+HttpServer &HttpServer::setNumListeners(int num_listeners) & {
+  _numListeners = num_listeners;
+  return *this;
+}
+
+HttpServer HttpServer::setNumListeners(int num_listeners) && {
+  return std::move(setNumListeners(num_listeners));
+}
+
+HttpServer &
+HttpServer::setSocketOptions(const ServerConfig::SocketOptions &options) & {
+  _socketOptions = options;
+  return *this;
+}
+
+HttpServer
+HttpServer::setSocketOptions(const ServerConfig::SocketOptions &options) && {
+  return std::move(setSocketOptions(options));
+}
+
+HttpServer &HttpServer::setNumFileIOThreads(int num_threads) & {
+  _numFileIOThreads = num_threads;
+  return *this;
+}
+
+HttpServer HttpServer::setNumFileIOThreads(int num_threads) && {
+  return std::move(setNumFileIOThreads(num_threads));
+}
+
+/**
+ * The 429 sent to clients over `limiter`'s limit, serialized once.
+ */
+static std::string too_many_requests(const RateLimiter &limiter) {
+  HttpResponse res;
+  res.set_status_code(429);
+  res.set_header("Retry-After", std::to_string(limiter.retry_after()));
+  res.set_header("Connection", "close");
+  res.text("Too Many Requests");
+  return res.get_full_response();
+}
+
+HttpServer &HttpServer::setNumThreads(int num_threads) & {
+  _numThreads = num_threads;
+  return *this;
+}
+
+HttpServer HttpServer::setNumThreads(int num_threads) && {
+  return std::move(setNumThreads(num_threads));
+}
+
+HttpServer &HttpServer::setBusyPoll(int spin_us) & {
+  _spinMicros = spin_us;
+  return *this;
+}
+
+HttpServer HttpServer::setBusyPoll(int spin_us) && {
+  return std::move(setBusyPoll(spin_us));
+}
+
+HttpServer &HttpServer::loadConfig(const std::string &path) & {
+  _config_path = path;
+  applyConfig(
+      std::make_shared<const ServerConfig>(ServerConfig::from_file(path)));
+  return *this;
+}
+
+HttpServer HttpServer::loadConfig(const std::string &path) && {
+  return std::move(loadConfig(path));
+}
+
+void HttpServer::applyConfig(std::shared_ptr<const ServerConfig> config) {
+  _address = config->address;
+  _port = config->port.value_or(0);
+  _numListeners = config->backlog;
+  _bindRetries = config->bind_retries;
+  _socketOptions = config->socket;
+  _numThreads = config->workers;
+  _spinMicros = config->spin_us;
+  _numFileIOThreads = config->file_io_threads;
+  for (const auto &mount : config->static_directories) {
+    add_static_directory(mount.directory, mount.mount_point);
+  }
+  if (config->rate_limit) {
+    _rate_limiter = std::make_shared<RateLimiter>(
+        config->rate_limit->requests_per_second, config->rate_limit->burst,
+        config->rate_limit->clients);
+  }
+  if (!config->ip_filter.empty()) {
+    setIpFilter(config->ip_filter);
+  }
+  if (!config->redirects.empty()) {
+    setRedirects(config->redirects);
+  }
+  if (!config->not_found_page.empty()) {
+    set404Page(config->not_found_page);
+  }
+  if (config->verbose) {
+    verbose = *config->verbose;
+  }
+  log_requests = config->log_requests;
+  // a holder of its own, so that reloading doesn't change the copies this
+  // server was made from
+  _config = std::make_shared<std::atomic<std::shared_ptr<const ServerConfig>>>(
+      std::move(config));
+}
+
+void HttpServer::reloadConfig() {
+  try {
+    auto config =
+        std::make_shared<const ServerConfig>(ServerConfig::from_file(_config_path));
+    auto old = _config->load();
+    // read everything which can fail before changing anything
+    std::map<std::string, StaticMount> mounts;
+    for (const auto &[directory, mount_point] : config->static_directories) {
+      StaticMount mount{directory, {}};
+      if (mount.directory.back() != '/') {
+        mount.directory += "/";
+      }
+      staticSetup(mount_point, mount);
+      mounts.insert_or_assign(mount_point, std::move(mount));
+    }
+    std::shared_ptr<const IpFilter> ip_filter;
+    if (!config->ip_filter.empty()) {
+      ip_filter =
+          std::make_shared<const IpFilter>(IpFilter::from_file(config->ip_filter));
+    }
+    std::shared_ptr<const RedirectTable> redirects;
+    if (!config->redirects.empty()) {
+      redirects = std::make_shared<const RedirectTable>(
+          RedirectTable::from_file(config->redirects));
+    }
+    std::shared_ptr<RateLimiter> rate_limiter;
+    if (config->rate_limit) {
+      rate_limiter = std::make_shared<RateLimiter>(
+          config->rate_limit->requests_per_second, config->rate_limit->burst,
+          config->rate_limit->clients);
+    }
+
+    // the directories of the old config make way for the new ones, and
+    // directories which were mounted in code are left alone
+    reconfigure([&] {
+      for (const auto &mount : old->static_directories) {
+        _static_mounts.erase(mount.mount_point);
+      }
+      for (auto &[mount_point, mount] : mounts) {
+        _static_mounts.insert_or_assign(mount_point, std::move(mount));
+      }
+    });
+    if (config->rate_limit || old->rate_limit) {
+      _rate_limiter = std::move(rate_limiter);
+      if (_rate_limiter) {
+        _too_many_requests = too_many_requests(*_rate_limiter);
+      }
+    }
+    // accept_connection runs on this thread, so the filter can be set up
+    // here if there wasn't one
+    if (ip_filter || old->ip_filter != config->ip_filter) {
+      _ip_filter_path = config->ip_filter;
+      if (!ip_filter) {
+        ip_filter = std::make_shared<const IpFilter>();
+      }
+      if (_ip_filter) {
+        _ip_filter->store(std::move(ip_filter));
+      } else {
+        _ip_filter =
+            std::make_shared<std::atomic<std::shared_ptr<const IpFilter>>>(
+                std::move(ip_filter));
+      }
+    }
+    std::vector<std::string> restart;
+    if (redirects || old->redirects != config->redirects) {
+      if (_redirects) {
+        _redirects_path = config->redirects;
+        _redirects->store(redirects ? std::move(redirects)
+                                    : std::make_shared<const RedirectTable>());
+      } else {
+        restart.push_back("redirects");
+      }
+    }
+    if (config->verbose) {
+      verbose = *config->verbose;
+    }
+    log_requests = config->log_requests;
+    if (config->address != old->address || config->port != old->port ||
+        config->backlog != old->backlog ||
+        config->bind_retries != old->bind_retries) {
+      restart.push_back("listen");
+    }
+    if (config->socket != old->socket) {
+      restart.push_back("socket");
+    }
+    if (config->workers != old->workers ||
+        config->file_io_threads != old->file_io_threads ||
+        config->spin_us != old->spin_us) {
+      restart.push_back("threads");
+    }
+    if (config->not_found_page != old->not_found_page) {
+      restart.push_back("not_found_page");
+    }
+    _config->store(std::move(config));
+    fmt::print("Reloaded config from {}\n", _config_path);
+    for (const auto &setting : restart) {
+      fmt::print(stderr, "Changes to \"{}\" need a restart\n", setting);
+    }
+  } catch (const std::exception &e) {
+    fmt::print(stderr, "Keeping the old config: {}\n", e.what());
+  }
+}
+
+HttpServer &HttpServer::setRateLimit(double requests_per_second,
+                                     double burst) & {
+  _rate_limiter = std::make_shared<RateLimiter>(requests_per_second, burst);
+  return *this;
+}
+
+HttpServer HttpServer::setRateLimit(double requests_per_second,
+                                    double burst) && {
+  return std::move(setRateLimit(requests_per_second, burst));
+}
+
+HttpServer &HttpServer::setIpFilter(const std::string &path) & {
+  _ip_filter_path = path;
+  _ip_filter = std::make_shared<std::atomic<std::shared_ptr<const IpFilter>>>(
+      std::make_shared<const IpFilter>(IpFilter::from_file(path)));
+  return *this;
+}
+
+HttpServer HttpServer::setIpFilter(const std::string &path) && {
+  return std::move(setIpFilter(path));
+}
+
+void HttpServer::reloadIpFilter() {
+  if (!_ip_filter) {
+    throw std::logic_error("no IP filter was set");
+  }
+  auto filter = std::make_shared<const IpFilter>(IpFilter::from_file(_ip_filter_path));
+  if (verbose) {
+    fmt::print("Reloaded {} IP filter rules from {}\n", filter->size(),
+               _ip_filter_path);
+  }
+  _ip_filter->store(std::move(filter));
+}
+
+HttpServer &HttpServer::setRedirects(const std::string &path) & {
+  _redirects_path = path;
+  _redirects =
+      std::make_shared<std::atomic<std::shared_ptr<const RedirectTable>>>(
+          std::make_shared<const RedirectTable>(RedirectTable::from_file(path)));
+  return *this;
+}
+
+HttpServer HttpServer::setRedirects(const std::string &path) && {
+  return std::move(setRedirects(path));
+}
+
+void HttpServer::reloadRedirects() {
+  if (!_redirects) {
+    throw std::logic_error("no redirects were set");
+  }
+  auto redirects = std::make_shared<const RedirectTable>(
+      RedirectTable::from_file(_redirects_path));
+  if (verbose) {
+    fmt::print("Reloaded {} redirects from {}\n", redirects->size(),
+               _redirects_path);
+  }
+  _redirects->store(std::move(redirects));
+}
+
+std::function<bool(const HttpRequest &, HttpResponse &)>
+rate_limit(double requests_per_second, double burst) {
+  auto limiter = std::make_shared<RateLimiter>(requests_per_second, burst);
+  return [limiter](const HttpRequest &req, HttpResponse &res) {
+    if (limiter->allow(client_key(req.peer()))) {
+      return true;
+    }
+    res.set_status_code(429);
+    res.set_header("Retry-After", std::to_string(limiter->retry_after()));
+    res.text("Too Many Requests");
+    return false;
+  };
+}
+
+std::function<bool(const HttpRequest &, HttpResponse &)>
+timeout(std::chrono::milliseconds timeout) {
+  return [timeout](const HttpRequest &req, HttpResponse &res) {
+    req.set_timeout(timeout);
+    if (std::chrono::steady_clock::now() < req.deadline()) {
+      return true;
+    }
+    res.set_status_code(504);
+    res.text("Gateway Timeout");
+    return false;
+  };
+}
+
+HttpServer &HttpServer::set404Page(const std::string &path) & {
+  HttpResponse res;
+  res.html(path);
+  // the 404 page is sent over and over, so read it once right now
+  res.load_pending_file();
+  res.share_body();
+  _notFoundResponse = res;
+  _notFoundResponse.set_status_code(404);
+  return *this;
+}
+
+HttpServer HttpServer::set404Page(const std::string &path) && {
+  return std::move(set404Page(path));
+}
+
+HttpServer &HttpServer::set404Text(const std::string &message) & {
+  HttpResponse res;
+  res.text(message);
+  res.share_body();
+  _notFoundResponse = res;
+  _notFoundResponse.set_status_code(404);
+  return *this;
+}
+
+HttpServer HttpServer::set404Text(const std::string &message) && {
+  return std::move(set404Text(message));
+}
+
+HttpServer &HttpServer::set404Response(HttpResponse res) & {
+  res.share_body();
+  _notFoundResponse = res;
+  _notFoundResponse.set_status_code(404);
+  return *this;
+}
+
+HttpServer HttpServer::set404Response(HttpResponse res) && {
+  return std::move(set404Response(std::move(res)));
+}
+
+HttpServer &
+HttpServer::mount_static_directory(const std::string &directory_path,
+                                   const std::string &mount_point) & {
+  add_static_directory(directory_path, mount_point);
+  return *this;
+}
+
+HttpServer
+HttpServer::mount_static_directory(const std::string &directory_path,
+                                   const std::string &mount_point) && {
+  return std::move(mount_static_directory(directory_path, mount_point));
+}
+
+HttpServer &
+HttpServer::mount_embedded_assets(std::span<const EmbeddedAsset> assets,
+                                  const std::string &mount_point) & {
+  _embedded_assets = assets;
+  _embedded_assets_mount_point = mount_point;
+  if (_embedded_assets_mount_point.back() != '/') {
+    _embedded_assets_mount_point += "/";
+  }
+  return *this;
+}
+
+HttpServer
+HttpServer::mount_embedded_assets(std::span<const EmbeddedAsset> assets,
+                                  const std::string &mount_point) && {
+  return std::move(mount_embedded_assets(assets, mount_point));
+}
+
+HttpServer &HttpServer::mount_asset_pack(const std::string &pack_path,
+                                         const std::string &mount_point) & {
+  _asset_pack_path = pack_path;
+  _asset_pack_mount_point = mount_point;
+  if (_asset_pack_mount_point.back() != '/') {
+    _asset_pack_mount_point += "/";
+  }
+  return *this;
+}
+
+HttpServer HttpServer::mount_asset_pack(const std::string &pack_path,
+                                        const std::string &mount_point) && {
+  return std::move(mount_asset_pack(pack_path, mount_point));
+}
+
+void HttpServer::reloadAssetPack() {
+  if (_asset_pack_path.empty()) {
+    throw std::logic_error("no asset pack was mounted");
+  }
+  auto pack = std::make_shared<const AssetPack>(_asset_pack_path);
+  if (verbose) {
+    fmt::print("Mapped {} files from asset pack {}\n", pack->size(),
+               _asset_pack_path);
+  }
+  if (_asset_pack) {
+    _asset_pack->store(std::move(pack));
+  } else {
+    _asset_pack =
+        std::make_shared<std::atomic<std::shared_ptr<const AssetPack>>>(
+            std::move(pack));
   }
+}
+
+void HttpServer::reloadAssetPacks() {
+  std::vector<HttpServer *> servers{this};
+  for (auto *hosts : {&_hosts, &_wildcard_hosts}) {
+    for (auto &[host, site] : *hosts) {
+      servers.push_back(site.get());
+    }
+  }
+  for (auto *server : servers) {
+    if (server->_asset_pack_path.empty()) {
+      continue;
+    }
+    try {
+      server->reloadAssetPack();
+    } catch (const std::runtime_error &e) {
+      fmt::print(stderr, "Keeping the old asset pack: {}\n", e.what());
+    }
+  }
+}
+
+HttpServer &HttpServer::virtual_host(const std::string &host,
+                                     HttpServer site) & {
+  if (!site._hosts.empty() || !site._wildcard_hosts.empty()) {
+    throw std::invalid_argument("virtual hosts cannot have virtual hosts: " +
+                                host);
+  }
+  std::string name = strutil::lowers(host);
+  bool wildcard = name.starts_with("*.");
+  if (wildcard) {
+    name.erase(0, 1);
+  }
+  if (name.empty() || name == "." || name.ends_with('.') ||
+      name.find('*') != name.npos || name.find(' ') != name.npos ||
+      strutil::has_control_chars(name)) {
+    throw std::invalid_argument("invalid virtual host: " + host);
+  }
+  auto &hosts = wildcard ? _wildcard_hosts : _hosts;
+  hosts.insert_or_assign(std::move(name),
+                         std::make_shared<HttpServer>(std::move(site)));
+  return *this;
+}
+
+HttpServer HttpServer::virtual_host(const std::string &host,
+                                    HttpServer site) && {
+  return std::move(virtual_host(host, std::move(site)));
+}
+
+/**
+ * Returns a copy of a `sockaddr_in` with its
+ * fields initialized.
+ *
+ * s_addr is initialized to `address`, which is "0.0.0.0" (`INADDR_ANY`)
+ * by default, and sin_port is initialized to `port`.
+ *
+ * @param address The IPv4 address, which the config has checked already
+ * @param port The port number
+ * @return The sockaddr_in struct with its fields initialized
+ */
+static sockaddr_in get_sa(const std::string &address, uint16_t port) {
+  sockaddr_in sa{};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &sa.sin_addr) != 1) {
+    throw std::invalid_argument("invalid listen address: " + address);
+  }
+  return sa;
+}
+
+/**
+ * This function reads the request body into `req`, whose size has already
+ * been taken from the "Content-Length" header of the request and checked
+ * against the body size limit.
+ *
+ * @param connfd The socket to be reading from
+ * @param req The HttpRequest object
+ * @param size_to_read The size of the body
+ */
+void handle_request_body(int connfd, HttpRequest &req,
+                         std::size_t size_to_read) {
+  if (size_to_read == 0) {
+    return;
+  }
+  // various methods of reading the request body into req._body
+
+  // unique pointer method (buf gets deallocated for automatically
+  // and doesn't read directly into the string's `data` so it's
+  // safer)
+  /* auto buf = std::make_unique<char []>(size_to_read + 1);
+  memset(&buf[0], 0, size_to_read + 1);
+  read(connfd, &buf[0], size_to_read);
+  req._body.append(buf.get()); */
+
+  // resize method (don't need to use a temp variable in between)
+  // I'll settle on this one for now.
+  // note: don't have to take the null-terminating character into
+  // account when resizing the string
+  //
+  // could be dangerous to read directly into `req._body.data()`,
+  // but since this is the only place we modify it, it should be ok
+  //
+  // the body is resized with json::PADDING zeroed bytes to spare first, which
+  // stay allocated after shrinking it back down so that `req.json()` can
+  // read the body in place
+  req._body.resize(size_to_read + json::PADDING);
+  std::size_t total = 0;
+  while (total < size_to_read) {
+    ssize_t n = read(connfd, req._body.data() + total, size_to_read - total);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    total += n;
+  }
+  req._body.resize(total);
+
+  // Temp string method
+  /* std::string buf(size_to_read + 1, 0);
+  read(connfd, buf.data(), size_to_read);
+  req._body = buf; */
+}
+
+/**
+ * Check whether an Accept-Encoding header allows `coding`, taking q=0 as a
+ * refusal. An explicit entry for the coding wins over a "*".
+ *
+ * @param accept_encoding The value of the header
+ * @param coding The content coding, i.e. "gzip"
+ */
+static bool accepts_encoding(std::string_view accept_encoding,
+                             std::string_view coding) {
+  std::optional<bool> wildcard;
+  for (std::string_view element : strutil::split_view(accept_encoding, ",")) {
+    std::string_view name = element.substr(0, element.find(';'));
+    std::string_view params = element.substr(name.size());
+    name = strutil::trim_view(name);
+    // q=0, q=0.0 and so on are the only ways of saying no
+    bool refused = false;
+    for (std::string_view param : strutil::split_view(params, ";")) {
+      param = strutil::trim_view(param);
+      if (param.size() > 2 && strutil::iequals(param.substr(0, 2), "q=")) {
+        std::string_view q = param.substr(2);
+        refused = q.starts_with('0') &&
+                  q.find_first_not_of("0.") == std::string_view::npos;
+      }
+    }
+    // "x-gzip" is an alias of "gzip", see RFC 7230 section 4.2.3
+    if (strutil::iequals(name, coding) ||
+        (coding == "gzip" && strutil::iequals(name, "x-gzip"))) {
+      return !refused;
+    }
+    if (name == "*") {
+      wildcard = !refused;
+    }
+  }
+  return wildcard.value_or(false);
+}
+
+/**
+ * Check whether an If-None-Match header matches `etag`, i.e. is "*" or lists
+ * it. Weak tags match as well, since this is only used for GET requests.
+ *
+ * @param if_none_match The value of the header
+ * @param etag The quoted ETag of the resource
+ */
+static bool etag_matches(std::string_view if_none_match,
+                         std::string_view etag) {
+  if (strutil::trim_view(if_none_match) == "*") {
+    return true;
+  }
+  for (std::string_view tag : strutil::split_view(if_none_match, ",")) {
+    tag = strutil::trim_view(tag);
+    if (tag.size() > 2 && strutil::iequals(tag.substr(0, 2), "w/")) {
+      tag.remove_prefix(2);
+    }
+    if (tag == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Fill in `res` with `asset`, picking the smallest encoding the client
+ * accepts and answering conditional requests with a 304.
+ *
+ * The body is never copied: embedded assets are sent straight from the
+ * executable's memory, and files in an asset pack are `sendfile`d out of
+ * the pack.
+ *
+ * @param asset The embedded asset to be sent
+ * @param req The HttpRequest the asset was requested in
+ * @param res The HttpResponse to be filled in
+ * @param pack The pack `asset` was found in, if any
+ */
+static void
+serve_embedded_asset(const EmbeddedAsset &asset, const HttpRequest &req,
+                     HttpResponse &res,
+                     const std::shared_ptr<const AssetPack> &pack = nullptr) {
+  const auto &headers = req.headers();
+  res.set_header("ETag", std::string(asset.etag));
+  res.set_header("Vary", "Accept-Encoding");
+  // header values are lowercased by HttpRequest, and so are our ETags
+  if (headers.contains("if-none-match") &&
+      etag_matches(headers.at("if-none-match"), asset.etag)) {
+    res.set_status_code(304);
+    return;
+  }
+  res.set_header("Content-Type", std::string(asset.mime_type));
+  std::string_view accept_encoding;
+  if (headers.contains("accept-encoding")) {
+    accept_encoding = headers.at("accept-encoding");
+  }
+  std::string_view body = asset.data;
+  if (!asset.brotli.empty() && accepts_encoding(accept_encoding, "br")) {
+    res.set_header("Content-Encoding", "br");
+    body = asset.brotli;
+  } else if (!asset.gzip.empty() &&
+             accepts_encoding(accept_encoding, "gzip")) {
+    res.set_header("Content-Encoding", "gzip");
+    body = asset.gzip;
+  }
+  if (pack) {
+    res.set_body(FileRegion{pack->fd(), pack->offset_of(body), body.size(),
+                            pack});
+  } else {
+    res.set_static_body(body);
+  }
+}
+
+bool HttpServer::send_response(HttpResponse &res, int connfd) {
+  if (!res._pending_file.empty() && _file_io_pool != nullptr) {
+    _file_io_pool->enqueue([res, connfd]() mutable {
+      try {
+        res.load_pending_file();
+        res.write_to(connfd);
+      } catch (const std::runtime_error &e) {
+        // the file went away after the handler looked at it
+        fmt::print(stderr, "{}\n", e.what());
+        HttpResponse error;
+        error.set_status_code(500);
+        error.write_to(connfd);
+      }
+      close(connfd);
+    });
+    return false;
+  }
+  res.write_to(connfd);
+  return true;
+}
+
+bool HttpServer::handle_reply(const HttpRequest &request, int connfd) {
+
+  if (_redirects) {
+    // hold on to the table until the response is written
+    auto redirects = _redirects->load();
+    if (auto match = redirects->find(request.route())) {
+      iovec iov[3] = {
+          {const_cast<char *>(match->head.data()), match->head.size()},
+          {const_cast<char *>(match->suffix.data()), match->suffix.size()},
+          {const_cast<char *>(match->tail.data()), match->tail.size()}};
+      // done with the connection whether or not the write went through
+      writev_all(connfd, iov, 3);
+      return true;
+    }
+  }
+
+  return select_host(request).route_request(request, connfd);
+}
+
+HttpServer &HttpServer::select_host(const HttpRequest &request) {
+  if (_hosts.empty() && _wildcard_hosts.empty()) {
+    return *this;
+  }
+  std::string_view host = request.host();
+  if (auto site = _hosts.find(host); site != _hosts.end()) {
+    return *site->second;
+  }
+  // try the longest suffix first, i.e. ".b.example.com" and then
+  // ".example.com" for "a.b.example.com"
+  for (std::size_t dot = host.find('.', 1); dot != host.npos;
+       dot = host.find('.', dot + 1)) {
+    if (auto site = _wildcard_hosts.find(host.substr(dot));
+        site != _wildcard_hosts.end()) {
+      return *site->second;
+    }
+  }
+  return *this;
+}
+
+bool HttpServer::route_request(const HttpRequest &request, int connfd) {
+  HttpResponse res;
+  res.set_header("x-powered-by", "Wilson-Server");
+
+  const RouteTable &table = routeTable();
+  auto route = table.routes.find(request.method());
+  if (route != table.routes.end() &&
+      route->second.contains(request.route())) {
+    if (log_requests) {
+      fmt::print("Route func found for the requested method: {} and path: {}\n",
+                 request.method(), request.route());
+    }
+
+    const auto &func = route->second.at(request.route());
+    try {
+      func(request, res);
+    } catch (const json::error &e) {
+      // the handler couldn't make sense of a JSON body
+      res = HttpResponse();
+      res.set_header("x-powered-by", "Wilson-Server");
+      res.set_status_code(400);
+      res.text(e.what());
+    }
+    if (std::chrono::steady_clock::now() >= request.deadline()) {
+      // too late for the response to be of any use
+      res = HttpResponse();
+      res.set_header("x-powered-by", "Wilson-Server");
+      res.set_status_code(504);
+      res.text("Gateway Timeout");
+    }
+    // add custom powered-by header
+    return send_response(res, connfd);
+  }
+
+  // requests which didn't match a route still go through the middleware,
+  // i.e. so that authentication covers the asset pack as well
+  if (!run_middleware(table, request, res)) {
+    run_after_hooks(table, request, res);
+    return send_response(res, connfd);
+  }
+
+  // fall back to the asset pack before giving up on the request
+  if (_asset_pack && request.method() == "GET" &&
+      request.route().starts_with(_asset_pack_mount_point)) {
+    // hold on to the pack until the response is written
+    auto pack = _asset_pack->load();
+    std::string path =
+        request.route().substr(_asset_pack_mount_point.length() - 1);
+    auto asset = pack->find(path == "/" ? "/index.html" : path);
+    if (asset) {
+      serve_embedded_asset(*asset, request, res, pack);
+      run_after_hooks(table, request, res);
+      return send_response(res, connfd);
+    }
+  }
+
+  if (route == table.routes.end()) {
+    fmt::print(stderr,
+               "No route handler configured for the requested method: {}\n",
+               request.method());
+    res.set_status_code(405);
+    run_after_hooks(table, request, res);
+    return send_response(res, connfd);
+  }
+
+  fmt::print(stderr,
+             "No route handler configured for the requested path: {}\n",
+             request.route());
+  HttpResponse not_found = _notFoundResponse;
+  // keep the headers the middleware added, along with x-powered-by
+  for (const auto &[key, value] : res._headers) {
+    not_found.set_header(key, value);
+  }
+  run_after_hooks(table, request, not_found);
+  return send_response(not_found, connfd);
+}
+
+void HttpServer::staticSetup(const std::string &mount_point,
+                             StaticMount &mount) {
+  auto root = std::filesystem::path(mount.directory);
+  if (!is_directory(root)) {
+    throw std::invalid_argument(
+        "static directory path has to point to a directory");
+  }
+  if (root.empty()) {
+    throw std::invalid_argument("given directory is empty");
+  }
+  if (!std::ifstream(root / "index.html").good()) {
+    throw std::invalid_argument(
+        "index.html does not exist in the root directory of the static folder");
+  }
+  mount.routes.clear();
   // Set the entry point "index.html" to the route specified at
-  // `_static_directory_mount_point`
-  this->_get(_static_directory_mount_point,
-             [=](const HttpRequest &req, HttpResponse &res) {
-               res.html(root / "index.html");
-             });
+  // `mount_point`
+  mount.routes.insert_or_assign(
+      mount_point, [=](const HttpRequest &req, HttpResponse &res) {
+        res.html(root / "index.html");
+      });
+  // files go under the mount point, i.e. "/docs/style.css" for "/docs" or
+  // "/docs/", so that directories on different mount points don't clash
+  std::string prefix = mount_point;
+  if (prefix.ends_with('/')) {
+    prefix.pop_back();
+  }
   // Recursively list all the files in the static directory
   for (const auto &entry :
-       std::filesystem::recursive_directory_iterator(_static_directory_path)) {
+       std::filesystem::recursive_directory_iterator(mount.directory)) {
     std::string extension(entry.path().extension());
     // This skips all the directory entries
     if (!std::filesystem::is_regular_file(entry.path())) {
@@ -448,63 +1846,179 @@ void HttpServer::staticSetup() {
     // Get the file path relatice to the root i.e. /static instead of
     // /build/static
     std::string file_name = std::filesystem::relative(entry.path(), root);
-    this->_get("/" + file_name, [=](const HttpRequest &req, HttpResponse &res) {
-      std::string content_type;
-      if (extension == ".css") {
-        content_type = "text/css";
-      } else if (extension == ".js") {
-        content_type = "text/javascript";
-      } else if (extension == ".html") {
-        content_type = "text/html";
-      } else if (extension == ".ico") {
-        res.image(entry.path(), "x-icon");
-        return;
-      } else if (extension == ".svg") {
-        res.image(entry.path(), "svg+xml");
-        return;
-      } else if (extension == ".txt") {
-        content_type = "text/plain";
-      } else if (extension == ".json" || extension == ".map") {
-        content_type = "application/json";
-      } else if (extension == ".png") {
-        res.image(entry.path());
-        return;
-      } else {
-        content_type = "text/plain";
-      }
-      res.set_header("Content-Type", content_type);
-      res.static_file(entry.path());
-    });
+    // Look the content type up once here instead of on every request
+    std::string content_type(mime::lookup(extension));
+    std::string path = entry.path();
+    mount.routes.insert_or_assign(
+        prefix + "/" + file_name,
+        [=](const HttpRequest &req, HttpResponse &res) {
+          res.set_header("Content-Type", content_type);
+          res.static_file(path);
+        });
+  }
+}
+
+void HttpServer::embeddedSetup(std::map<std::string, routeFunc> &routes) const {
+  for (const EmbeddedAsset &asset : _embedded_assets) {
+    // `asset.path` always starts with a '/', and the mount point always ends
+    // with one
+    std::string route =
+        _embedded_assets_mount_point + std::string(asset.path.substr(1));
+    routes.insert_or_assign(
+        route, [&asset](const HttpRequest &req, HttpResponse &res) {
+          serve_embedded_asset(asset, req, res);
+        });
+  }
+  if (const EmbeddedAsset *index =
+          find_embedded_asset(_embedded_assets, "/index.html")) {
+    routes.insert_or_assign(_embedded_assets_mount_point,
+                            [index](const HttpRequest &req, HttpResponse &res) {
+                              serve_embedded_asset(*index, req, res);
+                            });
   }
 }
 
-void HttpServer::handle_connections(int connfd) {
+/**
+ * Send a response with no body and close the connection, for requests which
+ * aren't read any further. `monitor` drains what's left of the request, so
+ * the worker doesn't wait for the client.
+ */
+static void reject(DisconnectMonitor &monitor, int connfd, int status_code) {
+  HttpResponse res;
+  res.set_status_code(status_code);
+  res.set_header("Connection", "close");
+  res.write_to(connfd);
+  monitor.drain(connfd);
+}
+
+void HttpServer::handle_connections(
+    int connfd, const sockaddr_storage &peer,
+    std::chrono::steady_clock::time_point accepted) {
+  // the config of the whole connection, even if it is reloaded meanwhile
+  auto config = _config->load();
+  auto request_timeout = std::chrono::milliseconds(config->request_timeout_ms);
+  if (config->request_timeout_ms > 0 &&
+      std::chrono::steady_clock::now() - accepted >= request_timeout) {
+    // the connection waited in the queue for so long that the response
+    // would be too late, so don't spend any time on it: not even on draining
+    // the request, which would only make an overload worse
+    HttpResponse res;
+    res.set_status_code(503);
+    res.set_header("Connection", "close");
+    res.write_to(connfd);
+    close(connfd);
+    return;
+  }
+  if (config->read_timeout_ms > 0) {
+    timeval timeout{config->read_timeout_ms / 1000,
+                    config->read_timeout_ms % 1000 * 1000};
+    setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  }
+  if (config->write_timeout_ms > 0) {
+    timeval timeout{config->write_timeout_ms / 1000,
+                    config->write_timeout_ms % 1000 * 1000};
+    setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  }
   char buf[2] = {0};
   std::string request_string;
   while (true) {
     int len_read = read(connfd, buf, 1);
     if (len_read == 0) {
       fmt::print("Client closed the connection\n");
+      close(connfd);
       return;
     }
     if (len_read < 0) {
       fmt::print("Error reading from connection\n");
+      close(connfd);
       return;
     }
     request_string.append(buf);
     if (request_string.ends_with("\r\n\r\n")) {
       break;
     }
+    if (config->max_header_bytes > 0 &&
+        request_string.size() > config->max_header_bytes) {
+      reject(*_disconnect_monitor, connfd, 431);
+      return;
+    }
   }
   // parse and store the HTTP request headers and body in `request`
-  HttpRequest request(request_string);
-  handle_request_body(connfd, request);
+  std::optional<HttpRequest> parsed;
+  try {
+    parsed.emplace(request_string);
+  } catch (const std::invalid_argument &e) {
+    fmt::print(stderr, "Bad request: {}\n", e.what());
+    HttpResponse res;
+    res.set_status_code(400);
+    send_response(res, connfd);
+    close(connfd);
+    return;
+  }
+  HttpRequest &request = *parsed;
+  request._peer = peer;
+  request._received = accepted;
+  if (config->request_timeout_ms > 0) {
+    request.set_timeout(request_timeout);
+  }
+  // turn away bodies which are malformed or too large before reading any
+  // of them
+  std::size_t body_size = 0;
+  try {
+    body_size = request.content_length();
+  } catch (const std::invalid_argument &) {
+    reject(*_disconnect_monitor, connfd, 400);
+    return;
+  }
+  std::size_t max_body_bytes = config->max_body_bytes > 0
+                                   ? config->max_body_bytes
+                                   : DEFAULT_MAX_BODY_BYTES;
+  if (body_size > max_body_bytes) {
+    reject(*_disconnect_monitor, connfd, 413);
+    return;
+  }
+  // a client which sent `Expect: 100-continue` waits for the go ahead
+  // before sending its body, so that it can be turned away first
+  auto expect = request._headers.find("expect");
+  if (expect != request._headers.end() && expect->second != "100-continue") {
+    reject(*_disconnect_monitor, connfd, 417);
+    return;
+  }
+  if (request._headers.contains("content-length")) {
+    HttpResponse res;
+    if (!run_body_hooks(request, res)) {
+      res.set_header("Connection", "close");
+      res.write_to(connfd);
+      _disconnect_monitor->drain(connfd);
+      return;
+    }
+    if (expect != request._headers.end()) {
+      static constexpr std::string_view CONTINUE =
+          "HTTP/1.1 100 Continue\r\n\r\n";
+      iovec iov{const_cast<char *>(CONTINUE.data()), CONTINUE.size()};
+      if (!writev_all(connfd, &iov, 1)) {
+        close(connfd);
+        return;
+      }
+    }
+  }
+  handle_request_body(connfd, request, body_size);
 
-  std::cout << fmt::format("Recieved {} request for route: {}",
-                           request.method(), request.route())
-            << std::endl;
+  if (log_requests) {
+    std::cout << fmt::format("Recieved {} request for route: {}",
+                             request.method(), request.route())
+              << std::endl;
+  }
+  // watch for the client hanging up while the request is handled
+  request._cancelled = _disconnect_monitor->watch(connfd);
   // handle the reply to the client based on the request recieved
-  handle_reply(request, connfd);
+  bool done = handle_reply(request, connfd);
+  if (request._cancelled) {
+    _disconnect_monitor->unwatch(connfd, request._cancelled);
+  }
+  if (done) {
+    close(connfd);
+  }
 }
 
 void HttpServer::_cleanup() {
@@ -512,180 +2026,342 @@ void HttpServer::_cleanup() {
   std::cout << "\nall sockets closed. Exiting now..." << std::endl;
 }
 
-int HttpServer::accept_connection() {
-  // create a sockaddr struct to store client information
-  sockaddr_in client_sa = {0}; // zero out the struct
-  socklen_t client_sa_len =
-      sizeof(sockaddr); // must initialize value to size of struct
-
-  // accept is now non-blocking as _listenfd is set to be non-blocking
-  int connfd = accept(_listenfd, reinterpret_cast<sockaddr *>(&client_sa),
-                      &client_sa_len);
-  if (connfd == -1) {
-    _cleanup();
-    std::cerr << std::strerror(errno) << std::endl;
-    throw std::runtime_error("error accepting connection");
+int HttpServer::accept_connection(sockaddr_storage &peer) {
+  while (_run) {
+    // zero out the struct which stores the client information
+    peer = {};
+    socklen_t client_sa_len =
+        sizeof(peer); // must initialize value to size of struct
+
+#ifdef __linux__
+    // connections stay blocking, since workers block on them with timeouts
+    int connfd = accept4(_listenfd, reinterpret_cast<sockaddr *>(&peer),
+                         &client_sa_len, SOCK_CLOEXEC);
+#else
+    int connfd =
+        accept(_listenfd, reinterpret_cast<sockaddr *>(&peer), &client_sa_len);
+    if (connfd != -1) {
+      fcntl(connfd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (connfd == -1) {
+      switch (errno) {
+      case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+      case EWOULDBLOCK:
+#endif
+      case EINTR:
+        // the backlog is drained, or a signal, i.e. SIGHUP, which the
+        // accept loop takes care of
+        return -1;
+      case ECONNABORTED:
+      case EPROTO:
+      case EPERM:
+        // the client went away while it was waiting, or a firewall rule
+        // turned it away, neither of which are the server's problem
+        continue;
+      case EMFILE:
+      case ENFILE:
+      case ENOBUFS:
+      case ENOMEM:
+        // leave the rest of the storm in the backlog until connections
+        // which are being handled free some descriptors up
+        fmt::print(stderr, "Unable to accept connections: {}\n",
+                   std::strerror(errno));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return -1;
+      default:
+        _cleanup();
+        std::cerr << std::strerror(errno) << std::endl;
+        throw std::runtime_error("error accepting connection");
+      }
+    }
+    if (_ip_filter && !_ip_filter->load()->allowed(peer)) {
+      // reset the connection rather than leaving it in TIME_WAIT
+      linger reset{1, 0};
+      setsockopt(connfd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+      close(connfd);
+      continue;
+    }
+    if (verbose) {
+      // the port is in the same place for IPv4 and IPv6
+      std::uint16_t port =
+          ntohs(reinterpret_cast<const sockaddr_in &>(peer).sin_port);
+      fmt::print("Recieved connection from address: {}:{}\n",
+                 format_address(peer), port);
+    }
+    return connfd;
   }
-  // use `INET_ADDRSTRLEN` as the max size of an internet address
-  char client_address[INET_ADDRSTRLEN] = {0};
-  inet_ntop(client_sa.sin_family, &client_sa.sin_addr, client_address,
-            INET_ADDRSTRLEN);
-  if (verbose) {
-    fmt::print("Recieved connection from address: {}:{}", client_address,
-               client_sa.sin_port);
+  return -1;
+}
+
+void HttpServer::wait_for_connection() {
+  pollfd listener{_listenfd, POLLIN, 0};
+  if (_spinMicros > 0) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::microseconds(_spinMicros);
+    while (std::chrono::steady_clock::now() < deadline) {
+      if (poll(&listener, 1, 0) > 0) {
+        return;
+      }
+      cpu_relax();
+    }
   }
-  return connfd;
+  // nothing for the whole budget, so sleep until there is. A signal ends
+  // the wait early as well
+  poll(&listener, 1, -1);
 }
 
 void HttpServer::try_bind(const int &port) {
   int bind_retry_count = 0;
   int bind_status;
-  sockaddr_in sa = get_sa(port);
+  sockaddr_in sa = get_sa(_address, port);
   do {
     bind_status =
         bind(_listenfd, reinterpret_cast<sockaddr *>(&sa), sizeof(sockaddr));
     if (bind_status == -1) {
       std::cout << fmt::format(
           "Binding to port {} failed. Retry count: {}/{}\n", port,
-          ++bind_retry_count, BIND_RETRY_COUNT);
+          ++bind_retry_count, _bindRetries);
       std::cerr << std::strerror(errno) << std::endl;
       std::cout << fmt::format("Waiting {}s before retrying...\n",
                                bind_retry_count);
       sleep(1 * bind_retry_count);
     }
-  } while (bind_status == -1 && bind_retry_count < BIND_RETRY_COUNT);
+  } while (bind_status == -1 && bind_retry_count < _bindRetries);
 
   if (bind_status == -1) {
     std::cerr << std::strerror(errno) << std::endl;
     throw std::runtime_error(
-        fmt::format("Unable to bind after {} tries", BIND_RETRY_COUNT));
+        fmt::format("Unable to bind after {} tries", _bindRetries));
   }
 }
 
+/**
+ * The most connections the kernel lets wait to be accepted, which larger
+ * backlogs are cut down to anyway.
+ */
+static int somaxconn() {
+  std::ifstream file("/proc/sys/net/core/somaxconn");
+  int limit = 0;
+  if (file >> limit && limit > 0) {
+    return limit;
+  }
+  return SOMAXCONN;
+}
+
 void HttpServer::try_listen(const int &port) {
-  if (listen(_listenfd, _numListeners) == -1) {
+  int backlog = _numListeners > 0 ? _numListeners : somaxconn();
+  if (listen(_listenfd, backlog) == -1) {
     std::cerr << strerror(errno) << std::endl;
     throw std::runtime_error("unable to listen");
   }
   std::cout << fmt::format("Now listening at port: {} with {} listeners\n",
-                           port, _numListeners);
+                           port, backlog);
 }
 
 void HttpServer::setup_interrupts() {
   struct sigaction sigAction;
   sigAction.sa_flags = 0;
   sigAction.sa_handler = intHandler;
+  sigemptyset(&sigAction.sa_mask);
   sigaction(SIGINT, &sigAction, NULL);
+  // SIGHUP reloads the config file and the asset packs, if there are any
+  bool asset_packs = !_asset_pack_path.empty();
+  for (auto *hosts : {&_hosts, &_wildcard_hosts}) {
+    for (auto &[host, site] : *hosts) {
+      asset_packs = asset_packs || !site->_asset_pack_path.empty();
+    }
+  }
+  if (!_config_path.empty() || asset_packs) {
+    struct sigaction hup;
+    hup.sa_flags = 0;
+    hup.sa_handler = hupHandler;
+    sigemptyset(&hup.sa_mask);
+    sigaction(SIGHUP, &hup, NULL);
+  }
+  // writing to a client which went away should fail with EPIPE instead of
+  // killing the whole server
+  struct sigaction ignore;
+  ignore.sa_flags = 0;
+  ignore.sa_handler = SIG_IGN;
+  sigemptyset(&ignore.sa_mask);
+  sigaction(SIGPIPE, &ignore, NULL);
+}
+
+/**
+ * Set an int socket option, and only warn if it can't be set since the
+ * server works without any of them.
+ */
+static void set_option(int fd, int level, int option, int value,
+                       const char *name) {
+  if (setsockopt(fd, level, option, &value, sizeof(value)) == -1) {
+    fmt::print(stderr, "Unable to set {}: {}\n", name, std::strerror(errno));
+  }
 }
 
 int HttpServer::create_socket() {
   int fd = socket(AF_INET, SOCK_STREAM, 0);
-  // Get the socket's current flags
-  int flags = fcntl(fd, F_GETFL, 0);
-  // Set the socket to be non-blocking
-  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-  // Set the socket to be reusable instantly; Violates TCP/IP protocol?
-  int iSetOption = 1;
-  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&iSetOption,
-             sizeof(iSetOption));
   if (fd == -1) {
     throw std::runtime_error("Failed to create socket");
   }
+  // the accept loop waits for connections in `poll` and then accepts until
+  // there are none left, which needs `accept` to fail instead of blocking
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  // Set the socket to be reusable instantly; Violates TCP/IP protocol?
+  set_option(fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR");
+  // the rest are inherited by accepted connections, which saves setting
+  // them on every one of those. Buffer sizes have to be set before
+  // `listen` for the window scale to take them into account
+  const ServerConfig::SocketOptions &options = _socketOptions;
+  if (options.nodelay) {
+    set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  }
+  if (options.recv_buffer > 0) {
+    set_option(fd, SOL_SOCKET, SO_RCVBUF, options.recv_buffer, "SO_RCVBUF");
+  }
+  if (options.send_buffer > 0) {
+    set_option(fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer, "SO_SNDBUF");
+  }
+  if (options.defer_accept_s > 0) {
+#ifdef TCP_DEFER_ACCEPT
+    set_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, options.defer_accept_s,
+               "TCP_DEFER_ACCEPT");
+#else
+    fmt::print(stderr, "TCP_DEFER_ACCEPT isn't supported here\n");
+#endif
+  }
+  if (options.fastopen_queue > 0) {
+#ifdef TCP_FASTOPEN
+    set_option(fd, IPPROTO_TCP, TCP_FASTOPEN, options.fastopen_queue,
+               "TCP_FASTOPEN");
+#else
+    fmt::print(stderr, "TCP_FASTOPEN isn't supported here\n");
+#endif
+  }
+  if (_spinMicros > 0) {
+    // connections inherit this too, so that reading a request polls the
+    // device queue instead of sleeping until the interrupt
+#ifdef SO_BUSY_POLL
+    set_option(fd, SOL_SOCKET, SO_BUSY_POLL, _spinMicros, "SO_BUSY_POLL");
+#endif
+  }
+  cork_responses = options.cork;
   return fd;
 }
 
-void handle_connections_free(
-    int connfd,
-    std::unordered_map<
-        std::string,
-        std::map<std::string,
-                 std::function<void(const HttpRequest &, HttpResponse &)>>>
-        _routes,
-    HttpResponse _notFoundResponse) {
-  char buf[2] = {0};
-  std::string request_string;
-  while (true) {
-    int len_read = read(connfd, buf, 1);
-    if (len_read == 0) {
-      fmt::print("Client closed the connection\n");
-      return;
-    }
-    if (len_read < 0) {
-      fmt::print("Error reading from connection\n");
-      return;
-    }
-    request_string.append(buf);
-    if (request_string.ends_with("\r\n\r\n")) {
-      break;
-    }
+void HttpServer::routeSetup() {
+  // setup static directories first so that any errors can be caught early
+  for (auto &[mount_point, mount] : _static_mounts) {
+    staticSetup(mount_point, mount);
   }
-  // parse and store the HTTP request headers and body in `request`
-  HttpRequest request(request_string);
-  handle_request_body(connfd, request);
-
-  std::cout << fmt::format("Recieved {} request for route: {}",
-                           request.method(), request.route())
-            << std::endl;
-  // handle the reply to the client based on the request recieved
-  HttpResponse res;
-  res.set_header("x-powered-by", "Wilson-Server");
-  if (!_routes.contains(request.method())) {
-    fmt::print(stderr,
-               "No route handler configured for the requested method: {}\n",
-               request.method());
-    res.set_status_code(405);
-    std::string reply = res.get_full_response();
-    write(connfd, reply.c_str(), reply.length());
-    return;
-  }
-
-  auto route = _routes.at(request.method());
-
-  if (!route.contains(request.route())) {
-    fmt::print(stderr,
-               "No route handler configured for the requested path: {}\n",
-               request.route());
-    _notFoundResponse.set_header("x-powered-by", "Wilson-Server");
-    std::string reply = _notFoundResponse.get_full_response();
-    write(connfd, reply.c_str(), reply.length());
-    return;
+  if (!_asset_pack_path.empty()) {
+    auto pack = std::make_shared<const AssetPack>(_asset_pack_path);
+    if (verbose) {
+      fmt::print("Mapped {} files from asset pack {}\n", pack->size(),
+                 _asset_pack_path);
+    }
+    _asset_pack =
+        std::make_shared<std::atomic<std::shared_ptr<const AssetPack>>>(
+            std::move(pack));
   }
-
-  fmt::print("Route func found for the requested method: {} and path: {}\n",
-             request.method(), request.route());
-
-  auto routeFunc = route.at(request.route());
-
-  auto func = route.at(request.route());
-  func(request, res);
-  // add custom powered-by header
-  std::string reply = res.get_full_response();
-  write(connfd, reply.c_str(), reply.length());
-  close(connfd);
+  _live_routes = std::make_shared<LiveRoutes>();
+  publishRoutes();
 }
 
-void HttpServer::run(const std::uint16_t &port) {
-  // setup static directory first so that any errors can be caught early
-  if (!_static_directory_path.empty()) {
-    staticSetup();
+void HttpServer::run(const std::uint16_t &requested_port) {
+  std::uint16_t port =
+      requested_port != 0 ? requested_port : _port != 0 ? _port : DEFAULT_PORT;
+  routeSetup();
+  for (auto *hosts : {&_hosts, &_wildcard_hosts}) {
+    for (auto &[host, site] : *hosts) {
+      site->routeSetup();
+    }
   }
   setup_interrupts();
 
-  _listenfd = socket(AF_INET, SOCK_STREAM, 0); // create_socket();
+  _listenfd = create_socket();
   try_bind(port);
   try_listen(port);
 
-  int num_threads = std::thread::hardware_concurrency();
+  int num_threads =
+      _numThreads > 0 ? _numThreads : std::thread::hardware_concurrency();
+  if (_numThreads <= 0 && _spinMicros > 0 && num_threads > 1) {
+    // a core of its own for the accept loop, which spins as well
+    --num_threads;
+  }
   if (verbose) {
     fmt::print("Creating thread pool with {} threads\n", num_threads);
   }
-  ThreadPool pool(num_threads);
+  if (_spinMicros > 0 &&
+      static_cast<unsigned>(num_threads) >= std::thread::hardware_concurrency()) {
+    fmt::print(stderr,
+               "Busy-polling with {} workers and the accept loop on {} cores "
+               "leaves them fighting over the cores, use fewer workers\n",
+               num_threads, std::thread::hardware_concurrency());
+  }
+  // declared before `pool` so that they outlive the workers which use them
+  DisconnectMonitor disconnect_monitor;
+  _disconnect_monitor = &disconnect_monitor;
+  ThreadPool file_io_pool(_numFileIOThreads);
+  _file_io_pool = &file_io_pool;
+  for (auto *hosts : {&_hosts, &_wildcard_hosts}) {
+    for (auto &[host, site] : *hosts) {
+      site->_file_io_pool = &file_io_pool;
+    }
+  }
+  // the pools and the monitor are locals, so nothing may point at them once
+  // `run` is left, even by an exception. Declared before `pool` so that its
+  // workers are done by then
+  struct Detach {
+    HttpServer &server;
+    ~Detach() {
+      server._file_io_pool = nullptr;
+      server._disconnect_monitor = nullptr;
+      for (auto *hosts : {&server._hosts, &server._wildcard_hosts}) {
+        for (auto &[host, site] : *hosts) {
+          site->_file_io_pool = nullptr;
+        }
+      }
+    }
+  } detach{*this};
+  ThreadPool pool(num_threads, std::chrono::microseconds(_spinMicros));
+
+  if (_rate_limiter) {
+    _too_many_requests = too_many_requests(*_rate_limiter);
+  }
 
   while (_run) {
-    int connfd = accept_connection();
-    pool.enqueue([connfd, this]() {
-      handle_connections_free(connfd, _routes, _notFoundResponse);
-    });
+    if (_reload) {
+      _reload = 0;
+      if (!_config_path.empty()) {
+        reloadConfig();
+      }
+      reloadAssetPacks();
+    }
+    wait_for_connection();
+    // take every connection which is waiting rather than one per wakeup,
+    // but no more than a batch so that a storm of them doesn't hold up
+    // SIGINT and reloads
+    for (int accepted = 0; accepted < ACCEPT_BATCH_SIZE; ++accepted) {
+      sockaddr_storage peer;
+      int connfd = accept_connection(peer);
+      if (connfd == -1) {
+        break;
+      }
+      // turn away clients over the rate limit before they take up a worker
+      if (_rate_limiter && !_rate_limiter->allow(client_key(peer))) {
+        send(connfd, _too_many_requests.data(), _too_many_requests.size(),
+             MSG_DONTWAIT | MSG_NOSIGNAL);
+        close(connfd);
+        continue;
+      }
+      pool.enqueue(
+          [connfd, peer, accepted = std::chrono::steady_clock::now(), this]() {
+            handle_connections(connfd, peer, accepted);
+          });
+    }
   }
   // clean up when SIGINT is called and _run becomes 0,
   // breaking the while loop
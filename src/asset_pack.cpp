@@ -0,0 +1,100 @@
+#include "asset_pack.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+AssetPack::AssetPack(const std::string &path) {
+  _fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (_fd == -1) {
+    throw std::runtime_error("unable to open asset pack: " + path + ": " +
+                             std::strerror(errno));
+  }
+  struct stat st;
+  if (fstat(_fd, &st) == -1 ||
+      static_cast<std::size_t>(st.st_size) < sizeof(AssetPackHeader)) {
+    close(_fd);
+    throw std::runtime_error("not an asset pack: " + path);
+  }
+  _length = st.st_size;
+  void *base = mmap(nullptr, _length, PROT_READ, MAP_SHARED, _fd, 0);
+  if (base == MAP_FAILED) {
+    close(_fd);
+    throw std::runtime_error("unable to mmap asset pack: " + path + ": " +
+                             std::strerror(errno));
+  }
+  _base = static_cast<const char *>(base);
+
+  // Validate everything up front so that `find` never has to
+  auto fail = [&](const std::string &reason) {
+    munmap(const_cast<char *>(_base), _length);
+    close(_fd);
+    throw std::runtime_error("invalid asset pack: " + path + ": " + reason);
+  };
+  const auto *header = reinterpret_cast<const AssetPackHeader *>(_base);
+  if (std::memcmp(header->magic, ASSET_PACK_MAGIC, sizeof(ASSET_PACK_MAGIC)) !=
+      0) {
+    fail("bad magic");
+  }
+  if (header->version != ASSET_PACK_VERSION) {
+    fail("unsupported version " + std::to_string(header->version));
+  }
+  _entry_count = header->entry_count;
+  if (_entry_count > (_length - sizeof(AssetPackHeader)) /
+                         sizeof(AssetPackEntry)) {
+    fail("truncated index");
+  }
+  _entries =
+      reinterpret_cast<const AssetPackEntry *>(_base + sizeof(AssetPackHeader));
+  auto in_bounds = [this](const AssetPackRange &r) {
+    return r.offset <= _length && r.length <= _length - r.offset;
+  };
+  for (std::size_t i = 0; i < _entry_count; ++i) {
+    const AssetPackEntry &e = _entries[i];
+    if (!in_bounds(e.path) || !in_bounds(e.mime_type) || !in_bounds(e.etag) ||
+        !in_bounds(e.data) || !in_bounds(e.gzip) || !in_bounds(e.brotli)) {
+      fail("entry out of bounds");
+    }
+    if (i > 0 && _entries[i - 1].path_hash > e.path_hash) {
+      fail("index is not sorted");
+    }
+  }
+}
+
+AssetPack::~AssetPack() {
+  munmap(const_cast<char *>(_base), _length);
+  close(_fd);
+}
+
+std::string_view AssetPack::view(const AssetPackRange &range) const {
+  return {_base + range.offset, range.length};
+}
+
+std::optional<EmbeddedAsset> AssetPack::find(std::string_view path) const {
+  std::uint64_t hash = asset_pack_hash(path);
+  const AssetPackEntry *end = _entries + _entry_count;
+  const AssetPackEntry *it = std::lower_bound(
+      _entries, end, hash, [](const AssetPackEntry &e, std::uint64_t h) {
+        return e.path_hash < h;
+      });
+  // different paths may share a hash, so compare the paths as well
+  for (; it != end && it->path_hash == hash; ++it) {
+    if (view(it->path) == path) {
+      return EmbeddedAsset{view(it->path), view(it->data),
+                           view(it->gzip), view(it->brotli),
+                           view(it->etag), view(it->mime_type)};
+    }
+  }
+  return std::nullopt;
+}
+
+std::size_t AssetPack::size() const { return _entry_count; }
+
+int AssetPack::fd() const { return _fd; }
+
+off_t AssetPack::offset_of(std::string_view view) const {
+  return view.data() - _base;
+}
@@ -0,0 +1,220 @@
+#include "disconnect_monitor.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/* The key of the eventfd, which no connection can have */
+static constexpr std::uint64_t WAKE = UINT64_MAX;
+
+/* How long, and how much, a client that keeps sending is drained for */
+static constexpr auto DRAIN_TIME = std::chrono::seconds(2);
+static constexpr std::size_t DRAIN_BYTES = 16 * 1024 * 1024;
+
+DisconnectMonitor::DisconnectMonitor() {
+  _epollfd = epoll_create1(EPOLL_CLOEXEC);
+  _wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  epoll_event wake{};
+  wake.events = EPOLLIN;
+  wake.data.u64 = WAKE;
+  if (_epollfd == -1 || _wakefd == -1 ||
+      epoll_ctl(_epollfd, EPOLL_CTL_ADD, _wakefd, &wake) == -1) {
+    std::string error = std::strerror(errno);
+    if (_epollfd != -1) {
+      close(_epollfd);
+    }
+    if (_wakefd != -1) {
+      close(_wakefd);
+    }
+    throw std::runtime_error("unable to watch for disconnects: " + error);
+  }
+  _thread = std::thread([this] { monitor(); });
+}
+
+DisconnectMonitor::~DisconnectMonitor() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  std::uint64_t one = 1;
+  [[maybe_unused]] ssize_t written = write(_wakefd, &one, sizeof(one));
+  _thread.join();
+  for (const auto &[connfd, draining] : _draining) {
+    close(connfd);
+  }
+  close(_wakefd);
+  close(_epollfd);
+}
+
+std::shared_ptr<std::atomic<bool>> DisconnectMonitor::watch(int connfd) {
+  auto cancelled = std::make_shared<std::atomic<bool>>(false);
+  std::uint32_t generation;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    generation = ++_generation;
+    _watched.insert_or_assign(connfd, Watched{generation, cancelled});
+  }
+  // one shot, since a hangup stays readable and would wake the thread up
+  // over and over otherwise
+  epoll_event event{};
+  event.events = EPOLLRDHUP | EPOLLONESHOT;
+  event.data.u64 = static_cast<std::uint64_t>(generation) << 32 |
+                   static_cast<std::uint32_t>(connfd);
+  if (epoll_ctl(_epollfd, EPOLL_CTL_ADD, connfd, &event) == -1) {
+    unwatch(connfd, cancelled);
+    return nullptr;
+  }
+  return cancelled;
+}
+
+void DisconnectMonitor::unwatch(
+    int connfd, const std::shared_ptr<std::atomic<bool>> &cancelled) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto watched = _watched.find(connfd);
+  if (watched != _watched.end() && watched->second.cancelled == cancelled) {
+    _watched.erase(watched);
+  }
+}
+
+void DisconnectMonitor::drain(int connfd) {
+  shutdown(connfd, SHUT_WR);
+  fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+  std::uint32_t generation;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    generation = ++_generation;
+    _draining.insert_or_assign(
+        connfd, Draining{generation, DRAIN_BYTES,
+                         std::chrono::steady_clock::now() + DRAIN_TIME});
+  }
+  // level triggered, so whatever isn't read in one go wakes the thread up
+  // again
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.u64 = static_cast<std::uint64_t>(generation) << 32 |
+                   static_cast<std::uint32_t>(connfd);
+  if (epoll_ctl(_epollfd, EPOLL_CTL_ADD, connfd, &event) == -1) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _draining.erase(connfd);
+    close(connfd);
+    return;
+  }
+  // the thread may be asleep without a deadline to wake up for
+  std::uint64_t one = 1;
+  [[maybe_unused]] ssize_t written = write(_wakefd, &one, sizeof(one));
+}
+
+bool DisconnectMonitor::discard(int connfd, Draining &draining) {
+  char buf[16 * 1024];
+  while (draining.bytes_left > 0) {
+    ssize_t n = recv(connfd, buf, sizeof(buf), 0);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return false;
+    }
+    if (n <= 0) {
+      return true;
+    }
+    draining.bytes_left -= std::min<std::size_t>(n, draining.bytes_left);
+  }
+  return true;
+}
+
+void DisconnectMonitor::monitor() {
+  epoll_event events[64];
+  while (true) {
+    int timeout = -1;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!_draining.empty()) {
+        auto next = std::chrono::steady_clock::time_point::max();
+        for (const auto &[connfd, draining] : _draining) {
+          next = std::min(next, draining.deadline);
+        }
+        auto wait = std::chrono::ceil<std::chrono::milliseconds>(
+            next - std::chrono::steady_clock::now());
+        timeout = std::max<int>(0, wait.count());
+      }
+    }
+    int n = epoll_wait(_epollfd, events, 64, timeout);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (int i = 0; i < n; ++i) {
+      if (events[i].data.u64 == WAKE) {
+        std::uint64_t count;
+        [[maybe_unused]] ssize_t got = read(_wakefd, &count, sizeof(count));
+        if (_stop) {
+          return;
+        }
+        continue;
+      }
+      int connfd = static_cast<int>(events[i].data.u64 & UINT32_MAX);
+      std::uint32_t generation = events[i].data.u64 >> 32;
+      if (auto draining = _draining.find(connfd);
+          draining != _draining.end()) {
+        if (draining->second.generation == generation &&
+            discard(connfd, draining->second)) {
+          close(connfd);
+          _draining.erase(draining);
+        }
+        continue;
+      }
+      auto watched = _watched.find(connfd);
+      // the request may have finished, and the descriptor been reused by
+      // another one, since the event was queued
+      if (watched != _watched.end() &&
+          watched->second.generation == generation) {
+        watched->second.cancelled->store(true, std::memory_order_relaxed);
+        _watched.erase(watched);
+      }
+    }
+    // give up on clients which are still sending after all this time
+    auto now = std::chrono::steady_clock::now();
+    std::erase_if(_draining, [now](const auto &entry) {
+      if (entry.second.deadline > now) {
+        return false;
+      }
+      close(entry.first);
+      return true;
+    });
+  }
+}
+
+#else
+
+DisconnectMonitor::DisconnectMonitor() {}
+
+DisconnectMonitor::~DisconnectMonitor() {}
+
+std::shared_ptr<std::atomic<bool>> DisconnectMonitor::watch(int) {
+  return nullptr;
+}
+
+void DisconnectMonitor::unwatch(int,
+                                const std::shared_ptr<std::atomic<bool>> &) {}
+
+void DisconnectMonitor::drain(int connfd) {
+  shutdown(connfd, SHUT_WR);
+  close(connfd);
+}
+
+bool DisconnectMonitor::discard(int, Draining &) { return true; }
+
+void DisconnectMonitor::monitor() {}
+
+#endif
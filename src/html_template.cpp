@@ -0,0 +1,194 @@
+#include "html_template.hpp"
+#include "strutil.hpp"
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+
+void html_escape(std::string &out, std::string_view s) {
+  // copy everything up to the next special character in one go
+  for (std::size_t i; (i = strutil::find_html_special(s)) != s.npos;) {
+    out.append(s.substr(0, i));
+    switch (s[i]) {
+    case '&':
+      out.append("&amp;");
+      break;
+    case '<':
+      out.append("&lt;");
+      break;
+    case '>':
+      out.append("&gt;");
+      break;
+    case '"':
+      out.append("&quot;");
+      break;
+    default:
+      out.append("&#39;");
+    }
+    s.remove_prefix(i + 1);
+  }
+  out.append(s);
+}
+
+std::size_t RenderedTemplate::size() const {
+  std::size_t size = 0;
+  for (const Segment &segment : segments) {
+    size += segment.length;
+  }
+  return size;
+}
+
+static bool is_slot_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.';
+}
+
+HtmlTemplate::HtmlTemplate(std::string source) {
+  auto compiled = std::make_shared<Compiled>();
+  compiled->source = std::make_shared<const std::string>(std::move(source));
+  std::string_view src = *compiled->source;
+
+  auto add_static = [&](std::size_t from, std::size_t to) {
+    if (to > from) {
+      compiled->ops.push_back({OpKind::Static, 0,
+                               static_cast<std::uint32_t>(from),
+                               static_cast<std::uint32_t>(to - from)});
+      compiled->static_size += to - from;
+    }
+  };
+
+  std::size_t pos = 0;
+  for (std::size_t open; (open = src.find("{{", pos)) != src.npos;) {
+    add_static(pos, open);
+    bool raw = src.substr(open).starts_with("{{{");
+    std::string_view close_tag = raw ? "}}}" : "}}";
+    std::size_t name_start = open + (raw ? 3 : 2);
+    std::size_t close = src.find(close_tag, name_start);
+    if (close == src.npos) {
+      throw std::invalid_argument("unterminated template slot at offset " +
+                                  std::to_string(open));
+    }
+    std::string_view name =
+        strutil::trim_view(src.substr(name_start, close - name_start));
+    if (name.empty() || !std::all_of(name.begin(), name.end(), is_slot_char)) {
+      throw std::invalid_argument("invalid template slot name \"" +
+                                  std::string(name) + "\" at offset " +
+                                  std::to_string(open));
+    }
+    auto existing = std::find(compiled->slots.begin(), compiled->slots.end(),
+                              name);
+    std::uint32_t slot = existing - compiled->slots.begin();
+    if (existing == compiled->slots.end()) {
+      compiled->slots.emplace_back(name);
+    }
+    compiled->ops.push_back({raw ? OpKind::Raw : OpKind::Escaped, slot, 0, 0});
+    pos = close + close_tag.size();
+  }
+  add_static(pos, src.size());
+  _compiled = std::move(compiled);
+}
+
+HtmlTemplate HtmlTemplate::from_file(const std::string &path) {
+  return HtmlTemplate(strutil::slurp(path));
+}
+
+HtmlTemplate::Args HtmlTemplate::args() const { return Args(_compiled); }
+
+std::size_t HtmlTemplate::slot(std::string_view name) const {
+  return find_slot(*_compiled, name);
+}
+
+std::size_t HtmlTemplate::find_slot(const Compiled &compiled,
+                                    std::string_view name) {
+  const auto &slots = compiled.slots;
+  auto it = std::find(slots.begin(), slots.end(), name);
+  if (it == slots.end()) {
+    throw std::invalid_argument("template has no slot named \"" +
+                                std::string(name) + "\"");
+  }
+  return it - slots.begin();
+}
+
+const std::vector<std::string> &HtmlTemplate::slots() const {
+  return _compiled->slots;
+}
+
+/**
+ * Append `value` to `out`, escaping strings unless `raw` is set. Numbers
+ * never need escaping.
+ */
+static void append_value(std::string &out, const HtmlTemplate::Value &value,
+                         bool raw) {
+  if (const auto *s = std::get_if<std::string_view>(&value)) {
+    if (raw) {
+      out.append(*s);
+    } else {
+      html_escape(out, *s);
+    }
+  } else if (const auto *n = std::get_if<std::int64_t>(&value)) {
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), *n);
+    out.append(buf, end);
+  } else if (const auto *d = std::get_if<double>(&value)) {
+    if (std::isfinite(*d)) {
+      char buf[32];
+      auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), *d);
+      out.append(buf, end);
+    }
+  }
+}
+
+void HtmlTemplate::render(std::string &out, const Args &args) const {
+  const std::string &source = *_compiled->source;
+  out.reserve(out.size() + _compiled->static_size);
+  for (const Op &op : _compiled->ops) {
+    if (op.kind == OpKind::Static) {
+      out.append(source, op.offset, op.length);
+    } else {
+      append_value(out, args[op.slot], op.kind == OpKind::Raw);
+    }
+  }
+}
+
+void HtmlTemplate::render(RenderedTemplate &out, const Args &args) const {
+  out.source = _compiled->source;
+  out.segments.reserve(out.segments.size() + _compiled->ops.size());
+  const char *source = _compiled->source->data();
+  for (const Op &op : _compiled->ops) {
+    if (op.kind == OpKind::Static) {
+      out.segments.push_back({source + op.offset, 0, op.length});
+      continue;
+    }
+    std::size_t offset = out.dynamic.size();
+    append_value(out.dynamic, args[op.slot], op.kind == OpKind::Raw);
+    std::size_t length = out.dynamic.size() - offset;
+    if (length == 0) {
+      continue;
+    }
+    // neighbouring slots share a segment
+    if (!out.segments.empty() && out.segments.back().data == nullptr) {
+      out.segments.back().length += length;
+    } else {
+      out.segments.push_back({nullptr, offset, length});
+    }
+  }
+}
+
+HtmlTemplate::Args::Args(std::shared_ptr<const Compiled> compiled)
+    : _compiled(std::move(compiled)), _values(_compiled->slots.size()) {}
+
+HtmlTemplate::Args &HtmlTemplate::Args::set(std::string_view name,
+                                            std::string_view value) {
+  _values[find_slot(*_compiled, name)] = value;
+  return *this;
+}
+
+HtmlTemplate::Args &HtmlTemplate::Args::set(std::string_view name,
+                                            const char *value) {
+  return set(name, std::string_view(value));
+}
+
+HtmlTemplate::Args &HtmlTemplate::Args::set(std::string_view name,
+                                            double value) {
+  _values[find_slot(*_compiled, name)] = value;
+  return *this;
+}
@@ -0,0 +1,259 @@
+#include "ip_filter.hpp"
+#include "strutil.hpp"
+#include <arpa/inet.h>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <netinet/in.h>
+#include <stdexcept>
+
+namespace {
+
+bool bit_at(std::uint64_t hi, std::uint64_t lo, unsigned i) {
+  return i < 64 ? (hi >> (63 - i)) & 1 : (lo >> (127 - i)) & 1;
+}
+
+/* The first `length` bits of a key, with the rest cleared */
+void mask(std::uint64_t &hi, std::uint64_t &lo, unsigned length) {
+  if (length < 64) {
+    hi = length == 0 ? 0 : hi & (~0ULL << (64 - length));
+    lo = 0;
+  } else if (length < 128) {
+    lo = length == 64 ? 0 : lo & (~0ULL << (128 - length));
+  }
+}
+
+/* The number of leading bits two keys share, up to `limit` */
+unsigned common_length(std::uint64_t a_hi, std::uint64_t a_lo,
+                       std::uint64_t b_hi, std::uint64_t b_lo, unsigned limit) {
+  unsigned common;
+  if (std::uint64_t diff = a_hi ^ b_hi) {
+    common = std::countl_zero(diff);
+  } else if (std::uint64_t diff = a_lo ^ b_lo) {
+    common = 64 + std::countl_zero(diff);
+  } else {
+    common = 128;
+  }
+  return std::min(common, limit);
+}
+
+/* IPv4 addresses are mapped into ::ffff:0:0/96 */
+constexpr std::uint64_t V4_MAPPED = 0xffffULL << 32;
+
+std::uint64_t load_be64(const unsigned char *p) {
+  std::uint64_t v = 0;
+  for (int i = 0; i < 8; ++i) {
+    v = v << 8 | p[i];
+  }
+  return v;
+}
+
+} // namespace
+
+void IpFilter::add(std::string_view cidr, Action action) {
+  std::string_view address = cidr;
+  std::size_t slash = cidr.find('/');
+  if (slash != cidr.npos) {
+    address = cidr.substr(0, slash);
+  }
+  std::string text(address);
+  std::uint64_t hi, lo;
+  unsigned max_length, offset;
+  in_addr v4;
+  in6_addr v6;
+  if (inet_pton(AF_INET, text.c_str(), &v4) == 1) {
+    hi = 0;
+    lo = V4_MAPPED | ntohl(v4.s_addr);
+    max_length = 32;
+    offset = 96;
+  } else if (inet_pton(AF_INET6, text.c_str(), &v6) == 1) {
+    hi = load_be64(v6.s6_addr);
+    lo = load_be64(v6.s6_addr + 8);
+    max_length = 128;
+    offset = 0;
+  } else {
+    throw std::invalid_argument("invalid IP address: " + text);
+  }
+  unsigned length = max_length;
+  if (slash != cidr.npos) {
+    std::string_view bits = cidr.substr(slash + 1);
+    auto [end, ec] =
+        std::from_chars(bits.data(), bits.data() + bits.size(), length);
+    if (ec != std::errc() || end != bits.data() + bits.size() ||
+        bits.empty() || length > max_length) {
+      throw std::invalid_argument("invalid prefix length: " +
+                                  std::string(cidr));
+    }
+  }
+  insert({hi, lo}, length + offset, action);
+  _v4_index.clear();
+}
+
+void IpFilter::set_default(Action action) { _default = action; }
+
+void IpFilter::insert(Key prefix, unsigned length, Action action) {
+  mask(prefix.hi, prefix.lo, length);
+  auto new_node = [&](Key key, unsigned len, Action act) {
+    _nodes.push_back({key, {NONE, NONE}, static_cast<std::uint8_t>(len), act});
+    return static_cast<std::uint32_t>(_nodes.size() - 1);
+  };
+  // `_nodes` may grow below, so hold on to where the link is, not a pointer
+  std::uint32_t parent = NONE;
+  int side = 0;
+  auto link = [&]() -> std::uint32_t & {
+    return parent == NONE ? _root : _nodes[parent].child[side];
+  };
+
+  while (true) {
+    std::uint32_t current = link();
+    if (current == NONE) {
+      std::uint32_t leaf = new_node(prefix, length, action);
+      link() = leaf;
+      ++_rules;
+      return;
+    }
+    Node node = _nodes[current];
+    unsigned common = common_length(prefix.hi, prefix.lo, node.prefix.hi,
+                                    node.prefix.lo,
+                                    std::min<unsigned>(length, node.length));
+    if (common == node.length && common == length) {
+      if (node.action == Action::None) {
+        ++_rules;
+      }
+      _nodes[current].action = action;
+      return;
+    }
+    if (common == node.length) {
+      // the new network is inside this one, so keep going down
+      parent = current;
+      side = bit_at(prefix.hi, prefix.lo, node.length);
+      continue;
+    }
+    ++_rules;
+    if (common == length) {
+      // the new network covers this one, so it goes in between
+      std::uint32_t covering = new_node(prefix, length, action);
+      _nodes[covering].child[bit_at(node.prefix.hi, node.prefix.lo, length)] =
+          current;
+      link() = covering;
+      return;
+    }
+    // the networks diverge partway through this node, so split it
+    Key branch_key = prefix;
+    mask(branch_key.hi, branch_key.lo, common);
+    std::uint32_t leaf = new_node(prefix, length, action);
+    std::uint32_t branch = new_node(branch_key, common, Action::None);
+    _nodes[branch].child[bit_at(node.prefix.hi, node.prefix.lo, common)] =
+        current;
+    _nodes[branch].child[bit_at(prefix.hi, prefix.lo, common)] = leaf;
+    link() = branch;
+    return;
+  }
+}
+
+IpFilter::Action IpFilter::walk(Key key, std::uint32_t current,
+                                Action best) const {
+  while (current != NONE) {
+    const Node &node = _nodes[current];
+    if (common_length(key.hi, key.lo, node.prefix.hi, node.prefix.lo,
+                      node.length) != node.length) {
+      break;
+    }
+    if (node.action != Action::None) {
+      best = node.action;
+    }
+    if (node.length == 128) {
+      break;
+    }
+    current = node.child[bit_at(key.hi, key.lo, node.length)];
+  }
+  return best;
+}
+
+void IpFilter::build_index() {
+  _v4_index.assign(1 << 16, {NONE, Action::None});
+  for (std::uint32_t top = 0; top < (1 << 16); ++top) {
+    Key key{0, V4_MAPPED | top << 16};
+    // the same walk as `walk`, but stopping before the nodes which cover
+    // a /16 or less, since those look at the bottom 16 bits of the address
+    IndexEntry &entry = _v4_index[top];
+    std::uint32_t current = _root;
+    while (current != NONE) {
+      const Node &node = _nodes[current];
+      if (node.length >= 112) {
+        break;
+      }
+      if (common_length(key.hi, key.lo, node.prefix.hi, node.prefix.lo,
+                        node.length) != node.length) {
+        current = NONE;
+        break;
+      }
+      if (node.action != Action::None) {
+        entry.action = node.action;
+      }
+      current = node.child[bit_at(key.hi, key.lo, node.length)];
+    }
+    entry.node = current;
+  }
+}
+
+bool IpFilter::allowed(const sockaddr_storage &address) const {
+  if (_root == NONE) {
+    return _default != Action::Deny;
+  }
+  Key key;
+  if (address.ss_family == AF_INET6) {
+    const auto &in6 = reinterpret_cast<const sockaddr_in6 &>(address);
+    key = {load_be64(in6.sin6_addr.s6_addr),
+           load_be64(in6.sin6_addr.s6_addr + 8)};
+  } else {
+    const auto &in = reinterpret_cast<const sockaddr_in &>(address);
+    std::uint32_t v4 = ntohl(in.sin_addr.s_addr);
+    key = {0, V4_MAPPED | v4};
+    if (!_v4_index.empty()) {
+      const IndexEntry &entry = _v4_index[v4 >> 16];
+      Action best = entry.action == Action::None ? _default : entry.action;
+      return walk(key, entry.node, best) != Action::Deny;
+    }
+  }
+  return walk(key, _root, _default) != Action::Deny;
+}
+
+std::size_t IpFilter::size() const { return _rules; }
+
+IpFilter IpFilter::from_file(const std::string &path) {
+  IpFilter filter;
+  // the lines are parsed in place, so there is no need to copy the file
+  strutil::mapped_file file(path);
+  std::string_view contents = file.view();
+  std::size_t line_number = 0;
+  for (std::string_view line : strutil::split_view(contents, "\n")) {
+    ++line_number;
+    if (std::size_t comment = line.find('#'); comment != line.npos) {
+      line = line.substr(0, comment);
+    }
+    line = strutil::trim_view(line);
+    if (line.empty()) {
+      continue;
+    }
+    std::string_view word = line.substr(0, line.find_first_of(" \t"));
+    std::string_view rest = strutil::trim_view(line.substr(word.size()));
+    try {
+      if (word == "allow" || word == "deny") {
+        filter.add(rest, word == "allow" ? Action::Allow : Action::Deny);
+      } else if (word == "default" && (rest == "allow" || rest == "deny")) {
+        filter.set_default(rest == "allow" ? Action::Allow : Action::Deny);
+      } else if (rest.empty()) {
+        filter.add(word, Action::Deny);
+      } else {
+        throw std::invalid_argument("expected \"allow <cidr>\", \"deny "
+                                    "<cidr>\" or \"default allow|deny\"");
+      }
+    } catch (const std::invalid_argument &e) {
+      throw std::invalid_argument(path + ":" + std::to_string(line_number) +
+                                  ": " + e.what());
+    }
+  }
+  filter.build_index();
+  return filter;
+}
@@ -0,0 +1,657 @@
+#include "json.hpp"
+#include "strutil.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace json {
+
+void write_string(std::string &out, std::string_view s) {
+  static constexpr char hex[] = "0123456789abcdef";
+  out.push_back('"');
+  // copy everything up to the next byte which needs escaping in one go
+  for (std::size_t i; (i = strutil::find_json_escape(s)) != s.npos;) {
+    out.append(s.substr(0, i));
+    char c = s[i];
+    switch (c) {
+    case '"':
+      out.append("\\\"");
+      break;
+    case '\\':
+      out.append("\\\\");
+      break;
+    case '\n':
+      out.append("\\n");
+      break;
+    case '\r':
+      out.append("\\r");
+      break;
+    case '\t':
+      out.append("\\t");
+      break;
+    case '\b':
+      out.append("\\b");
+      break;
+    case '\f':
+      out.append("\\f");
+      break;
+    default:
+      char escaped[] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xf], hex[c & 0xf]};
+      out.append(escaped, sizeof(escaped));
+    }
+    s.remove_prefix(i + 1);
+  }
+  out.append(s);
+  out.push_back('"');
+}
+
+writer::writer(std::string &out) : _out(out), _flush_threshold(0) {}
+
+writer::writer(std::string &out, std::function<void()> flush,
+               std::size_t flush_threshold)
+    : _out(out), _flush(std::move(flush)), _flush_threshold(flush_threshold) {}
+
+void writer::separator() {
+  if (_after_key) {
+    _after_key = false;
+    return;
+  }
+  std::uint64_t bit = std::uint64_t(1) << _depth;
+  if (_has_items & bit) {
+    _out.push_back(',');
+  }
+  _has_items |= bit;
+}
+
+void writer::open(char c) {
+  // checked first so that the output is left as it was
+  if (_depth == 63) {
+    throw std::length_error("json::writer: nesting is too deep");
+  }
+  separator();
+  _out.push_back(c);
+  ++_depth;
+  _has_items &= ~(std::uint64_t(1) << _depth);
+}
+
+void writer::close(char c) {
+  --_depth;
+  _out.push_back(c);
+  maybe_flush();
+}
+
+void writer::maybe_flush() {
+  if (_flush && _out.size() >= _flush_threshold) {
+    _flush();
+  }
+}
+
+writer &writer::begin_object() {
+  open('{');
+  return *this;
+}
+
+writer &writer::end_object() {
+  close('}');
+  return *this;
+}
+
+writer &writer::begin_array() {
+  open('[');
+  return *this;
+}
+
+writer &writer::end_array() {
+  close(']');
+  return *this;
+}
+
+writer &writer::key(std::string_view key) {
+  separator();
+  write_string(_out, key);
+  _out.push_back(':');
+  _after_key = true;
+  return *this;
+}
+
+writer &writer::value(std::string_view s) {
+  separator();
+  write_string(_out, s);
+  maybe_flush();
+  return *this;
+}
+
+writer &writer::value(const char *s) { return value(std::string_view(s)); }
+
+writer &writer::value(bool b) {
+  separator();
+  _out.append(b ? "true" : "false");
+  maybe_flush();
+  return *this;
+}
+
+writer &writer::value(std::nullptr_t) {
+  separator();
+  _out.append("null");
+  maybe_flush();
+  return *this;
+}
+
+writer &writer::value(double d) {
+  if (!std::isfinite(d)) {
+    return value(nullptr);
+  }
+  separator();
+  char buf[32];
+  auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), d);
+  _out.append(buf, end - buf);
+  maybe_flush();
+  return *this;
+}
+
+writer &writer::raw(std::string_view json) {
+  separator();
+  _out.append(json);
+  maybe_flush();
+  return *this;
+}
+
+/* Reading */
+
+namespace {
+
+/*
+ * The scans below return the first quote/backslash (or structural character)
+ * at or after `p`, or `end` if there is none. The SIMD versions read whole
+ * blocks past `end`, which the padding after every document makes safe.
+ */
+
+#ifndef STRUTIL_X86_SIMD
+const char *find_quote_scalar(const char *p, const char *end) {
+  while (p < end && *p != '"' && *p != '\\') {
+    ++p;
+  }
+  return p;
+}
+
+bool is_structural(char c) {
+  return c == '"' || c == '[' || c == ']' || c == '{' || c == '}';
+}
+
+const char *find_structural_scalar(const char *p, const char *end) {
+  while (p < end && !is_structural(*p)) {
+    ++p;
+  }
+  return p;
+}
+#else
+__attribute__((target("sse2"))) const char *find_quote_sse2(const char *p,
+                                                            const char *end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  for (; p < end; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i hit =
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+    if (unsigned mask = _mm_movemask_epi8(hit)) {
+      return std::min(p + __builtin_ctz(mask), end);
+    }
+  }
+  return end;
+}
+
+__attribute__((target("avx2"))) const char *find_quote_avx2(const char *p,
+                                                            const char *end) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  for (; p < end; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                  _mm256_cmpeq_epi8(v, backslash));
+    if (unsigned mask = _mm256_movemask_epi8(hit)) {
+      return std::min(p + __builtin_ctz(mask), end);
+    }
+  }
+  return end;
+}
+
+__attribute__((target("sse2"))) const char *
+find_structural_sse2(const char *p, const char *end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  // '[' and '{' (and ']' and '}') only differ in bit 5
+  const __m128i bit5 = _mm_set1_epi8(0x20);
+  const __m128i open = _mm_set1_epi8('{');
+  const __m128i close = _mm_set1_epi8('}');
+  for (; p < end; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i folded = _mm_or_si128(v, bit5);
+    __m128i hit = _mm_or_si128(
+        _mm_cmpeq_epi8(v, quote),
+        _mm_or_si128(_mm_cmpeq_epi8(folded, open),
+                     _mm_cmpeq_epi8(folded, close)));
+    if (unsigned mask = _mm_movemask_epi8(hit)) {
+      return std::min(p + __builtin_ctz(mask), end);
+    }
+  }
+  return end;
+}
+
+__attribute__((target("avx2"))) const char *
+find_structural_avx2(const char *p, const char *end) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i bit5 = _mm256_set1_epi8(0x20);
+  const __m256i open = _mm256_set1_epi8('{');
+  const __m256i close = _mm256_set1_epi8('}');
+  for (; p < end; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i folded = _mm256_or_si256(v, bit5);
+    __m256i hit = _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, quote),
+        _mm256_or_si256(_mm256_cmpeq_epi8(folded, open),
+                        _mm256_cmpeq_epi8(folded, close)));
+    if (unsigned mask = _mm256_movemask_epi8(hit)) {
+      return std::min(p + __builtin_ctz(mask), end);
+    }
+  }
+  return end;
+}
+#endif // STRUTIL_X86_SIMD
+
+const char *find_quote(const char *p, const char *end) {
+#ifdef STRUTIL_X86_SIMD
+  static const auto impl =
+      strutil::detail::pick(&find_quote_avx2, &find_quote_sse2);
+  return impl(p, end);
+#else
+  return find_quote_scalar(p, end);
+#endif
+}
+
+const char *find_structural(const char *p, const char *end) {
+#ifdef STRUTIL_X86_SIMD
+  static const auto impl =
+      strutil::detail::pick(&find_structural_avx2, &find_structural_sse2);
+  return impl(p, end);
+#else
+  return find_structural_scalar(p, end);
+#endif
+}
+
+int hex_digit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c = strutil::ascii_lower(c);
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+void append_utf8(std::string &out, std::uint32_t cp) {
+  if (cp < 0x80) {
+    out.push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    out.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+  } else if (cp < 0x10000) {
+    out.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+  } else {
+    out.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+  }
+}
+
+} // namespace
+
+document::document(std::string_view json) {
+  _copy.reserve(json.size() + PADDING);
+  _copy.assign(json);
+  _copy.resize(json.size() + PADDING);
+  _begin = _copy.data();
+  _end = _begin + json.size();
+}
+
+document::document(std::string_view json, padded_t)
+    : _begin(json.data()), _end(json.data() + json.size()) {}
+
+value document::root() const {
+  const char *p = skip_ws(_begin);
+  if (p == _end) {
+    fail(p, "empty document");
+  }
+  return {this, p};
+}
+
+void document::fail(const char *p, const char *what) const {
+  throw error(std::string("json: ") + what + " at offset " +
+              std::to_string(p - _begin));
+}
+
+const char *document::skip_ws(const char *p) const {
+  while (p < _end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+    ++p;
+  }
+  return p;
+}
+
+const char *document::expect(const char *p, char c) const {
+  p = skip_ws(p);
+  if (p == _end || *p != c) {
+    fail(p, c == ':' ? "expected ':'" : "unexpected character");
+  }
+  return p + 1;
+}
+
+const char *document::skip_string(const char *p) const {
+  ++p;
+  for (;;) {
+    p = find_quote(p, _end);
+    if (p == _end) {
+      fail(p, "unterminated string");
+    }
+    if (*p == '"') {
+      return p + 1;
+    }
+    // *p is a backslash, which must not be the last byte of the document
+    if (p + 1 >= _end) {
+      fail(p + 1, "unterminated string");
+    }
+    p += 2; // skip the escaped character
+  }
+}
+
+const char *document::scalar_end(const char *p) const {
+  while (p < _end && *p != ',' && *p != ']' && *p != '}' && *p != ':' &&
+         *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t') {
+    ++p;
+  }
+  return p;
+}
+
+const char *document::skip_value(const char *p) const {
+  if (p == _end) {
+    fail(p, "expected a value");
+  }
+  if (*p == '"') {
+    return skip_string(p);
+  }
+  if (*p != '{' && *p != '[') {
+    const char *end = scalar_end(p);
+    if (end == p) {
+      fail(p, "expected a value");
+    }
+    return end;
+  }
+  // only brackets and strings matter when skipping a container, so jump
+  // from one to the next instead of parsing what's in between
+  int depth = 0;
+  for (;;) {
+    p = find_structural(p, _end);
+    if (p == _end) {
+      fail(p, "unterminated container");
+    }
+    if (*p == '"') {
+      p = skip_string(p);
+      continue;
+    }
+    depth += (*p == '{' || *p == '[') ? 1 : -1;
+    ++p;
+    if (depth == 0) {
+      return p;
+    }
+  }
+}
+
+std::string_view document::read_string(const char *p) const {
+  const char *start = p + 1;
+  p = find_quote(start, _end);
+  if (p < _end && *p == '"') {
+    return {start, static_cast<std::size_t>(p - start)};
+  }
+  std::string &out = _strings.emplace_back(start, p);
+  for (;;) {
+    if (p == _end) {
+      fail(p, "unterminated string");
+    }
+    if (*p == '"') {
+      return out;
+    }
+    // *p is a backslash
+    if (++p == _end) {
+      fail(p, "unterminated string");
+    }
+    switch (*p++) {
+    case '"':
+      out.push_back('"');
+      break;
+    case '\\':
+      out.push_back('\\');
+      break;
+    case '/':
+      out.push_back('/');
+      break;
+    case 'b':
+      out.push_back('\b');
+      break;
+    case 'f':
+      out.push_back('\f');
+      break;
+    case 'n':
+      out.push_back('\n');
+      break;
+    case 'r':
+      out.push_back('\r');
+      break;
+    case 't':
+      out.push_back('\t');
+      break;
+    case 'u': {
+      auto read_hex = [&](const char *at) {
+        if (_end - at < 4) {
+          fail(at, "invalid unicode escape");
+        }
+        std::uint32_t cp = 0;
+        for (int i = 0; i < 4; ++i) {
+          int digit = hex_digit(at[i]);
+          if (digit < 0) {
+            fail(at, "invalid unicode escape");
+          }
+          cp = cp << 4 | digit;
+        }
+        return cp;
+      };
+      std::uint32_t cp = read_hex(p);
+      p += 4;
+      // a high surrogate followed by a low one encodes a single code point
+      if (cp >= 0xd800 && cp < 0xdc00 && _end - p >= 6 && p[0] == '\\' &&
+          p[1] == 'u') {
+        std::uint32_t low = read_hex(p + 2);
+        if (low >= 0xdc00 && low < 0xe000) {
+          cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+          p += 6;
+        }
+      }
+      append_utf8(out, cp);
+      break;
+    }
+    default:
+      fail(p - 1, "invalid escape");
+    }
+    const char *next = find_quote(p, _end);
+    out.append(p, next);
+    p = next;
+  }
+}
+
+json::type value::type() const {
+  switch (*_p) {
+  case 'n':
+    return json::type::null;
+  case 't':
+  case 'f':
+    return json::type::boolean;
+  case '"':
+    return json::type::string;
+  case '[':
+    return json::type::array;
+  case '{':
+    return json::type::object;
+  default:
+    if (*_p == '-' || (*_p >= '0' && *_p <= '9')) {
+      return json::type::number;
+    }
+    _doc->fail(_p, "expected a value");
+  }
+}
+
+bool value::is_null() const {
+  return std::string_view(_p, _doc->scalar_end(_p) - _p) == "null";
+}
+
+bool value::get_bool() const {
+  std::string_view token(_p, _doc->scalar_end(_p) - _p);
+  if (token == "true") {
+    return true;
+  }
+  if (token != "false") {
+    _doc->fail(_p, "expected a boolean");
+  }
+  return false;
+}
+
+std::int64_t value::get_int() const {
+  const char *end = _doc->scalar_end(_p);
+  std::int64_t n;
+  auto [ptr, ec] = std::from_chars(_p, end, n);
+  if (ec != std::errc() || ptr != end) {
+    _doc->fail(_p, "expected an integer");
+  }
+  return n;
+}
+
+double value::get_double() const {
+  const char *end = _doc->scalar_end(_p);
+  double d;
+  // from_chars also takes "inf" and "nan", which aren't JSON
+  bool number = *_p == '-' || (*_p >= '0' && *_p <= '9');
+  auto [ptr, ec] = std::from_chars(_p, end, d);
+  if (!number || ec != std::errc() || ptr != end) {
+    _doc->fail(_p, "expected a number");
+  }
+  return d;
+}
+
+std::string_view value::get_string() const {
+  if (*_p != '"') {
+    _doc->fail(_p, "expected a string");
+  }
+  return _doc->read_string(_p);
+}
+
+std::string_view value::raw() const {
+  return {_p, static_cast<std::size_t>(_doc->skip_value(_p) - _p)};
+}
+
+std::optional<value> value::find(std::string_view key) const {
+  for (member m : members()) {
+    if (m.key == key) {
+      return m.value;
+    }
+  }
+  return std::nullopt;
+}
+
+value value::operator[](std::string_view key) const {
+  if (auto member = find(key)) {
+    return *member;
+  }
+  _doc->fail(_p, ("missing member \"" + std::string(key) + "\"").c_str());
+}
+
+value value::operator[](std::size_t index) const {
+  for (value element : elements()) {
+    if (index-- == 0) {
+      return element;
+    }
+  }
+  _doc->fail(_p, "index out of range");
+}
+
+array_range value::elements() const {
+  if (*_p != '[') {
+    _doc->fail(_p, "expected an array");
+  }
+  return {_doc, _p};
+}
+
+object_range value::members() const {
+  if (*_p != '{') {
+    _doc->fail(_p, "expected an object");
+  }
+  return {_doc, _p};
+}
+
+array_range::iterator array_range::begin() const {
+  const char *p = _doc->skip_ws(_p + 1);
+  if (p == _doc->_end) {
+    _doc->fail(p, "unterminated array");
+  }
+  return {_doc, *p == ']' ? nullptr : p};
+}
+
+array_range::iterator &array_range::iterator::operator++() {
+  const char *p = _doc->skip_ws(_doc->skip_value(_p));
+  if (p < _doc->_end && *p == ',') {
+    _p = _doc->skip_ws(p + 1);
+  } else if (p < _doc->_end && *p == ']') {
+    _p = nullptr;
+  } else {
+    _doc->fail(p, "expected ',' or ']'");
+  }
+  return *this;
+}
+
+object_range::iterator object_range::begin() const {
+  const char *p = _doc->skip_ws(_p + 1);
+  if (p < _doc->_end && *p == '}') {
+    return {_doc, nullptr};
+  }
+  if (p == _doc->_end || *p != '"') {
+    _doc->fail(p, "expected a key");
+  }
+  return {_doc, p};
+}
+
+member object_range::iterator::operator*() const {
+  const char *value_start =
+      _doc->skip_ws(_doc->expect(_doc->skip_string(_p), ':'));
+  if (value_start == _doc->_end) {
+    _doc->fail(value_start, "expected a value");
+  }
+  return {_doc->read_string(_p), value(_doc, value_start)};
+}
+
+object_range::iterator &object_range::iterator::operator++() {
+  const char *value_start =
+      _doc->skip_ws(_doc->expect(_doc->skip_string(_p), ':'));
+  const char *p = _doc->skip_ws(_doc->skip_value(value_start));
+  if (p < _doc->_end && *p == ',') {
+    p = _doc->skip_ws(p + 1);
+    if (p == _doc->_end || *p != '"') {
+      _doc->fail(p, "expected a key");
+    }
+    _p = p;
+  } else if (p < _doc->_end && *p == '}') {
+    _p = nullptr;
+  } else {
+    _doc->fail(p, "expected ',' or '}'");
+  }
+  return *this;
+}
+
+} // namespace json
@@ -0,0 +1,128 @@
+#include "rate_limiter.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <netinet/in.h>
+#include <stdexcept>
+
+std::uint64_t client_key(const sockaddr_storage &address) {
+  if (address.ss_family == AF_INET6) {
+    const auto &in6 = reinterpret_cast<const sockaddr_in6 &>(address);
+    std::uint64_t prefix;
+    std::memcpy(&prefix, in6.sin6_addr.s6_addr, sizeof(prefix));
+    return prefix == 0 ? 1 : prefix;
+  }
+  const auto &in = reinterpret_cast<const sockaddr_in &>(address);
+  return 0xffffULL << 32 | ntohl(in.sin_addr.s_addr);
+}
+
+RateLimiter::RateLimiter(double rate, double burst, std::size_t capacity)
+    : _epoch(std::chrono::steady_clock::now()) {
+  if (!(rate > 0)) {
+    throw std::invalid_argument("rate limit must be positive");
+  }
+  if (!(burst >= 1 && burst <= 16000)) {
+    throw std::invalid_argument("rate limit burst must be between 1 and 16000");
+  }
+  _rate = rate;
+  _burst = static_cast<std::uint64_t>(burst * 1000);
+  _refill_ms = static_cast<std::uint64_t>(std::ceil(_burst / _rate));
+  _shard_size = std::bit_ceil(std::max<std::size_t>(capacity / SHARDS, 16));
+  _shard_mask = _shard_size - 1;
+  // every shard spans whole cache lines, so aligning the table aligns them
+  static_assert(CACHE_LINE % sizeof(Slot) == 0);
+  std::size_t count = _shard_size * SHARDS;
+  auto *slots = static_cast<Slot *>(
+      ::operator new(count * sizeof(Slot), std::align_val_t(CACHE_LINE)));
+  std::uninitialized_default_construct_n(slots, count);
+  _slots.reset(slots);
+}
+
+std::uint64_t RateLimiter::now() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - _epoch)
+             .count() +
+         1;
+}
+
+unsigned RateLimiter::retry_after() const {
+  // `_rate` is also the number of tokens per second
+  return std::max(1u, static_cast<unsigned>(std::ceil(1 / _rate)));
+}
+
+bool RateLimiter::take(Slot &slot, std::uint64_t key, std::uint64_t now) {
+  std::uint64_t state = slot.state.load(std::memory_order_acquire);
+  for (;;) {
+    if (state == CLAIMED) {
+      // the slot is changing hands, which only takes a few instructions
+      do {
+        state = slot.state.load(std::memory_order_acquire);
+      } while (state == CLAIMED);
+      // a slot is only taken over once its bucket has filled up again, so
+      // the client it was taken from would have had a token anyway
+      if (slot.key.load(std::memory_order_acquire) != key) {
+        return true;
+      }
+    }
+    std::uint64_t last = state >> TOKEN_BITS;
+    std::uint64_t tokens = state & TOKEN_MASK;
+    if (now > last) {
+      double refilled = tokens + (now - last) * _rate;
+      tokens = std::min(_burst, static_cast<std::uint64_t>(refilled));
+    }
+    if (tokens < 1000) {
+      return false;
+    }
+    if (slot.state.compare_exchange_weak(state,
+                                         pack(std::max(now, last), tokens - 1000),
+                                         std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+}
+
+bool RateLimiter::allow(std::uint64_t key) {
+  // the top bits pick the shard and the bottom bits the slot in it
+  std::uint64_t hash = key * 0x9e3779b97f4a7c15ULL;
+  hash ^= hash >> 29;
+  Slot *shard = &_slots[(hash >> 58) * _shard_size];
+  std::uint64_t now = this->now();
+
+  for (std::size_t probe = 0; probe < MAX_PROBES; ++probe) {
+    Slot &slot = shard[(hash + probe) & _shard_mask];
+    std::uint64_t current = slot.key.load(std::memory_order_acquire);
+    if (current == key) {
+      return take(slot, key, now);
+    }
+    // a bucket which has had time to fill up is as good as a new one
+    std::uint64_t state = slot.state.load(std::memory_order_acquire);
+    std::uint64_t last = state >> TOKEN_BITS;
+    bool expired = state != CLAIMED &&
+                   (current == 0 || (now > last && now - last >= _refill_ms));
+    if (!expired) {
+      continue;
+    }
+    // claim the slot, unless somebody beat us to it. Nobody can take from
+    // it while it's claimed, so the new key and its full bucket appear
+    // together
+    if (!slot.state.compare_exchange_strong(state, CLAIMED,
+                                            std::memory_order_acq_rel)) {
+      // whoever beat us may be claiming it for the same client, which only
+      // shows once their key is in
+      while (state == CLAIMED) {
+        state = slot.state.load(std::memory_order_acquire);
+      }
+      if (slot.key.load(std::memory_order_acquire) == key) {
+        return take(slot, key, now);
+      }
+      continue;
+    }
+    slot.key.store(key, std::memory_order_relaxed);
+    slot.state.store(pack(now, _burst - 1000), std::memory_order_release);
+    return true;
+  }
+  // every slot we could use belongs to an active client
+  return true;
+}
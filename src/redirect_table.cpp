@@ -0,0 +1,262 @@
+#include "redirect_table.hpp"
+#include "strutil.hpp"
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <stdexcept>
+
+/* Everything after the location, the same for every redirect */
+static constexpr std::string_view TAIL = "\r\nContent-Length: 0\r\n\r\n";
+
+static std::string_view status_message(int status_code) {
+  switch (status_code) {
+  case 301:
+    return "Moved Permanently";
+  case 302:
+    return "Found";
+  case 307:
+    return "Temporary Redirect";
+  case 308:
+    return "Permanent Redirect";
+  default:
+    throw std::invalid_argument("invalid redirect status code: " +
+                                std::to_string(status_code));
+  }
+}
+
+static bool has_whitespace_or_ctl(std::string_view s) {
+  return strutil::has_control_chars(s) || s.find(' ') != s.npos;
+}
+
+RedirectTable::Range RedirectTable::store(std::string_view s) {
+  if (_arena.size() + s.size() > UINT32_MAX) {
+    throw std::length_error("redirect table is too large");
+  }
+  Range range{static_cast<std::uint32_t>(_arena.size()),
+              static_cast<std::uint32_t>(s.size())};
+  _arena.append(s);
+  return range;
+}
+
+std::string_view RedirectTable::view(Range range) const {
+  return std::string_view(_arena).substr(range.offset, range.length);
+}
+
+void RedirectTable::add(std::string_view from, std::string_view to,
+                        int status_code) {
+  if (!from.starts_with('/') || has_whitespace_or_ctl(from)) {
+    throw std::invalid_argument("invalid route to redirect: " +
+                                std::string(from));
+  }
+  if (to.empty() || has_whitespace_or_ctl(to)) {
+    throw std::invalid_argument("invalid redirect location: " +
+                                std::string(to));
+  }
+  bool prefix = from.ends_with('*');
+  bool keep_suffix = to.ends_with('*');
+  if (keep_suffix && !prefix) {
+    throw std::invalid_argument("a location ending in '*' needs a route "
+                                "ending in '*': " +
+                                std::string(from));
+  }
+  std::string head = "HTTP/1.1 " + std::to_string(status_code) + " " +
+                     std::string(status_message(status_code)) +
+                     "\r\nLocation: ";
+  if (prefix) {
+    head.append(keep_suffix ? to.substr(0, to.size() - 1) : to);
+    add_prefix(from.substr(0, from.size() - 1), {store(head), keep_suffix});
+  } else {
+    head.append(to);
+    head.append(TAIL);
+    add_exact(from, head);
+  }
+}
+
+void RedirectTable::grow() {
+  std::vector<std::uint32_t> slots(std::max<std::size_t>(16, _slots.size() * 2));
+  std::size_t mask = slots.size() - 1;
+  for (std::uint32_t i = 0; i < _exact.size(); ++i) {
+    std::size_t slot = _exact[i].hash & mask;
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = i + 1;
+  }
+  _slots = std::move(slots);
+}
+
+void RedirectTable::add_exact(std::string_view from,
+                              std::string_view response) {
+  // kept at most half full so that probes stay short
+  if ((_exact.size() + 1) * 2 > _slots.size()) {
+    grow();
+  }
+  std::uint64_t hash = std::hash<std::string_view>{}(from);
+  std::size_t mask = _slots.size() - 1;
+  std::size_t slot = hash & mask;
+  for (; _slots[slot] != 0; slot = (slot + 1) & mask) {
+    Exact &existing = _exact[_slots[slot] - 1];
+    if (existing.hash == hash && view(existing.from) == from) {
+      existing.response = store(response);
+      return;
+    }
+  }
+  _exact.push_back({hash, store(from), store(response)});
+  _slots[slot] = _exact.size();
+}
+
+void RedirectTable::add_prefix(std::string_view prefix, Prefix rule) {
+  if (_nodes.empty()) {
+    _nodes.emplace_back(); // the root, with an empty label
+  }
+  // `_nodes` grows below, so nodes are referred to by index
+  std::uint32_t current = 0;
+  std::size_t pos = 0;
+  while (pos < prefix.size()) {
+    auto &children = _nodes[current].children;
+    auto it = std::lower_bound(
+        children.begin(), children.end(), prefix[pos],
+        [this](std::uint32_t child, char c) {
+          return view(_nodes[child].label)[0] < c;
+        });
+    if (it == children.end() || view(_nodes[*it].label)[0] != prefix[pos]) {
+      Node leaf;
+      leaf.label = store(prefix.substr(pos));
+      children.insert(it, _nodes.size());
+      _nodes.push_back(std::move(leaf));
+      current = _nodes.size() - 1;
+      pos = prefix.size();
+      break;
+    }
+    std::uint32_t child = *it;
+    std::string_view label = view(_nodes[child].label);
+    std::string_view rest = prefix.substr(pos);
+    std::size_t common =
+        std::mismatch(label.begin(), label.end(), rest.begin(), rest.end())
+            .first -
+        label.begin();
+    if (common < label.size()) {
+      // the prefix ends or diverges partway through the label, so split it
+      Node middle;
+      middle.label = {_nodes[child].label.offset,
+                      static_cast<std::uint32_t>(common)};
+      middle.children.push_back(child);
+      _nodes[child].label.offset += common;
+      _nodes[child].label.length -= common;
+      *it = _nodes.size();
+      _nodes.push_back(std::move(middle));
+      child = _nodes.size() - 1;
+    }
+    current = child;
+    pos += common;
+  }
+  Node &node = _nodes[current];
+  if (node.prefix >= 0) {
+    _prefixes[node.prefix] = rule;
+  } else {
+    node.prefix = _prefixes.size();
+    _prefixes.push_back(rule);
+  }
+}
+
+std::optional<RedirectTable::Match>
+RedirectTable::find(std::string_view route) const {
+  if (!_slots.empty()) {
+    std::uint64_t hash = std::hash<std::string_view>{}(route);
+    std::size_t mask = _slots.size() - 1;
+    for (std::size_t slot = hash & mask; _slots[slot] != 0;
+         slot = (slot + 1) & mask) {
+      const Exact &exact = _exact[_slots[slot] - 1];
+      if (exact.hash == hash && view(exact.from) == route) {
+        return Match{view(exact.response), {}, {}};
+      }
+    }
+  }
+  if (_nodes.empty()) {
+    return std::nullopt;
+  }
+  // keep the longest prefix seen on the way down
+  std::int32_t best = -1;
+  std::size_t best_end = 0;
+  std::uint32_t current = 0;
+  std::size_t pos = 0;
+  while (true) {
+    const Node &node = _nodes[current];
+    std::string_view label = view(node.label);
+    if (route.substr(pos, label.size()) != label) {
+      break;
+    }
+    pos += label.size();
+    if (node.prefix >= 0) {
+      best = node.prefix;
+      best_end = pos;
+    }
+    if (pos == route.size()) {
+      break;
+    }
+    auto it = std::lower_bound(
+        node.children.begin(), node.children.end(), route[pos],
+        [this](std::uint32_t child, char c) {
+          return view(_nodes[child].label)[0] < c;
+        });
+    if (it == node.children.end()) {
+      break;
+    }
+    current = *it;
+  }
+  if (best < 0) {
+    return std::nullopt;
+  }
+  const Prefix &prefix = _prefixes[best];
+  return Match{view(prefix.head),
+               prefix.keep_suffix ? route.substr(best_end) : std::string_view(),
+               TAIL};
+}
+
+std::size_t RedirectTable::size() const {
+  return _exact.size() + _prefixes.size();
+}
+
+RedirectTable RedirectTable::from_file(const std::string &path) {
+  RedirectTable table;
+  // the lines are parsed in place, so there is no need to copy the file
+  strutil::mapped_file file(path);
+  std::string_view contents = file.view();
+  std::size_t line_number = 0;
+  for (std::string_view line : strutil::split_view(contents, "\n")) {
+    ++line_number;
+    if (std::size_t comment = line.find('#'); comment != line.npos) {
+      line = line.substr(0, comment);
+    }
+    std::vector<std::string_view> fields;
+    for (std::string_view field : strutil::split_view(line, " ")) {
+      field = strutil::trim_view(field);
+      if (!field.empty()) {
+        fields.push_back(field);
+      }
+    }
+    if (fields.empty()) {
+      continue;
+    }
+    try {
+      if (fields.size() < 2 || fields.size() > 3) {
+        throw std::invalid_argument("expected \"<route> <location> [status]\"");
+      }
+      int status_code = 301;
+      if (fields.size() == 3) {
+        std::string_view code = fields[2];
+        auto [end, ec] =
+            std::from_chars(code.data(), code.data() + code.size(), status_code);
+        if (ec != std::errc() || end != code.data() + code.size()) {
+          throw std::invalid_argument("invalid status code: " +
+                                      std::string(code));
+        }
+      }
+      table.add(fields[0], fields[1], status_code);
+    } catch (const std::invalid_argument &e) {
+      throw std::invalid_argument(path + ":" + std::to_string(line_number) +
+                                  ": " + e.what());
+    }
+  }
+  return table;
+}
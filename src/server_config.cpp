@@ -0,0 +1,306 @@
+#include "server_config.hpp"
+#include "json.hpp"
+#include "strutil.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <charconv>
+#include <stdexcept>
+
+namespace {
+
+/**
+ * Reads settings out of a config file, and points at the line and column
+ * of anything which is wrong with them.
+ */
+class ConfigReader {
+public:
+  ConfigReader(const std::string &path, std::string_view text)
+      : _path(path), _text(text) {}
+
+  [[noreturn]] void fail(json::value at, const std::string &key,
+                         const std::string &what) const {
+    std::string setting = key.empty() ? "the config" : "\"" + key + "\"";
+    throw std::invalid_argument(location(at.raw().data() - _text.data()) +
+                                ": " + setting + " " + what);
+  }
+
+  /* Turn the offset in a json::error into a line and column as well */
+  [[noreturn]] void fail(const json::error &e) const {
+    std::string_view what = e.what();
+    std::size_t at = what.rfind(" at offset ");
+    std::size_t offset = 0;
+    if (at == what.npos ||
+        std::from_chars(what.data() + at + 11, what.data() + what.size(),
+                        offset)
+                .ec != std::errc()) {
+      throw std::invalid_argument(_path + ": " + std::string(what));
+    }
+    throw std::invalid_argument(location(offset) + ": " +
+                                std::string(what.substr(0, at)));
+  }
+
+  /**
+   * Call `member(name, key, value)` for each member of the object `value`,
+   * where `key` is the full name of the setting, i.e. "listen.port".
+   */
+  template <typename F>
+  void object(json::value value, const std::string &key, F &&member) const {
+    if (value.type() != json::type::object) {
+      fail(value, key, "must be an object");
+    }
+    for (auto [name, child] : value.members()) {
+      member(name, key.empty() ? std::string(name) : key + "." + std::string(name),
+             child);
+    }
+  }
+
+  std::int64_t integer(json::value value, const std::string &key,
+                       std::int64_t min, std::int64_t max) const {
+    std::int64_t n = 0;
+    try {
+      n = value.get_int();
+    } catch (const json::error &) {
+      fail(value, key, "must be an integer");
+    }
+    if (n < min || n > max) {
+      fail(value, key,
+           "must be between " + std::to_string(min) + " and " +
+               std::to_string(max));
+    }
+    return n;
+  }
+
+  double positive(json::value value, const std::string &key) const {
+    double n = 0;
+    try {
+      n = value.get_double();
+    } catch (const json::error &) {
+      fail(value, key, "must be a number");
+    }
+    if (!(n > 0)) {
+      fail(value, key, "must be positive");
+    }
+    return n;
+  }
+
+  bool boolean(json::value value, const std::string &key) const {
+    if (value.type() != json::type::boolean) {
+      fail(value, key, "must be true or false");
+    }
+    return value.get_bool();
+  }
+
+  std::string string(json::value value, const std::string &key) const {
+    if (value.type() != json::type::string) {
+      fail(value, key, "must be a string");
+    }
+    std::string s(value.get_string());
+    if (s.empty()) {
+      fail(value, key, "must not be empty");
+    }
+    return s;
+  }
+
+  [[noreturn]] void unknown(json::value value, const std::string &key) const {
+    fail(value, key, "is not a setting");
+  }
+
+private:
+  const std::string &_path;
+  std::string_view _text;
+
+  std::string location(std::size_t offset) const {
+    std::string_view before = _text.substr(0, offset);
+    std::size_t line = std::count(before.begin(), before.end(), '\n') + 1;
+    std::size_t line_start = before.rfind('\n');
+    std::size_t column =
+        offset - (line_start == before.npos ? 0 : line_start + 1) + 1;
+    return _path + ":" + std::to_string(line) + ":" + std::to_string(column);
+  }
+};
+
+} // namespace
+
+ServerConfig ServerConfig::from_file(const std::string &path) {
+  std::string text = strutil::slurp(path);
+  // read the file in place, with the padding the reader needs left in the
+  // string's capacity
+  std::size_t size = text.size();
+  text.resize(size + json::PADDING);
+  text.resize(size);
+
+  ServerConfig config;
+  ConfigReader reader(path, text);
+  try {
+    json::document doc(text, json::padded);
+    // the reader stops at the end of the root, so a stray bracket or a
+    // second object after it would go unnoticed
+    std::string_view root = doc.root().raw();
+    std::size_t end = root.data() + root.size() - text.data();
+    if (std::size_t extra = text.find_first_not_of(" \t\r\n", end);
+        extra != text.npos) {
+      throw json::error("json: unexpected content after the config at offset " +
+                        std::to_string(extra));
+    }
+    reader.object(doc.root(), "", [&](std::string_view name,
+                                      const std::string &key,
+                                      json::value value) {
+      if (name == "listen") {
+        reader.object(value, key, [&](std::string_view name,
+                                      const std::string &key,
+                                      json::value value) {
+          if (name == "address") {
+            config.address = reader.string(value, key);
+            in_addr addr;
+            if (inet_pton(AF_INET, config.address.c_str(), &addr) != 1) {
+              reader.fail(value, key, "must be an IPv4 address");
+            }
+          } else if (name == "port") {
+            config.port = reader.integer(value, key, 1, UINT16_MAX);
+          } else if (name == "backlog") {
+            config.backlog = reader.integer(value, key, 0, INT32_MAX);
+          } else if (name == "bind_retries") {
+            config.bind_retries = reader.integer(value, key, 1, 100);
+          } else {
+            reader.unknown(value, key);
+          }
+        });
+      } else if (name == "socket") {
+        SocketOptions &socket = config.socket;
+        reader.object(value, key, [&](std::string_view name,
+                                      const std::string &key,
+                                      json::value value) {
+          if (name == "nodelay") {
+            socket.nodelay = reader.boolean(value, key);
+          } else if (name == "cork") {
+            socket.cork = reader.boolean(value, key);
+          } else if (name == "defer_accept_s") {
+            socket.defer_accept_s = reader.integer(value, key, 0, 3600);
+          } else if (name == "fastopen_queue") {
+            socket.fastopen_queue = reader.integer(value, key, 0, 65535);
+          } else if (name == "recv_buffer") {
+            socket.recv_buffer = reader.integer(value, key, 0, INT32_MAX / 2);
+          } else if (name == "send_buffer") {
+            socket.send_buffer = reader.integer(value, key, 0, INT32_MAX / 2);
+          } else {
+            reader.unknown(value, key);
+          }
+        });
+      } else if (name == "threads") {
+        reader.object(value, key, [&](std::string_view name,
+                                      const std::string &key,
+                                      json::value value) {
+          if (name == "workers") {
+            config.workers = reader.integer(value, key, 0, 4096);
+          } else if (name == "file_io") {
+            config.file_io_threads = reader.integer(value, key, 1, 4096);
+          } else if (name == "spin_us") {
+            config.spin_us = reader.integer(value, key, 0, 1000000);
+          } else {
+            reader.unknown(value, key);
+          }
+        });
+      } else if (name == "timeouts") {
+        reader.object(value, key, [&](std::string_view name,
+                                      const std::string &key,
+                                      json::value value) {
+          if (name == "read_ms") {
+            config.read_timeout_ms = reader.integer(value, key, 0, INT32_MAX);
+          } else if (name == "write_ms") {
+            config.write_timeout_ms = reader.integer(value, key, 0, INT32_MAX);
+          } else if (name == "request_ms") {
+            config.request_timeout_ms = reader.integer(value, key, 0, INT32_MAX);
+          } else {
+            reader.unknown(value, key);
+          }
+        });
+      } else if (name == "limits") {
+        reader.object(value, key, [&](std::string_view name,
+                                      const std::string &key,
+                                      json::value value) {
+          if (name == "max_header_bytes") {
+            config.max_header_bytes = reader.integer(value, key, 0, INT64_MAX);
+          } else if (name == "max_body_bytes") {
+            config.max_body_bytes = reader.integer(value, key, 0, INT64_MAX);
+          } else if (name == "rate_limit") {
+            RateLimit limit{0, 0};
+            reader.object(value, key, [&](std::string_view name,
+                                          const std::string &key,
+                                          json::value value) {
+              if (name == "requests_per_second") {
+                limit.requests_per_second = reader.positive(value, key);
+              } else if (name == "burst") {
+                limit.burst = reader.positive(value, key);
+                if (limit.burst < 1 || limit.burst > 16000) {
+                  reader.fail(value, key, "must be between 1 and 16000");
+                }
+              } else if (name == "clients") {
+                limit.clients = reader.integer(value, key, 16, 1 << 26);
+              } else {
+                reader.unknown(value, key);
+              }
+            });
+            if (limit.requests_per_second == 0 || limit.burst == 0) {
+              reader.fail(value, key,
+                          "needs both requests_per_second and burst");
+            }
+            config.rate_limit = limit;
+          } else {
+            reader.unknown(value, key);
+          }
+        });
+      } else if (name == "static") {
+        if (value.type() != json::type::array) {
+          reader.fail(value, key, "must be an array");
+        }
+        for (json::value element : value.elements()) {
+          std::string element_key =
+              key + "[" + std::to_string(config.static_directories.size()) +
+              "]";
+          StaticDirectory mount;
+          reader.object(element, element_key, [&](std::string_view name,
+                                                  const std::string &key,
+                                                  json::value value) {
+            if (name == "directory") {
+              mount.directory = reader.string(value, key);
+            } else if (name == "mount") {
+              mount.mount_point = reader.string(value, key);
+              if (!mount.mount_point.starts_with('/')) {
+                reader.fail(value, key, "must start with '/'");
+              }
+            } else {
+              reader.unknown(value, key);
+            }
+          });
+          if (mount.directory.empty()) {
+            reader.fail(element, element_key, "needs a directory");
+          }
+          config.static_directories.push_back(std::move(mount));
+        }
+      } else if (name == "ip_filter") {
+        config.ip_filter = reader.string(value, key);
+      } else if (name == "redirects") {
+        config.redirects = reader.string(value, key);
+      } else if (name == "not_found_page") {
+        config.not_found_page = reader.string(value, key);
+      } else if (name == "log") {
+        reader.object(value, key, [&](std::string_view name,
+                                      const std::string &key,
+                                      json::value value) {
+          if (name == "verbose") {
+            config.verbose = reader.boolean(value, key);
+          } else if (name == "requests") {
+            config.log_requests = reader.boolean(value, key);
+          } else {
+            reader.unknown(value, key);
+          }
+        });
+      } else {
+        reader.unknown(value, key);
+      }
+    });
+  } catch (const json::error &e) {
+    reader.fail(e);
+  }
+  return config;
+}
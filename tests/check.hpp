@@ -0,0 +1,148 @@
+/**
+ * A minimal test harness for the unit tests in this directory, so that they
+ * don't need a test framework.
+ *
+ * Each test file is its own executable which includes this header once:
+ *
+ * TEST(splits_on_the_delimiter) {
+ *   CHECK_EQ(strutil::split("a,b", ",").size(), 2u);
+ * }
+ *
+ * The generated `main` runs every TEST in the order they are defined, prints
+ * each failed check and exits with a non-zero status if any failed.
+ */
+#pragma once
+
+#include <exception>
+#include <fmt/format.h>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace check {
+
+struct Test {
+  const char *name;
+  std::function<void()> body;
+};
+
+inline std::vector<Test> &tests() {
+  static std::vector<Test> tests;
+  return tests;
+}
+
+inline int &failures() {
+  static int failures = 0;
+  return failures;
+}
+
+struct Register {
+  Register(const char *name, std::function<void()> body) {
+    tests().push_back({name, std::move(body)});
+  }
+};
+
+inline void fail(const char *file, int line, const std::string &what) {
+  fmt::print(stderr, "{}:{}: {}\n", file, line, what);
+  ++failures();
+}
+
+/* Shows characters as the escapes they were written with in a failed check */
+inline std::string escaped(std::string_view s) {
+  std::string out;
+  out += '"';
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20 || c >= 0x7f) {
+      out += fmt::format("\\x{:02x}", c);
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+  return out;
+}
+
+template <typename T> std::string show(const T &value) {
+  if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+    return escaped(value);
+  } else if constexpr (requires { fmt::format("{}", value); }) {
+    return fmt::format("{}", value);
+  } else {
+    return "?";
+  }
+}
+
+} // namespace check
+
+#define CHECK_CONCAT_(a, b) a##b
+#define CHECK_CONCAT(a, b) CHECK_CONCAT_(a, b)
+
+#define TEST(name)                                                             \
+  static void CHECK_CONCAT(test_, name)();                                     \
+  static check::Register CHECK_CONCAT(register_, name)(                        \
+      #name, CHECK_CONCAT(test_, name));                                       \
+  static void CHECK_CONCAT(test_, name)()
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      check::fail(__FILE__, __LINE__, "CHECK(" #cond ") failed");              \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(actual, expected)                                             \
+  do {                                                                         \
+    const auto &check_actual = (actual);                                       \
+    const auto &check_expected = (expected);                                   \
+    if (!(check_actual == check_expected)) {                                   \
+      check::fail(__FILE__, __LINE__,                                          \
+                  fmt::format("CHECK_EQ({}, {}) failed: {} != {}", #actual,    \
+                              #expected, check::show(check_actual),            \
+                              check::show(check_expected)));                   \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_THROWS(expr, exception)                                          \
+  do {                                                                         \
+    bool check_thrown = false;                                                 \
+    try {                                                                      \
+      (void)(expr);                                                            \
+    } catch (const exception &) {                                              \
+      check_thrown = true;                                                     \
+    } catch (...) {                                                            \
+    }                                                                          \
+    if (!check_thrown) {                                                       \
+      check::fail(__FILE__, __LINE__,                                          \
+                  "CHECK_THROWS(" #expr ", " #exception ") failed");           \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_NOTHROW(expr)                                                    \
+  do {                                                                         \
+    try {                                                                      \
+      (void)(expr);                                                            \
+    } catch (const std::exception &e) {                                        \
+      check::fail(__FILE__, __LINE__,                                          \
+                  fmt::format("CHECK_NOTHROW({}) threw: {}", #expr, e.what()));  \
+    }                                                                          \
+  } while (0)
+
+int main() {
+  for (const auto &test : check::tests()) {
+    int before = check::failures();
+    try {
+      test.body();
+    } catch (const std::exception &e) {
+      check::fail(__FILE__, __LINE__,
+                  fmt::format("{} threw: {}", test.name, e.what()));
+    }
+    fmt::print("{} {}\n", check::failures() == before ? "ok  " : "FAIL",
+               test.name);
+  }
+  return check::failures() == 0 ? 0 : 1;
+}
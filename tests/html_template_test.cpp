@@ -0,0 +1,127 @@
+/**
+ * Checks compiling and rendering HTML templates, both into a string and
+ * into segments.
+ */
+#include "check.hpp"
+#include "html_template.hpp"
+#include <cmath>
+
+/* The segments of a rendered template joined into one string */
+static std::string join(const RenderedTemplate &rendered) {
+  std::string out;
+  for (const auto &segment : rendered.segments) {
+    const char *data = segment.data != nullptr
+                           ? segment.data
+                           : rendered.dynamic.data() + segment.offset;
+    out.append(data, segment.length);
+  }
+  return out;
+}
+
+/* Render `page` both ways, checking that they agree */
+static std::string render(const HtmlTemplate &page,
+                          const HtmlTemplate::Args &args) {
+  std::string out = "prefix:";
+  page.render(out, args);
+  CHECK(out.starts_with("prefix:"));
+  out.erase(0, 7);
+  RenderedTemplate rendered;
+  page.render(rendered, args);
+  CHECK_EQ(join(rendered), out);
+  CHECK_EQ(rendered.size(), out.size());
+  return out;
+}
+
+TEST(renders_slots) {
+  HtmlTemplate page("<h1>{{title}}</h1><ul>{{{items}}}</ul>{{ title }}");
+  CHECK(page.slots() == std::vector<std::string>({"title", "items"}));
+  auto args = page.args();
+  args.set("title", "Fish & <Chips>").set("items", "<li>one</li>");
+  CHECK_EQ(render(page, args), "<h1>Fish &amp; &lt;Chips&gt;</h1>"
+                               "<ul><li>one</li></ul>Fish &amp; &lt;Chips&gt;");
+}
+
+TEST(renders_unset_slots_as_nothing) {
+  HtmlTemplate page("a{{x}}b{{{y}}}c");
+  CHECK_EQ(render(page, page.args()), "abc");
+}
+
+TEST(renders_numbers) {
+  HtmlTemplate page("{{n}} {{d}} {{{n}}}");
+  auto args = page.args();
+  args.set("n", -42).set("d", 0.25);
+  CHECK_EQ(render(page, args), "-42 0.25 -42");
+  args.set("n", std::uint64_t(7)).set("d", std::nan(""));
+  CHECK_EQ(render(page, args), "7  7");
+}
+
+TEST(sets_slots_by_index) {
+  HtmlTemplate page("{{a}}-{{b}}");
+  std::size_t b = page.slot("b");
+  CHECK_EQ(b, 1u);
+  auto args = page.args();
+  args[b] = std::string_view("<b>");
+  CHECK_EQ(render(page, args), "-&lt;b&gt;");
+  CHECK_THROWS(page.slot("c"), std::invalid_argument);
+  CHECK_THROWS(args.set("c", "x"), std::invalid_argument);
+}
+
+TEST(leaves_stray_braces_alone) {
+  HtmlTemplate page("{ } }} {{{a}}}} {{a}}} {x}");
+  auto args = page.args();
+  args.set("a", "v");
+  CHECK_EQ(render(page, args), "{ } }} v} v} {x}");
+  CHECK_EQ(render(HtmlTemplate(""), HtmlTemplate("").args()), "");
+}
+
+TEST(rejects_malformed_slots) {
+  CHECK_THROWS(HtmlTemplate("<p>{{title</p>"), std::invalid_argument);
+  CHECK_THROWS(HtmlTemplate("{{{raw}}"), std::invalid_argument);
+  CHECK_THROWS(HtmlTemplate("{{}}"), std::invalid_argument);
+  CHECK_THROWS(HtmlTemplate("{{ }}"), std::invalid_argument);
+  CHECK_THROWS(HtmlTemplate("{{a b}}"), std::invalid_argument);
+  CHECK_THROWS(HtmlTemplate("{{<script>}}"), std::invalid_argument);
+  try {
+    HtmlTemplate("0123{{x");
+    CHECK(false);
+  } catch (const std::invalid_argument &e) {
+    CHECK_EQ(std::string(e.what()), "unterminated template slot at offset 4");
+  }
+}
+
+TEST(merges_neighbouring_slots) {
+  HtmlTemplate page("<p>{{a}}{{b}}{{{c}}}</p>");
+  auto args = page.args();
+  args.set("a", "1").set("b", "2").set("c", "3");
+  RenderedTemplate rendered;
+  page.render(rendered, args);
+  CHECK_EQ(rendered.segments.size(), 3u);
+  CHECK_EQ(join(rendered), "<p>123</p>");
+}
+
+TEST(keeps_the_source_alive) {
+  RenderedTemplate rendered;
+  {
+    HtmlTemplate page(std::string(1000, 'x') + "{{a}}");
+    auto args = page.args();
+    args.set("a", "y");
+    page.render(rendered, args);
+  }
+  CHECK_EQ(join(rendered), std::string(1000, 'x') + "y");
+}
+
+TEST(escapes_html) {
+  std::string out;
+  html_escape(out, "& < > \" ' plain");
+  CHECK_EQ(out, "&amp; &lt; &gt; &quot; &#39; plain");
+  // specials on either side of the SIMD blocks are found
+  for (std::size_t at = 0; at < 100; ++at) {
+    std::string s(100, 'x');
+    s[at] = '<';
+    std::string expected = s;
+    expected.replace(at, 1, "&lt;");
+    out.clear();
+    html_escape(out, s);
+    CHECK_EQ(out, expected);
+  }
+}
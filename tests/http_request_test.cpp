@@ -0,0 +1,92 @@
+/**
+ * Checks parsing the head of requests: the request line, the headers and
+ * the length of the body.
+ */
+#include "HttpServer.hpp"
+#include "check.hpp"
+#include <limits>
+
+using namespace std::string_view_literals;
+
+TEST(reads_content_length) {
+  CHECK_EQ(HttpRequest("GET / HTTP/1.1\r\n\r\n").content_length(), 0u);
+  CHECK_EQ(HttpRequest("POST / HTTP/1.1\r\nContent-Length: 0\r\n\r\n")
+               .content_length(),
+           0u);
+  CHECK_EQ(HttpRequest("POST / HTTP/1.1\r\ncontent-length:  42 \r\n\r\n")
+               .content_length(),
+           42u);
+  std::string max = std::to_string(std::numeric_limits<std::size_t>::max());
+  CHECK_EQ(HttpRequest("POST / HTTP/1.1\r\nContent-Length: " + max + "\r\n\r\n")
+               .content_length(),
+           std::numeric_limits<std::size_t>::max());
+}
+
+TEST(rejects_invalid_content_length) {
+  for (const char *value :
+       {"", "-1", "+1", "0x10", "1.5", "1e3", "abc", "5, 5", "5 5",
+        // one past SIZE_MAX, and far past it
+        "18446744073709551616", "99999999999999999999999999"}) {
+    HttpRequest request(std::string("POST / HTTP/1.1\r\nContent-Length: ") +
+                        value + "\r\n\r\n");
+    CHECK_THROWS(request.content_length(), std::invalid_argument);
+  }
+}
+
+TEST(parses_the_request_line_and_headers) {
+  HttpRequest request("GET /index.html?q=1 HTTP/1.1\r\n"
+                      "Host: Example.com\r\n"
+                      "X-Forwarded-For:\t10.0.0.1 \r\n"
+                      "Accept:text/html\r\n"
+                      "not a header\r\n"
+                      "\r\n"
+                      "Ignored: body\r\n");
+  CHECK_EQ(request.method(), "GET");
+  CHECK_EQ(request.route(), "/index.html?q=1");
+  // names and values are lowercased, and values trimmed
+  std::map<std::string, std::string> expected = {
+      {"host", "example.com"},
+      {"x-forwarded-for", "10.0.0.1"},
+      {"accept", "text/html"}};
+  CHECK(request.headers() == expected);
+}
+
+TEST(keeps_the_last_of_repeated_headers) {
+  HttpRequest request("GET / HTTP/1.1\r\nAccept: a\r\naccept: b\r\n\r\n");
+  CHECK_EQ(request.headers().at("accept"), "b");
+}
+
+TEST(allows_tabs_in_header_values) {
+  HttpRequest request("GET / HTTP/1.1\r\nX-List: a\tb\r\n\r\n");
+  CHECK_EQ(request.headers().at("x-list"), "a\tb");
+}
+
+TEST(rejects_malformed_request_lines) {
+  CHECK_THROWS(HttpRequest(""), std::invalid_argument);
+  CHECK_THROWS(HttpRequest("\r\n\r\n"), std::invalid_argument);
+  CHECK_THROWS(HttpRequest("GET\r\n\r\n"), std::invalid_argument);
+  // the route ends up in responses, i.e. in the Location of redirects
+  for (std::string_view target :
+       {"/a\tb"sv, "/a\x01"sv, "/a\x7f"sv, "/a\0b"sv, "/a\rb"sv}) {
+    std::string head = "GET " + std::string(target) + " HTTP/1.1";
+    CHECK_THROWS(HttpRequest(head + "\r\n\r\n"), std::invalid_argument);
+  }
+}
+
+TEST(rejects_invalid_header_names) {
+  for (std::string name : {"", "Host ", " Host", "Ho st", "Ho(st)", "Hóst",
+                           "X-\x01", "[Host]", "Host/1"}) {
+    CHECK_THROWS(HttpRequest("GET / HTTP/1.1\r\n" + name + ": x\r\n\r\n"),
+                 std::invalid_argument);
+  }
+  CHECK_NOTHROW(
+      HttpRequest("GET / HTTP/1.1\r\n!#$%&'*+-.^_`|~09az: x\r\n\r\n"));
+}
+
+TEST(rejects_control_characters_in_header_values) {
+  for (std::string_view value :
+       {"a\x01"sv, "a\x1f."sv, "\x7f"sv, "a\0b"sv, "a\rb"sv, "a\nb"sv}) {
+    std::string head = "GET / HTTP/1.1\r\nX: " + std::string(value);
+    CHECK_THROWS(HttpRequest(head + "\r\n\r\n"), std::invalid_argument);
+  }
+}
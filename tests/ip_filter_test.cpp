@@ -0,0 +1,263 @@
+/**
+ * Checks IP filters against a linear scan of their rules, and loading them
+ * from files.
+ */
+#include "check.hpp"
+#include "ip_filter.hpp"
+#include <arpa/inet.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <netinet/in.h>
+#include <random>
+
+using Action = IpFilter::Action;
+using u128 = unsigned __int128;
+
+static sockaddr_storage v4(std::uint32_t address) {
+  sockaddr_storage storage{};
+  auto &in = reinterpret_cast<sockaddr_in &>(storage);
+  in.sin_family = AF_INET;
+  in.sin_addr.s_addr = htonl(address);
+  return storage;
+}
+
+static sockaddr_storage v6(u128 address) {
+  sockaddr_storage storage{};
+  auto &in6 = reinterpret_cast<sockaddr_in6 &>(storage);
+  in6.sin6_family = AF_INET6;
+  for (int i = 15; i >= 0; --i, address >>= 8) {
+    in6.sin6_addr.s6_addr[i] = static_cast<unsigned char>(address);
+  }
+  return storage;
+}
+
+static sockaddr_storage parse(const char *text) {
+  in_addr a4;
+  if (inet_pton(AF_INET, text, &a4) == 1) {
+    return v4(ntohl(a4.s_addr));
+  }
+  in6_addr a6;
+  CHECK_EQ(inet_pton(AF_INET6, text, &a6), 1);
+  u128 address = 0;
+  for (unsigned char byte : a6.s6_addr) {
+    address = address << 8 | byte;
+  }
+  return v6(address);
+}
+
+static std::string format(u128 address, bool is_v4) {
+  char text[INET6_ADDRSTRLEN];
+  sockaddr_storage storage = is_v4 ? v4(static_cast<std::uint32_t>(address))
+                                   : v6(address);
+  if (is_v4) {
+    inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in &>(storage).sin_addr,
+              text, sizeof(text));
+  } else {
+    inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6 &>(storage).sin6_addr,
+              text, sizeof(text));
+  }
+  return text;
+}
+
+/* The rules of a filter, checked by scanning all of them */
+struct Reference {
+  struct Rule {
+    u128 prefix;
+    unsigned length;
+    Action action;
+  };
+  std::vector<Rule> rules;
+  Action fallback = Action::Allow;
+
+  static u128 mask(unsigned length) {
+    return length == 0 ? 0 : ~u128(0) << (128 - length);
+  }
+
+  /* IPv4 networks are kept in ::ffff:0:0/96, like the filter does */
+  void add(u128 address, unsigned length, bool is_v4, Action action) {
+    if (is_v4) {
+      address |= u128(0xffff) << 32;
+      length += 96;
+    }
+    u128 prefix = address & mask(length);
+    for (Rule &rule : rules) {
+      if (rule.prefix == prefix && rule.length == length) {
+        rule.action = action;
+        return;
+      }
+    }
+    rules.push_back({prefix, length, action});
+  }
+
+  bool allowed(u128 address, bool is_v4) const {
+    if (is_v4) {
+      address |= u128(0xffff) << 32;
+    }
+    const Rule *best = nullptr;
+    for (const Rule &rule : rules) {
+      if ((address & mask(rule.length)) == rule.prefix &&
+          (best == nullptr || rule.length > best->length)) {
+        best = &rule;
+      }
+    }
+    return (best != nullptr ? best->action : fallback) != Action::Deny;
+  }
+};
+
+/* A file in the temporary directory which is removed at the end of a test */
+class TempFile {
+public:
+  explicit TempFile(std::string_view contents) {
+    std::ofstream(_path) << contents;
+  }
+  ~TempFile() { std::filesystem::remove(_path); }
+
+  const std::string &path() const { return _path; }
+
+private:
+  std::string _path = (std::filesystem::temp_directory_path() /
+                       ("ip_filter_test_" + std::to_string(getpid())))
+                          .string();
+};
+
+TEST(matches_the_most_specific_rule) {
+  IpFilter filter;
+  filter.add("10.0.0.0/8", Action::Deny);
+  filter.add("10.1.0.0/16", Action::Allow);
+  filter.add("10.1.2.3", Action::Deny);
+  filter.add("2001:db8::/32", Action::Deny);
+  filter.add("2001:db8:1::/48", Action::Allow);
+  CHECK_EQ(filter.size(), 5u);
+  CHECK(!filter.allowed(parse("10.0.0.1")));
+  CHECK(filter.allowed(parse("10.1.0.1")));
+  CHECK(!filter.allowed(parse("10.1.2.3")));
+  CHECK(filter.allowed(parse("10.1.2.4")));
+  CHECK(filter.allowed(parse("11.0.0.1")));
+  CHECK(!filter.allowed(parse("2001:db8::1")));
+  CHECK(filter.allowed(parse("2001:db8:1::1")));
+  CHECK(filter.allowed(parse("2001:db9::1")));
+  // IPv4-mapped IPv6 clients are checked against the IPv4 rules
+  CHECK(!filter.allowed(parse("::ffff:10.0.0.1")));
+  CHECK(filter.allowed(parse("::ffff:10.1.0.1")));
+}
+
+TEST(replaces_rules_for_the_same_network) {
+  IpFilter filter;
+  filter.add("192.0.2.0/24", Action::Deny);
+  filter.add("192.0.2.77/24", Action::Allow);
+  CHECK_EQ(filter.size(), 1u);
+  CHECK(filter.allowed(parse("192.0.2.1")));
+}
+
+TEST(applies_the_default) {
+  IpFilter empty;
+  CHECK(empty.allowed(parse("192.0.2.1")));
+  empty.set_default(Action::Deny);
+  CHECK(!empty.allowed(parse("192.0.2.1")));
+  IpFilter filter;
+  filter.add("192.0.2.0/24", Action::Allow);
+  filter.set_default(Action::Deny);
+  CHECK(filter.allowed(parse("192.0.2.1")));
+  CHECK(!filter.allowed(parse("198.51.100.1")));
+  CHECK(!filter.allowed(parse("::1")));
+  // a rule for everything beats the default
+  filter.add("0.0.0.0/0", Action::Allow);
+  CHECK(filter.allowed(parse("198.51.100.1")));
+  CHECK(!filter.allowed(parse("::1")));
+  filter.add("::/0", Action::Allow);
+  CHECK(filter.allowed(parse("::1")));
+}
+
+TEST(rejects_invalid_networks) {
+  IpFilter filter;
+  for (const char *cidr :
+       {"", "10.0.0", "10.0.0.256", "10.0.0.0/", "10.0.0.0/33", "10.0.0.0/-1",
+        "10.0.0.0/8x", "10.0.0.0/ 8", "2001:db8::/129", "2001:db8:::1",
+        "example.com", "10.0.0.0/8/8"}) {
+    CHECK_THROWS(filter.add(cidr, Action::Deny), std::invalid_argument);
+  }
+  CHECK_EQ(filter.size(), 0u);
+}
+
+TEST(matches_a_linear_scan) {
+  std::mt19937_64 rng(7);
+  for (bool is_v4 : {true, false}) {
+    unsigned bits = is_v4 ? 32 : 128;
+    for (int round = 0; round < 20; ++round) {
+      // rules around a few bases, so that they nest and share prefixes
+      std::vector<u128> bases;
+      for (int i = 0; i < 4; ++i) {
+        u128 base = u128(rng()) << 64 | rng();
+        bases.push_back(is_v4 ? base & 0xffffffff : base);
+      }
+      auto near = [&] {
+        u128 address = bases[rng() % bases.size()];
+        // flip a few bits, mostly towards the end
+        for (int flips = rng() % 3; flips > 0; --flips) {
+          address ^= u128(1) << (rng() % 4 == 0 ? rng() % bits : rng() % 24);
+        }
+        return address;
+      };
+      IpFilter filter;
+      Reference reference;
+      std::string file;
+      for (int i = 0, rules = 1 + rng() % 60; i < rules; ++i) {
+        u128 address = near();
+        unsigned length = rng() % 4 == 0 ? rng() % (bits + 1)
+                                         : bits - rng() % std::min(bits, 25u);
+        Action action = rng() % 2 ? Action::Allow : Action::Deny;
+        std::string cidr = format(address, is_v4) + "/" + std::to_string(length);
+        filter.add(cidr, action);
+        reference.add(address, length, is_v4, action);
+        file += (action == Action::Allow ? "allow " : "deny ") + cidr + "\n";
+      }
+      if (rng() % 2) {
+        filter.set_default(Action::Deny);
+        reference.fallback = Action::Deny;
+        file += "default deny\n";
+      }
+      CHECK_EQ(filter.size(), reference.rules.size());
+      // files build the IPv4 index, which `add` doesn't
+      TempFile rules(file);
+      IpFilter loaded = IpFilter::from_file(rules.path());
+      for (int i = 0; i < 500; ++i) {
+        u128 address = near();
+        sockaddr_storage client = is_v4 ? v4(static_cast<std::uint32_t>(address))
+                                        : v6(address);
+        bool expected = reference.allowed(address, is_v4);
+        CHECK_EQ(filter.allowed(client), expected);
+        CHECK_EQ(loaded.allowed(client), expected);
+      }
+    }
+  }
+}
+
+TEST(loads_rules_from_files) {
+  TempFile file("# a threat feed\n"
+                "allow 10.1.0.0/16\n"
+                "\tdeny   10.0.0.0/8  # the rest of 10/8\n"
+                "\n"
+                "203.0.113.7\n"
+                "default deny\n");
+  IpFilter filter = IpFilter::from_file(file.path());
+  CHECK_EQ(filter.size(), 3u);
+  CHECK(filter.allowed(parse("10.1.0.1")));
+  CHECK(!filter.allowed(parse("10.2.0.1")));
+  CHECK(!filter.allowed(parse("203.0.113.7")));
+  CHECK(!filter.allowed(parse("192.0.2.1")));
+  CHECK_THROWS(IpFilter::from_file("/nonexistent/file"), std::runtime_error);
+}
+
+TEST(reports_the_line_of_invalid_rules) {
+  for (const char *line : {"allow 10.0.0.0/33", "block 10.0.0.0/8",
+                           "default maybe", "allow", "10.0.0.0/8 10.0.0.1"}) {
+    TempFile file(std::string("allow 10.0.0.0/8\n\n") + line + "\n");
+    try {
+      IpFilter::from_file(file.path());
+      check::fail(__FILE__, __LINE__, std::string("accepted: ") + line);
+    } catch (const std::invalid_argument &e) {
+      CHECK(std::string(e.what()).starts_with(file.path() + ":3: "));
+    }
+  }
+}
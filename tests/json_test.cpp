@@ -0,0 +1,341 @@
+/**
+ * Checks the JSON writer against hand-written documents, and the reader
+ * against what the writer produces.
+ */
+#include "check.hpp"
+#include "json.hpp"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+TEST(writes_nested_containers) {
+  std::string out;
+  json::writer w(out);
+  w.begin_object()
+      .key("id")
+      .value(42)
+      .key("tags")
+      .begin_array()
+      .value("a")
+      .begin_object()
+      .end_object()
+      .begin_array()
+      .end_array()
+      .value("b")
+      .end_array()
+      .key("owner")
+      .begin_object()
+      .key("name")
+      .value("x")
+      .key("admin")
+      .value(false)
+      .end_object()
+      .key("parent")
+      .value(nullptr)
+      .end_object();
+  CHECK_EQ(out, R"({"id":42,"tags":["a",{},[],"b"],"owner":{"name":"x",)"
+                R"("admin":false},"parent":null})");
+}
+
+TEST(writes_deep_nesting) {
+  std::string out;
+  json::writer w(out);
+  for (int i = 0; i < 63; ++i) {
+    w.begin_array().value(i);
+  }
+  CHECK_THROWS(w.begin_array(), std::length_error);
+  for (int i = 0; i < 63; ++i) {
+    w.end_array();
+  }
+  CHECK(out.starts_with("[0,[1,[2,"));
+  CHECK(out.ends_with(",[62" + std::string(63, ']')));
+}
+
+TEST(writes_numbers) {
+  std::string out;
+  json::writer w(out);
+  w.begin_array()
+      .value(0)
+      .value(-1)
+      .value(std::numeric_limits<std::int64_t>::min())
+      .value(std::numeric_limits<std::uint64_t>::max())
+      .value(0.5)
+      .value(-1e300)
+      .value(std::nan(""))
+      .value(std::numeric_limits<double>::infinity())
+      .value(true)
+      .end_array();
+  CHECK_EQ(out, "[0,-1,-9223372036854775808,18446744073709551615,0.5,-1e+300,"
+                "null,null,true]");
+}
+
+TEST(escapes_strings) {
+  std::string out;
+  json::write_string(out, "quote\" backslash\\ slash/ tab\t newline\n");
+  CHECK_EQ(out, R"("quote\" backslash\\ slash/ tab\t newline\n")");
+  out.clear();
+  json::write_string(out, std::string_view("\0\x01\x1f\x7f\b\f\r", 7));
+  CHECK_EQ(out, R"("\u0000\u0001\u001f)"
+                "\x7f"
+                R"(\b\f\r")");
+  // UTF-8 is passed through untouched
+  out.clear();
+  json::write_string(out, "caf\xc3\xa9 \xf0\x9f\x98\x80");
+  CHECK_EQ(out, "\"caf\xc3\xa9 \xf0\x9f\x98\x80\"");
+}
+
+TEST(escapes_long_strings) {
+  // escapes on either side of the SIMD blocks are found
+  for (std::size_t at = 0; at < 100; ++at) {
+    std::string s(100, 'x');
+    s[at] = '"';
+    std::string out, expected = s;
+    json::write_string(out, s);
+    expected.insert(expected.begin() + at, '\\');
+    CHECK_EQ(out, '"' + expected + '"');
+  }
+}
+
+TEST(escapes_keys) {
+  std::string out;
+  json::writer(out).begin_object().key("a\"b").value(1).end_object();
+  CHECK_EQ(out, R"({"a\"b":1})");
+}
+
+TEST(writes_raw_fragments) {
+  std::string out;
+  json::writer(out)
+      .begin_array()
+      .raw(R"({"cached":true})")
+      .value(1)
+      .raw("[]")
+      .end_array();
+  CHECK_EQ(out, R"([{"cached":true},1,[]])");
+}
+
+TEST(flushes_past_the_threshold) {
+  std::string out, sent;
+  int flushes = 0;
+  json::writer w(
+      out,
+      [&] {
+        ++flushes;
+        sent += out;
+        out.clear();
+      },
+      64);
+  w.begin_array();
+  for (int i = 0; i < 100; ++i) {
+    w.value("0123456789");
+  }
+  w.end_array();
+  sent += out;
+  CHECK(flushes >= 100 * 13 / 64);
+  CHECK(flushes <= 100 * 13 / 64 + 1);
+  CHECK(sent.starts_with(R"(["0123456789","0123456789",)"));
+  CHECK(sent.ends_with(R"("0123456789"])"));
+  CHECK_EQ(sent.size(), 100u * 13 + 1);
+}
+
+/* The message of the json::error thrown by `f`, or "" if there was none */
+template <typename F> static std::string error_of(F &&f) {
+  try {
+    f();
+  } catch (const json::error &e) {
+    return e.what();
+  }
+  return "";
+}
+
+TEST(reads_members) {
+  json::document doc(R"( {"id": 42, "name" : "x", "owner": {"admin": true},
+                          "tags": ["a", "b"], "parent": null} )");
+  json::value root = doc.root();
+  CHECK(root.type() == json::type::object);
+  CHECK_EQ(root["id"].get_int(), 42);
+  CHECK_EQ(root["name"].get_string(), "x");
+  CHECK_EQ(root["owner"]["admin"].get_bool(), true);
+  CHECK_EQ(root["tags"][1].get_string(), "b");
+  CHECK(root["parent"].is_null());
+  CHECK(!root.find("missing").has_value());
+  CHECK_EQ(error_of([&] { root["missing"]; }),
+           "json: missing member \"missing\" at offset 1");
+  CHECK_THROWS(root["tags"][2], json::error);
+  CHECK_THROWS(root["id"]["x"], json::error);
+  CHECK_THROWS(root["name"][0], json::error);
+}
+
+TEST(iterates_over_containers) {
+  json::document doc(R"({"a": [1, [2, 3], {"b": "]"}, "}"], "c": {}, "d": []})");
+  std::vector<std::string> keys, elements;
+  for (json::member m : doc.root().members()) {
+    keys.emplace_back(m.key);
+  }
+  for (json::value v : doc.root()["a"].elements()) {
+    elements.emplace_back(v.raw());
+  }
+  CHECK(keys == std::vector<std::string>({"a", "c", "d"}));
+  CHECK(elements ==
+        std::vector<std::string>({"1", "[2, 3]", R"({"b": "]"})", R"("}")"}));
+  CHECK(doc.root()["c"].members().begin() == doc.root()["c"].members().end());
+  CHECK(doc.root()["d"].elements().begin() == doc.root()["d"].elements().end());
+}
+
+TEST(skips_values_it_does_not_read) {
+  // brackets and escaped quotes inside skipped strings don't end the value
+  json::document doc(R"({"skip": {"x": "a\"}]b", "y": [1, {"z": "\\"}]},)"
+                     R"( "want": 7})");
+  CHECK_EQ(doc.root()["want"].get_int(), 7);
+  CHECK_EQ(doc.root()["skip"]["y"][1]["z"].get_string(), "\\");
+}
+
+TEST(reads_numbers) {
+  json::document doc(R"([0, -9223372036854775808, 9223372036854775807, 1.5,
+                         -2e-3, 9223372036854775808, inf, nan, 1x, true])");
+  json::value root = doc.root();
+  CHECK_EQ(root[0].get_int(), 0);
+  CHECK_EQ(root[1].get_int(), std::numeric_limits<std::int64_t>::min());
+  CHECK_EQ(root[2].get_int(), std::numeric_limits<std::int64_t>::max());
+  CHECK_THROWS(root[3].get_int(), json::error);
+  CHECK_EQ(root[3].get_double(), 1.5);
+  CHECK_EQ(root[4].get_double(), -2e-3);
+  // out of range
+  CHECK_THROWS(root[5].get_int(), json::error);
+  // not JSON
+  CHECK_THROWS(root[6].get_double(), json::error);
+  CHECK_THROWS(root[7].get_double(), json::error);
+  CHECK_THROWS(root[8].get_int(), json::error);
+  CHECK_THROWS(root[9].get_int(), json::error);
+  CHECK_THROWS(root[9].get_double(), json::error);
+  CHECK_THROWS(root[0].get_bool(), json::error);
+  CHECK_THROWS(root[0].get_string(), json::error);
+}
+
+TEST(unescapes_strings) {
+  json::document doc(
+      R"(["plain", "q\" b\\ s\/ \b\f\n\r\t", "Aé€",)"
+      R"( "😀", "\uD83D", "tailA"])");
+  json::value root = doc.root();
+  CHECK_EQ(root[0].get_string(), "plain");
+  CHECK_EQ(root[1].get_string(), "q\" b\\ s/ \b\f\n\r\t");
+  CHECK_EQ(root[2].get_string(), "A\xc3\xa9\xe2\x82\xac");
+  CHECK_EQ(root[3].get_string(), "\xf0\x9f\x98\x80");
+  // a lone surrogate is kept as is
+  CHECK_EQ(root[4].get_string(), "\xed\xa0\xbd");
+  CHECK_EQ(root[5].get_string(), "tailA");
+  // unescaped strings stay valid as more are read
+  std::string_view first = root[1].get_string();
+  for (int i = 0; i < 100; ++i) {
+    root[2].get_string();
+  }
+  CHECK_EQ(first, "q\" b\\ s/ \b\f\n\r\t");
+}
+
+TEST(reads_keys_with_escapes) {
+  json::document doc(R"({"a\"b": 1, "c": 2})");
+  CHECK_EQ(doc.root()["a\"b"].get_int(), 1);
+  CHECK_EQ(doc.root()["c"].get_int(), 2);
+}
+
+TEST(rejects_malformed_documents) {
+  auto read_all = [](std::string_view text) {
+    json::document doc(text);
+    // touch every value, which is when errors are noticed
+    auto visit = [](auto &self, json::value v) -> void {
+      switch (v.type()) {
+      case json::type::object:
+        for (json::member m : v.members()) {
+          self(self, m.value);
+        }
+        break;
+      case json::type::array:
+        for (json::value e : v.elements()) {
+          self(self, e);
+        }
+        break;
+      case json::type::string:
+        v.get_string();
+        break;
+      default:
+        v.raw();
+      }
+    };
+    visit(visit, doc.root());
+  };
+  CHECK_NOTHROW(read_all(R"({"a": [1, "x", {"b": null}]})"));
+  CHECK_EQ(error_of([&] { read_all(""); }), "json: empty document at offset 0");
+  CHECK_EQ(error_of([&] { read_all("   "); }),
+           "json: empty document at offset 3");
+  CHECK_EQ(error_of([&] { read_all(R"("abc)"); }),
+           "json: unterminated string at offset 4");
+  // a backslash at the very end escapes nothing
+  CHECK_EQ(error_of([&] { read_all(R"("abc\)"); }),
+           "json: unterminated string at offset 5");
+  CHECK_EQ(error_of([&] { read_all(R"(["abc\)"); }),
+           "json: unterminated string at offset 6");
+  CHECK_EQ(error_of([&] { read_all(R"({"a" 1})"); }),
+           "json: expected ':' at offset 5");
+  CHECK_EQ(error_of([&] { read_all(R"({"a": })"); }),
+           "json: expected a value at offset 6");
+  CHECK_EQ(error_of([&] { read_all("[1, 2"); }),
+           "json: expected ',' or ']' at offset 5");
+  CHECK_EQ(error_of([&] { read_all("[1 2]"); }),
+           "json: expected ',' or ']' at offset 3");
+  CHECK_EQ(error_of([&] { read_all(R"({"a": 1,})"); }),
+           "json: expected a key at offset 8");
+  CHECK_EQ(error_of([&] { read_all("[1,]"); }),
+           "json: expected a value at offset 3");
+  CHECK_EQ(error_of([&] { read_all("{1: 2}"); }),
+           "json: expected a key at offset 1");
+  CHECK_EQ(error_of([&] { read_all(R"(["\x"])"); }),
+           "json: invalid escape at offset 3");
+  CHECK_EQ(error_of([&] { read_all(R"(["\u12"])"); }),
+           "json: invalid unicode escape at offset 4");
+  CHECK_EQ(error_of([&] { read_all(R"(["\u12)"); }),
+           "json: invalid unicode escape at offset 4");
+  CHECK_EQ(error_of([] { json::document(R"({"a": [1, {"b": 2})").root()["c"]; }),
+           "json: unterminated container at offset 18");
+}
+
+TEST(reads_padded_buffers_in_place) {
+  std::string buffer = R"({"name": "in place"})";
+  std::size_t size = buffer.size();
+  buffer.resize(size + json::PADDING);
+  json::document doc(std::string_view(buffer.data(), size), json::padded);
+  std::string_view name = doc.root()["name"].get_string();
+  CHECK_EQ(name, "in place");
+  // strings without escapes point into the buffer
+  CHECK(name.data() > buffer.data() && name.data() < buffer.data() + size);
+}
+
+TEST(reads_what_the_writer_wrote) {
+  // every byte, with quotes and backslashes at every position around the
+  // SIMD blocks
+  std::vector<std::string> strings;
+  std::string all;
+  for (int c = 0; c < 256; ++c) {
+    all.push_back(static_cast<char>(c));
+  }
+  strings.push_back(all);
+  for (std::size_t n = 0; n < 70; ++n) {
+    for (char special : {'"', '\\', '\n'}) {
+      std::string s(n + 1, 'x');
+      s[n] = special;
+      strings.push_back(s);
+    }
+  }
+  std::string out;
+  json::writer w(out);
+  w.begin_array();
+  for (const auto &s : strings) {
+    w.begin_object().key(s).value(s).end_object();
+  }
+  w.end_array();
+  json::document doc(out);
+  std::size_t i = 0;
+  for (json::value v : doc.root().elements()) {
+    CHECK_EQ(v[strings[i]].get_string(), strings[i]);
+    ++i;
+  }
+  CHECK_EQ(i, strings.size());
+}
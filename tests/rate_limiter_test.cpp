@@ -0,0 +1,105 @@
+/**
+ * Checks the token buckets of the rate limiter, alone and from many threads
+ * at once.
+ */
+#include "check.hpp"
+#include "rate_limiter.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <netinet/in.h>
+#include <thread>
+#include <vector>
+
+/* Slow enough that no bucket refills while a test runs */
+static constexpr double SLOW = 0.001;
+
+TEST(allows_a_burst) {
+  RateLimiter limiter(SLOW, 5);
+  for (int i = 0; i < 5; ++i) {
+    CHECK(limiter.allow(1));
+  }
+  CHECK(!limiter.allow(1));
+  CHECK(!limiter.allow(1));
+  // other clients have buckets of their own
+  CHECK(limiter.allow(2));
+}
+
+TEST(refills_buckets) {
+  RateLimiter limiter(1000, 1);
+  CHECK(limiter.allow(1));
+  CHECK(!limiter.allow(1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  CHECK(limiter.allow(1));
+  CHECK_EQ(limiter.retry_after(), 1u);
+  CHECK_EQ(RateLimiter(0.1, 1).retry_after(), 10u);
+}
+
+TEST(rejects_invalid_limits) {
+  CHECK_THROWS(RateLimiter(0, 10), std::invalid_argument);
+  CHECK_THROWS(RateLimiter(-1, 10), std::invalid_argument);
+  CHECK_THROWS(RateLimiter(1, 0.5), std::invalid_argument);
+  CHECK_THROWS(RateLimiter(1, 16001), std::invalid_argument);
+}
+
+TEST(lets_clients_through_when_full) {
+  // far more clients than slots, which are let through rather than
+  // sharing a bucket
+  RateLimiter limiter(SLOW, 1, 16);
+  for (std::uint64_t key = 1; key <= 100000; ++key) {
+    limiter.allow(key);
+  }
+  int allowed = 0;
+  for (std::uint64_t key = 1; key <= 100000; ++key) {
+    allowed += limiter.allow(key);
+  }
+  // only the clients which got a slot first are limited
+  CHECK(allowed >= 100000 - 64 * 16);
+}
+
+TEST(hands_out_each_token_once) {
+  // many threads racing for the same fresh buckets get exactly the burst
+  constexpr int THREADS = 8, BURST = 100, ROUNDS = 200;
+  for (int round = 0; round < ROUNDS; ++round) {
+    RateLimiter limiter(SLOW, BURST);
+    std::atomic<int> allowed = 0;
+    std::atomic<bool> go = false;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+      threads.emplace_back([&] {
+        while (!go) {
+        }
+        for (int i = 0; i < BURST; ++i) {
+          allowed += limiter.allow(42);
+        }
+      });
+    }
+    go = true;
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    CHECK_EQ(allowed.load(), BURST);
+  }
+}
+
+TEST(keys_clients_by_address) {
+  auto v4 = [](const char *text) {
+    sockaddr_storage storage{};
+    auto &in = reinterpret_cast<sockaddr_in &>(storage);
+    in.sin_family = AF_INET;
+    inet_pton(AF_INET, text, &in.sin_addr);
+    return client_key(storage);
+  };
+  auto v6 = [](const char *text) {
+    sockaddr_storage storage{};
+    auto &in6 = reinterpret_cast<sockaddr_in6 &>(storage);
+    in6.sin6_family = AF_INET6;
+    inet_pton(AF_INET6, text, &in6.sin6_addr);
+    return client_key(storage);
+  };
+  CHECK(v4("192.0.2.1") != v4("192.0.2.2"));
+  CHECK(v4("0.0.0.0") != 0);
+  // a whole IPv6 /64 is one client
+  CHECK_EQ(v6("2001:db8::1"), v6("2001:db8::ffff:2"));
+  CHECK(v6("2001:db8::1") != v6("2001:db8:0:1::1"));
+  CHECK(v6("::1") != 0);
+}
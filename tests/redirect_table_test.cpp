@@ -0,0 +1,191 @@
+/**
+ * Checks redirect tables against a linear scan of their redirects, and
+ * loading them from files.
+ */
+#include "check.hpp"
+#include "redirect_table.hpp"
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+
+/* The response for a match, as it's sent */
+static std::string response(const std::optional<RedirectTable::Match> &match) {
+  if (!match) {
+    return "";
+  }
+  return std::string(match->head) + std::string(match->suffix) +
+         std::string(match->tail);
+}
+
+static std::string expected(std::string_view status, std::string_view location) {
+  return fmt::format("HTTP/1.1 {}\r\nLocation: {}\r\nContent-Length: 0\r\n\r\n",
+                     status, location);
+}
+
+/* A file in the temporary directory which is removed at the end of a test */
+class TempFile {
+public:
+  explicit TempFile(std::string_view contents) {
+    std::ofstream(_path) << contents;
+  }
+  ~TempFile() { std::filesystem::remove(_path); }
+
+  const std::string &path() const { return _path; }
+
+private:
+  std::string _path = (std::filesystem::temp_directory_path() /
+                       ("redirect_table_test_" + std::to_string(getpid())))
+                          .string();
+};
+
+TEST(redirects_exact_routes) {
+  RedirectTable table;
+  table.add("/old", "/new");
+  table.add("/temp", "https://example.com/", 302);
+  table.add("/kept", "/method", 307);
+  table.add("/moved", "/for-good", 308);
+  CHECK_EQ(table.size(), 4u);
+  CHECK_EQ(response(table.find("/old")),
+           expected("301 Moved Permanently", "/new"));
+  CHECK_EQ(response(table.find("/temp")),
+           expected("302 Found", "https://example.com/"));
+  CHECK_EQ(response(table.find("/kept")),
+           expected("307 Temporary Redirect", "/method"));
+  CHECK_EQ(response(table.find("/moved")),
+           expected("308 Permanent Redirect", "/for-good"));
+  CHECK(!table.find("/ol"));
+  CHECK(!table.find("/old/"));
+  CHECK(!table.find(""));
+  CHECK(!RedirectTable().find("/old"));
+}
+
+TEST(redirects_prefixes) {
+  RedirectTable table;
+  table.add("/blog/*", "/posts");
+  table.add("/blog/2019/*", "/archive/2019/*", 302);
+  table.add("/blog/2019/draft", "/drafts");
+  table.add("/*", "/home");
+  CHECK_EQ(response(table.find("/blog/anything")),
+           expected("301 Moved Permanently", "/posts"));
+  CHECK_EQ(response(table.find("/blog/")),
+           expected("301 Moved Permanently", "/posts"));
+  // the longest prefix wins, and keeps the rest of the route
+  CHECK_EQ(response(table.find("/blog/2019/05/hello")),
+           expected("302 Found", "/archive/2019/05/hello"));
+  CHECK_EQ(response(table.find("/blog/2019/")),
+           expected("302 Found", "/archive/2019/"));
+  // exact redirects beat prefixes
+  CHECK_EQ(response(table.find("/blog/2019/draft")),
+           expected("301 Moved Permanently", "/drafts"));
+  CHECK_EQ(response(table.find("/blog")),
+           expected("301 Moved Permanently", "/home"));
+  CHECK_EQ(response(table.find("/")), expected("301 Moved Permanently", "/home"));
+  CHECK(!table.find(""));
+}
+
+TEST(replaces_redirects_from_the_same_route) {
+  RedirectTable table;
+  table.add("/a", "/b");
+  table.add("/a", "/c", 302);
+  table.add("/p/*", "/q");
+  table.add("/p/*", "/r/*");
+  CHECK_EQ(table.size(), 2u);
+  CHECK_EQ(response(table.find("/a")), expected("302 Found", "/c"));
+  CHECK_EQ(response(table.find("/p/x")),
+           expected("301 Moved Permanently", "/r/x"));
+}
+
+TEST(rejects_invalid_redirects) {
+  RedirectTable table;
+  CHECK_THROWS(table.add("old", "/new"), std::invalid_argument);
+  CHECK_THROWS(table.add("", "/new"), std::invalid_argument);
+  CHECK_THROWS(table.add("/old", ""), std::invalid_argument);
+  CHECK_THROWS(table.add("/o ld", "/new"), std::invalid_argument);
+  CHECK_THROWS(table.add("/old", "/new\r\nSet-Cookie: a=b"),
+               std::invalid_argument);
+  CHECK_THROWS(table.add("/old", "/new", 200), std::invalid_argument);
+  CHECK_THROWS(table.add("/old", "/new", 304), std::invalid_argument);
+  CHECK_THROWS(table.add("/old", "/new/*"), std::invalid_argument);
+  CHECK_EQ(table.size(), 0u);
+}
+
+TEST(matches_a_linear_scan) {
+  // routes over a tiny alphabet, so that prefixes overlap a lot
+  std::mt19937 rng(11);
+  auto random_route = [&](std::size_t max_length) {
+    std::string route = "/";
+    for (std::size_t n = rng() % max_length; n > 0; --n) {
+      route += "ab/"[rng() % 3];
+    }
+    return route;
+  };
+  for (int round = 0; round < 50; ++round) {
+    RedirectTable table;
+    std::map<std::string, std::string> exact, prefixes;
+    for (int i = 0, redirects = 1 + rng() % 200; i < redirects; ++i) {
+      std::string from = random_route(8);
+      std::string to = "/to" + std::to_string(i);
+      if (rng() % 2) {
+        from += '*';
+        if (rng() % 2) {
+          to += '*';
+        }
+        prefixes[from.substr(0, from.size() - 1)] = to;
+      } else {
+        exact[from] = to;
+      }
+      table.add(from, to);
+    }
+    CHECK_EQ(table.size(), exact.size() + prefixes.size());
+    for (int i = 0; i < 500; ++i) {
+      std::string route = random_route(10);
+      std::string location;
+      if (auto it = exact.find(route); it != exact.end()) {
+        location = it->second;
+      } else {
+        std::size_t longest = 0;
+        for (const auto &[prefix, to] : prefixes) {
+          if (route.starts_with(prefix) &&
+              (location.empty() || prefix.size() > longest)) {
+            longest = prefix.size();
+            location = to.ends_with('*')
+                           ? to.substr(0, to.size() - 1) + route.substr(longest)
+                           : to;
+          }
+        }
+      }
+      CHECK_EQ(response(table.find(route)),
+               location.empty() ? ""
+                                : expected("301 Moved Permanently", location));
+    }
+  }
+}
+
+TEST(loads_redirects_from_files) {
+  TempFile file("# legacy URLs\n"
+                "/old-page /new-page\r\n"
+                "\n"
+                "  /blog/post-*   https://blog.example.com/post-*   302  # moved\n");
+  RedirectTable table = RedirectTable::from_file(file.path());
+  CHECK_EQ(table.size(), 2u);
+  CHECK_EQ(response(table.find("/old-page")),
+           expected("301 Moved Permanently", "/new-page"));
+  CHECK_EQ(response(table.find("/blog/post-42")),
+           expected("302 Found", "https://blog.example.com/post-42"));
+  CHECK_THROWS(RedirectTable::from_file("/nonexistent/file"),
+               std::runtime_error);
+}
+
+TEST(reports_the_line_of_invalid_redirects) {
+  for (const char *line : {"/old", "/old /new 301 extra", "/old /new 3o1",
+                           "/old /new 200", "old /new", "/old /new*"}) {
+    TempFile file(std::string("/a /b\n\n") + line + "\n");
+    try {
+      RedirectTable::from_file(file.path());
+      check::fail(__FILE__, __LINE__, std::string("accepted: ") + line);
+    } catch (const std::invalid_argument &e) {
+      CHECK(std::string(e.what()).starts_with(file.path() + ":3: "));
+    }
+  }
+}
@@ -0,0 +1,163 @@
+/**
+ * Checks loading server settings from config files, and the errors for
+ * invalid ones.
+ */
+#include "check.hpp"
+#include "server_config.hpp"
+#include <filesystem>
+#include <fstream>
+
+/* A file in the temporary directory which is removed at the end of a test */
+class TempFile {
+public:
+  explicit TempFile(std::string_view contents) {
+    std::ofstream(_path) << contents;
+  }
+  ~TempFile() { std::filesystem::remove(_path); }
+
+  const std::string &path() const { return _path; }
+
+private:
+  std::string _path = (std::filesystem::temp_directory_path() /
+                       ("server_config_test_" + std::to_string(getpid())))
+                          .string();
+};
+
+static ServerConfig load(std::string_view text) {
+  TempFile file(text);
+  return ServerConfig::from_file(file.path());
+}
+
+/* The error for `text`, without the path of the file */
+static std::string error(std::string_view text) {
+  TempFile file(text);
+  try {
+    ServerConfig::from_file(file.path());
+  } catch (const std::invalid_argument &e) {
+    std::string what = e.what();
+    CHECK(what.starts_with(file.path() + ":"));
+    return what.substr(file.path().size() + 1);
+  }
+  return "";
+}
+
+TEST(loads_every_setting) {
+  ServerConfig config = load(R"({
+    "listen": {"address": "127.0.0.1", "port": 8080, "backlog": 128,
+               "bind_retries": 3},
+    "socket": {"nodelay": false, "cork": false, "defer_accept_s": 1,
+               "fastopen_queue": 256, "recv_buffer": 65536,
+               "send_buffer": 131072},
+    "threads": {"workers": 8, "file_io": 4, "spin_us": 50},
+    "timeouts": {"read_ms": 5000, "write_ms": 6000, "request_ms": 10000},
+    "limits": {
+      "max_header_bytes": 8192,
+      "max_body_bytes": 1048576,
+      "rate_limit": {"requests_per_second": 50, "burst": 100.5, "clients": 1024}
+    },
+    "static": [{"directory": "www", "mount": "/"}, {"directory": "assets"}],
+    "ip_filter": "rules.txt",
+    "redirects": "redirects.txt",
+    "not_found_page": "www/404.html",
+    "log": {"verbose": true, "requests": false}
+  })");
+  CHECK_EQ(config.address, "127.0.0.1");
+  CHECK(config.port == std::optional<std::uint16_t>(8080));
+  CHECK_EQ(config.backlog, 128);
+  CHECK_EQ(config.bind_retries, 3);
+  CHECK(!config.socket.nodelay);
+  CHECK(!config.socket.cork);
+  CHECK_EQ(config.socket.defer_accept_s, 1);
+  CHECK_EQ(config.socket.fastopen_queue, 256);
+  CHECK_EQ(config.socket.recv_buffer, 65536);
+  CHECK_EQ(config.socket.send_buffer, 131072);
+  CHECK_EQ(config.workers, 8);
+  CHECK_EQ(config.file_io_threads, 4);
+  CHECK_EQ(config.spin_us, 50);
+  CHECK_EQ(config.read_timeout_ms, 5000);
+  CHECK_EQ(config.write_timeout_ms, 6000);
+  CHECK_EQ(config.request_timeout_ms, 10000);
+  CHECK_EQ(config.max_header_bytes, 8192u);
+  CHECK_EQ(config.max_body_bytes, 1048576u);
+  CHECK(config.rate_limit.has_value());
+  CHECK_EQ(config.rate_limit->requests_per_second, 50.0);
+  CHECK_EQ(config.rate_limit->burst, 100.5);
+  CHECK_EQ(config.rate_limit->clients, 1024u);
+  CHECK_EQ(config.static_directories.size(), 2u);
+  CHECK_EQ(config.static_directories[0].directory, "www");
+  CHECK_EQ(config.static_directories[1].directory, "assets");
+  CHECK_EQ(config.static_directories[1].mount_point, "/");
+  CHECK_EQ(config.ip_filter, "rules.txt");
+  CHECK_EQ(config.redirects, "redirects.txt");
+  CHECK_EQ(config.not_found_page, "www/404.html");
+  CHECK(config.verbose == std::optional<bool>(true));
+  CHECK(!config.log_requests);
+}
+
+TEST(defaults_missing_settings) {
+  ServerConfig config = load("{}");
+  ServerConfig defaults;
+  CHECK_EQ(config.address, defaults.address);
+  CHECK(!config.port.has_value());
+  CHECK(config.socket == defaults.socket);
+  CHECK_EQ(config.workers, defaults.workers);
+  CHECK_EQ(config.max_body_bytes, defaults.max_body_bytes);
+  CHECK(!config.rate_limit.has_value());
+  CHECK(config.static_directories.empty());
+  CHECK(!config.verbose.has_value());
+  CHECK(config.log_requests);
+  CHECK_EQ(load(R"({"listen": {}, "static": []})").address, "0.0.0.0");
+}
+
+TEST(points_at_invalid_settings) {
+  CHECK_EQ(error(R"({"listen": {"port": 0}})"),
+           "1:21: \"listen.port\" must be between 1 and 65535");
+  CHECK_EQ(error("{\n  \"listen\": {\n    \"port\": \"80\"\n  }\n}"),
+           "3:13: \"listen.port\" must be an integer");
+  CHECK_EQ(error(R"({"listen": {"port": 80.5}})"),
+           "1:21: \"listen.port\" must be an integer");
+  CHECK_EQ(error(R"({"listen": {"address": "localhost"}})"),
+           "1:24: \"listen.address\" must be an IPv4 address");
+  CHECK_EQ(error(R"({"listen": {"prot": 80}})"),
+           "1:21: \"listen.prot\" is not a setting");
+  CHECK_EQ(error(R"({"socket": {"nodelay": 1}})"),
+           "1:24: \"socket.nodelay\" must be true or false");
+  CHECK_EQ(error(R"({"threads": 8})"), "1:13: \"threads\" must be an object");
+  CHECK_EQ(error(R"([])"), "1:1: the config must be an object");
+  CHECK_EQ(error(R"({"ip_filter": ""})"),
+           "1:15: \"ip_filter\" must not be empty");
+  CHECK_EQ(error(R"({"static": [{"mount": "/x"}]})"),
+           "1:13: \"static[0]\" needs a directory");
+  CHECK_EQ(error(R"({"static": [{"directory": "a"}, {"directory": "b",
+                                                      "mount": "x"}]})"),
+           "2:64: \"static[1].mount\" must start with '/'");
+  CHECK_EQ(error(R"({"limits": {"rate_limit": {"burst": 10}}})"),
+           "1:27: \"limits.rate_limit\" needs both requests_per_second and "
+           "burst");
+  CHECK_EQ(error(R"({"limits": {"rate_limit": {"requests_per_second": -1}}})"),
+           "1:51: \"limits.rate_limit.requests_per_second\" must be positive");
+  CHECK_EQ(error(R"({"limits": {"max_body_bytes": -1}})"),
+           "1:31: \"limits.max_body_bytes\" must be between 0 and "
+           "9223372036854775807");
+  CHECK_EQ(error(R"({"limits": {"max_body_bytes": 9223372036854775808}})"),
+           "1:31: \"limits.max_body_bytes\" must be an integer");
+}
+
+TEST(points_at_malformed_json) {
+  CHECK_EQ(error(""), "1:1: json: empty document");
+  CHECK_EQ(error("{\n  \"listen\": {\"port\" 80}\n}"),
+           "2:21: json: expected ':'");
+  CHECK_EQ(error(R"({"ip_filter": "rules.txt)"),
+           "1:25: json: unterminated string");
+  CHECK_EQ(error(R"({"log": {"verbose": true,}})"),
+           "1:26: json: expected a key");
+  CHECK_EQ(error(R"({"listen": {"port": 80}} })"),
+           "1:26: json: unexpected content after the config");
+  CHECK_EQ(error(R"({"listen": {"port": 80}}, {})"),
+           "1:25: json: unexpected content after the config");
+}
+
+TEST(reports_missing_files) {
+  CHECK_THROWS(ServerConfig::from_file("/nonexistent/config.json"),
+               std::runtime_error);
+}
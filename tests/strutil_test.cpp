@@ -0,0 +1,303 @@
+/**
+ * Checks the SIMD kernels of strutil against their scalar versions, over
+ * every length and alignment around the vector widths, the string helpers
+ * built on them and the file readers.
+ */
+#include "check.hpp"
+#include "strutil.hpp"
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sys/stat.h>
+#include <thread>
+
+using namespace std::string_view_literals;
+
+/* Bytes next to the edges of the ranges the kernels compare against */
+static constexpr std::string_view EDGES =
+    "@AZ[`az{\x1f \x7f\x80\xff\"\\&<>'\t\r\n\0"sv;
+
+/**
+ * Random buffers of every length up to a few AVX2 blocks, at every offset
+ * from an aligned address, which are mostly made of `clean` bytes with
+ * edge bytes mixed in.
+ */
+template <typename F> static void for_each_input(std::string_view clean, F &&f) {
+  std::mt19937 rng(42);
+  alignas(64) char buffer[256];
+  for (std::size_t n = 0; n <= 130; ++n) {
+    for (std::size_t offset = 0; offset < 4; ++offset) {
+      for (int round = 0; round < 8; ++round) {
+        char *s = buffer + offset;
+        for (std::size_t i = 0; i < n; ++i) {
+          s[i] = rng() % 8 == 0 ? EDGES[rng() % EDGES.size()]
+                                : clean[rng() % clean.size()];
+        }
+        f(s, n);
+      }
+      // a single edge byte at every position of an otherwise clean buffer
+      for (std::size_t at = 0; at < n; ++at) {
+        char *s = buffer + offset;
+        for (std::size_t i = 0; i < n; ++i) {
+          s[i] = clean[i % clean.size()];
+        }
+        for (char edge : EDGES) {
+          s[at] = edge;
+          f(s, n);
+        }
+      }
+    }
+  }
+}
+
+static constexpr std::string_view LETTERS("abcdefghijklmnopqrstuvwxyz"
+                                          "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+
+#ifdef STRUTIL_X86_SIMD
+/**
+ * The SSE2 and AVX2 versions of a kernel which this CPU can run, which take
+ * the same arguments as its scalar version.
+ */
+template <typename F> static std::vector<F *> variants(F *sse2, F *avx2) {
+  std::vector<F *> kernels;
+  if (sse2 != nullptr) {
+    kernels.push_back(sse2);
+  }
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back(avx2);
+  }
+  return kernels;
+}
+#endif
+
+TEST(ascii_case_matches_scalar) {
+#ifdef STRUTIL_X86_SIMD
+  using namespace strutil::detail;
+  using F = void(const char *, char *, std::size_t);
+  auto check_case = [](auto scalar, const std::vector<F *> &kernels) {
+    for (const auto &kernel : kernels) {
+      for_each_input(LETTERS, [&](const char *s, std::size_t n) {
+        std::string expected(n, '\0'), actual(n + 1, '#');
+        scalar(s, expected.data(), n);
+        kernel(s, actual.data(), n);
+        // nothing is written past the end
+        CHECK_EQ(actual.back(), '#');
+        actual.pop_back();
+        CHECK_EQ(actual, expected);
+      });
+    }
+  };
+  check_case(ascii_case_scalar<false>,
+             variants<F>(ascii_case_sse2<false>, ascii_case_avx2<false>));
+  check_case(ascii_case_scalar<true>,
+             variants<F>(ascii_case_sse2<true>, ascii_case_avx2<true>));
+#endif
+  // and the public versions, which work in place too
+  std::string s = "Content-TYPE: Text/HTML; charset=UTF-8 \x80\xff[`@{";
+  CHECK_EQ(strutil::lowers(s), "content-type: text/html; charset=utf-8 \x80\xff[`@{");
+  CHECK_EQ(strutil::uppers(s), "CONTENT-TYPE: TEXT/HTML; CHARSET=UTF-8 \x80\xff[`@{");
+  strutil::ascii_lower_inplace(s);
+  CHECK_EQ(s, "content-type: text/html; charset=utf-8 \x80\xff[`@{");
+}
+
+TEST(is_token_matches_scalar) {
+#ifdef STRUTIL_X86_SIMD
+  using namespace strutil::detail;
+  using F = bool(const char *, std::size_t);
+  for (const auto &kernel : variants<F>(nullptr, is_token_avx2)) {
+    for_each_input(LETTERS, [&](const char *s, std::size_t n) {
+      CHECK_EQ(kernel(s, n), is_token_scalar(s, n));
+    });
+  }
+#endif
+  CHECK(strutil::is_token("X-Forwarded-For"));
+  CHECK(strutil::is_token("!#$%&'*+-.^_`|~"));
+  CHECK(!strutil::is_token(""));
+  CHECK(!strutil::is_token("Host "));
+  CHECK(!strutil::is_token("Content:Type"));
+  CHECK(!strutil::is_token("caf\xc3\xa9"));
+}
+
+TEST(has_control_chars_matches_scalar) {
+#ifdef STRUTIL_X86_SIMD
+  using namespace strutil::detail;
+  using F = bool(const char *, std::size_t);
+  for (const auto &kernel : variants<F>(has_ctl_sse2, has_ctl_avx2)) {
+    for_each_input(LETTERS, [&](const char *s, std::size_t n) {
+      CHECK_EQ(kernel(s, n), has_ctl_scalar(s, n));
+    });
+  }
+#endif
+  CHECK(!strutil::has_control_chars("text/html;\tq=0.9 \x80\xff"));
+  CHECK(strutil::has_control_chars("evil\r\nSet-Cookie: a=b"));
+  CHECK(strutil::has_control_chars(std::string_view("a\0b", 3)));
+  CHECK(strutil::has_control_chars("\x7f"));
+}
+
+TEST(find_json_escape_matches_scalar) {
+#ifdef STRUTIL_X86_SIMD
+  using namespace strutil::detail;
+  using F = std::size_t(const char *, std::size_t);
+  for (const auto &kernel :
+       variants<F>(find_json_escape_sse2, find_json_escape_avx2)) {
+    for_each_input(LETTERS, [&](const char *s, std::size_t n) {
+      CHECK_EQ(kernel(s, n), find_json_escape_scalar(s, n));
+    });
+  }
+#endif
+  CHECK_EQ(strutil::find_json_escape("plain text \x80\x7f"),
+           std::string_view::npos);
+  CHECK_EQ(strutil::find_json_escape("say \"hi\""), 4u);
+  CHECK_EQ(strutil::find_json_escape("C:\\"), 2u);
+  CHECK_EQ(strutil::find_json_escape("tab\there"), 3u);
+}
+
+TEST(find_html_special_matches_scalar) {
+#ifdef STRUTIL_X86_SIMD
+  using namespace strutil::detail;
+  using F = std::size_t(const char *, std::size_t);
+  for (const auto &kernel :
+       variants<F>(find_html_special_sse2, find_html_special_avx2)) {
+    for_each_input(LETTERS, [&](const char *s, std::size_t n) {
+      CHECK_EQ(kernel(s, n), find_html_special_scalar(s, n));
+    });
+  }
+#endif
+  CHECK_EQ(strutil::find_html_special("no markup here"), std::string_view::npos);
+  CHECK_EQ(strutil::find_html_special("a < b"), 2u);
+  CHECK_EQ(strutil::find_html_special("it's"), 2u);
+}
+
+TEST(split_view_matches_split) {
+  for (std::string s : {"", "a", "a,b", "a,,b", ",a", "a,", "a,b,", ",,"}) {
+    std::vector<std::string> views;
+    for (std::string_view token : strutil::split_view(s, ",")) {
+      views.emplace_back(token);
+    }
+    CHECK(views == strutil::split(s, ","));
+  }
+}
+
+TEST(trims_ascii_whitespace) {
+  CHECK_EQ(strutil::trim_view(" \t\r\n value \v\f"), "value");
+  CHECK_EQ(strutil::trim_view("   "), "");
+  // bytes which are whitespace in some locales are not trimmed
+  CHECK_EQ(strutil::trim_view("\xa0value\x85"), "\xa0value\x85");
+}
+
+TEST(compares_case_insensitively) {
+  static_assert(strutil::iequals("Content-Length", "content-LENGTH"));
+  CHECK(strutil::iequals("", ""));
+  CHECK(!strutil::iequals("Host", "Hosts"));
+  CHECK(!strutil::iequals("[", "{"));
+  CHECK(!strutil::iequals("\xc0", "\xe0"));
+  CHECK_EQ(strutil::ihash{}("Accept-Encoding"),
+           strutil::ihash{}("accept-encoding"));
+  CHECK(strutil::iequal_to{}("ETag", "etag"));
+}
+
+/* A file in the temporary directory which is removed at the end of a test */
+class TempFile {
+public:
+  explicit TempFile(std::string_view contents) {
+    std::ofstream(_path, std::ios::binary)
+        .write(contents.data(), contents.size());
+  }
+  ~TempFile() { std::filesystem::remove(_path); }
+
+  const std::string &path() const { return _path; }
+
+private:
+  static inline int _count = 0;
+  std::string _path =
+      (std::filesystem::temp_directory_path() /
+       fmt::format("strutil_test_{}_{}", getpid(), _count++))
+          .string();
+};
+
+/* Bytes which need to survive reading untouched, including a NUL */
+static std::string binary_contents(std::size_t size) {
+  std::string contents(size, '\0');
+  for (std::size_t i = 0; i < size; ++i) {
+    contents[i] = static_cast<char>(i * 31 + i / 256);
+  }
+  return contents;
+}
+
+TEST(slurps_whole_files) {
+  for (std::size_t size : {0, 1, 4095, 4096, 4097, 1 << 20}) {
+    std::string contents = binary_contents(size);
+    TempFile file(contents);
+    CHECK_EQ(strutil::slurp(file.path()), contents);
+  }
+  // a buffer which was used for a larger file is shrunk to fit
+  std::string out(10000, 'x');
+  TempFile file("small");
+  strutil::slurp_into(file.path(), out);
+  CHECK_EQ(out, "small");
+  CHECK_THROWS(strutil::slurp("/nonexistent/file"), std::runtime_error);
+}
+
+TEST(slurps_files_which_report_no_size) {
+  // /proc files have a size of 0 but still have contents, some over 4 KiB
+  std::string status = strutil::slurp("/proc/self/status");
+  CHECK(status.starts_with("Name:"));
+  CHECK(status.ends_with("\n"));
+  std::string maps = strutil::slurp("/proc/self/maps");
+  CHECK(!maps.empty());
+}
+
+TEST(slurps_cached_files) {
+  std::string contents = binary_contents(100000);
+  TempFile file(contents);
+  std::string out = "stale";
+  // the file was just written, so it should be in the page cache, but this
+  // may still miss, i.e. on filesystems which don't cache
+  if (strutil::slurp_cached(file.path(), out)) {
+    CHECK_EQ(out, contents);
+  } else {
+    CHECK_EQ(out, "");
+  }
+  TempFile empty("");
+  CHECK(strutil::slurp_cached(empty.path(), out));
+  CHECK_EQ(out, "");
+  CHECK(strutil::slurp_cached("/proc/self/status", out));
+  CHECK(out.starts_with("Name:"));
+  CHECK_THROWS(strutil::slurp_cached("/nonexistent/file", out),
+               std::runtime_error);
+}
+
+TEST(maps_files) {
+  std::string contents = binary_contents(1 << 16);
+  TempFile file(contents);
+  strutil::mapped_file mapped(file.path());
+  CHECK_EQ(mapped.view(), contents);
+  // the view stays valid when the mapping is moved
+  std::string_view view = mapped.view();
+  strutil::mapped_file moved(std::move(mapped));
+  CHECK_EQ(moved.view().data(), view.data());
+  CHECK_EQ(mapped.view(), "");
+  TempFile other("other");
+  strutil::mapped_file assigned(other.path());
+  assigned = std::move(moved);
+  CHECK_EQ(assigned.view(), contents);
+  CHECK_THROWS(strutil::mapped_file("/nonexistent/file"), std::runtime_error);
+}
+
+TEST(maps_files_which_cannot_be_mapped) {
+  TempFile empty("");
+  CHECK_EQ(strutil::mapped_file(empty.path()).view(), "");
+  CHECK(strutil::mapped_file("/proc/self/status").view().starts_with("Name:"));
+  // a named pipe can only be read once, and not with pread
+  std::string fifo = empty.path() + ".fifo";
+  CHECK_EQ(mkfifo(fifo.c_str(), 0600), 0);
+  std::string contents = binary_contents(100000);
+  std::thread writer([&] {
+    std::ofstream(fifo, std::ios::binary).write(contents.data(), contents.size());
+  });
+  strutil::mapped_file piped(fifo);
+  writer.join();
+  std::filesystem::remove(fifo);
+  CHECK_EQ(piped.view(), contents);
+}
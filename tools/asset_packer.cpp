@@ -0,0 +1,175 @@
+/**
+ * Packs a directory into a single asset pack file which can be served with
+ * `HttpServer::mount_asset_pack`.
+ *
+ * Usage: asset_packer <directory> <output>
+ *
+ * Precompressed variants are picked up from sibling files, i.e. `app.js.gz`
+ * and `app.js.br` become the gzip and brotli variants of `app.js` instead of
+ * files of their own. Text files without a `.gz` sibling are gzipped here,
+ * like `add_static_assets` does, and the variant is kept if it is smaller
+ * than the file. Brotli variants have to be generated beforehand.
+ *
+ * The output is written to a temporary file first and then renamed over
+ * `output`, so a running server can never see a half written pack. The
+ * server maps the new pack on its next SIGHUP or
+ * `HttpServer::reloadAssetPack`.
+ */
+#include "asset_pack.hpp"
+#include "mime_types.hpp"
+#include "strutil.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+struct PackedFile {
+  std::string path;
+  std::string mime_type;
+  std::string etag;
+  std::string data;
+  std::string gzip;
+  std::string brotli;
+};
+
+/**
+ * Text types compress well and are worth spending build time on.
+ */
+static bool compressible(const std::string &extension) {
+  static const std::array<std::string_view, 11> types{
+      ".html", ".htm", ".css", ".js",  ".mjs", ".json",
+      ".map",  ".txt", ".xml", ".svg", ".wasm"};
+  return std::find(types.begin(), types.end(), extension) != types.end();
+}
+
+/**
+ * Gzips `data` at the highest compression level.
+ *
+ * @throws std::runtime_error if zlib fails
+ */
+static std::string gzip(const std::string &data) {
+  z_stream stream{};
+  // 15 window bits plus 16 selects the gzip wrapper instead of zlib's own
+  if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("deflateInit2 failed");
+  }
+  std::string out(deflateBound(&stream, data.size()), '\0');
+  stream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef *>(out.data());
+  stream.avail_out = out.size();
+  int result = deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END) {
+    throw std::runtime_error("deflate failed");
+  }
+  return out;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " <directory> <output>" << std::endl;
+    return 1;
+  }
+  fs::path root(argv[1]);
+  if (!fs::is_directory(root)) {
+    std::cerr << root << " is not a directory" << std::endl;
+    return 1;
+  }
+
+  std::vector<PackedFile> files;
+  for (const auto &entry : fs::recursive_directory_iterator(root)) {
+    if (!entry.is_regular_file()) {
+      continue;
+    }
+    fs::path path = entry.path();
+    std::string extension = path.extension();
+    // precompressed variants are attached to the file they belong to
+    if ((extension == ".gz" || extension == ".br") &&
+        fs::is_regular_file(fs::path(path).replace_extension())) {
+      continue;
+    }
+    PackedFile file;
+    file.path = fmt::format("/{}", fs::relative(path, root).generic_string());
+    file.mime_type = mime::lookup(extension);
+    file.data = strutil::slurp(path);
+    file.etag = fmt::format("\"{:016x}\"", asset_pack_hash(file.data));
+    if (fs::is_regular_file(path.string() + ".gz")) {
+      file.gzip = strutil::slurp(path.string() + ".gz");
+    } else if (compressible(extension) && !file.data.empty()) {
+      // only keep the variant if it actually saves bytes on the wire
+      std::string compressed = gzip(file.data);
+      if (compressed.size() < file.data.size()) {
+        file.gzip = std::move(compressed);
+      }
+    }
+    if (fs::is_regular_file(path.string() + ".br")) {
+      file.brotli = strutil::slurp(path.string() + ".br");
+    }
+    files.push_back(std::move(file));
+  }
+
+  std::sort(files.begin(), files.end(),
+            [](const PackedFile &a, const PackedFile &b) {
+              auto ha = asset_pack_hash(a.path), hb = asset_pack_hash(b.path);
+              return ha != hb ? ha < hb : a.path < b.path;
+            });
+
+  // Lay out the blobs right after the index
+  std::uint64_t offset =
+      sizeof(AssetPackHeader) + files.size() * sizeof(AssetPackEntry);
+  std::string blobs;
+  auto append = [&](const std::string &s) {
+    AssetPackRange range{offset + blobs.size(), s.size()};
+    blobs.append(s);
+    return range;
+  };
+  std::vector<AssetPackEntry> entries;
+  for (const PackedFile &file : files) {
+    AssetPackEntry e;
+    e.path_hash = asset_pack_hash(file.path);
+    e.path = append(file.path);
+    e.mime_type = append(file.mime_type);
+    e.etag = append(file.etag);
+    e.data = append(file.data);
+    e.gzip = append(file.gzip);
+    e.brotli = append(file.brotli);
+    entries.push_back(e);
+  }
+
+  AssetPackHeader header;
+  std::copy(std::begin(ASSET_PACK_MAGIC), std::end(ASSET_PACK_MAGIC),
+            header.magic);
+  header.version = ASSET_PACK_VERSION;
+  header.entry_count = entries.size();
+
+  std::string tmp_path = std::string(argv[2]) + ".tmp";
+  std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(entries.data()),
+            entries.size() * sizeof(AssetPackEntry));
+  out.write(blobs.data(), blobs.size());
+  out.close();
+  if (!out) {
+    std::cerr << "failed to write " << tmp_path << std::endl;
+    return 1;
+  }
+  if (std::rename(tmp_path.c_str(), argv[2]) != 0) {
+    std::perror("rename");
+    return 1;
+  }
+  std::cout << fmt::format("Packed {} files into {}\n", entries.size(),
+                           argv[2]);
+}